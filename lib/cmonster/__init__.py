@@ -26,10 +26,11 @@ if sys.version_info < (3, 2):
 # Import the extension module's contents, so we get all of the token IDs.
 from ._cmonster import *
 from ._parser import Parser
-from ._preprocessor import Preprocessor
+from ._preprocessor import Preprocessor, context_macro, pure_macro
 
 # Define the names to import from this module.
 __all__ = [
-    "ast", "Parser", "Preprocessor", "Token"
+    "ast", "context_macro", "IncludeCache", "MacroCache", "Parser",
+    "Preprocessor", "pure_macro", "SearchPathIncludeLocator", "Token"
 ] + [name for name in locals() if name.startswith("tok_")]
 
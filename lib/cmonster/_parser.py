@@ -19,11 +19,10 @@
 # SOFTWARE.
 
 from . import _cmonster
-from . import _preprocessor
 from . import config
 
 class Parser(_cmonster.Parser):
-    def __init__(self, filename, data=None):
+    def __init__(self, filename, data=None, configuration=None):
         if data is None:
             if type(filename) is str:
                 data = open(filename).read()
@@ -34,13 +33,9 @@ class Parser(_cmonster.Parser):
                     filename = filename.name
         _cmonster.Parser.__init__(self, data, filename)
 
-        # TODO allow configuration of target preprocessor/compiler.
-        pp = self.preprocessor
-        config.configure(pp)
-
-        # XXX Should this be configurable?
-        pp.add_include_dir(".", False)
-
-        # Predefined macros.
-        pp.define('py_def', _preprocessor.PyDefHandler(pp))
+        # Install the (shared) configuration: predefined macros, include
+        # directories, the include locator and "py_def".
+        if configuration is None:
+            configuration = config.default_configuration()
+        configuration.install(self.preprocessor)
 
@@ -19,36 +19,389 @@
 # SOFTWARE.
 
 
+import ast
+import collections
+import functools
+import hashlib
+import itertools
+import marshal
+import os
+import re
+import sys
+import types
+
+from ._cache import write_atomically
+from ._cmonster import tok_identifier
+
+try:
+    from importlib.util import MAGIC_NUMBER as _MAGIC_NUMBER
+except ImportError: # Python < 3.4
+    import imp
+    _MAGIC_NUMBER = imp.get_magic()
+
+
+def context_macro(fn):
+    """
+    Decorator for function macros that use the context calling convention.
+
+    Such a function is called with a single MacroContext argument, rather
+    than with one Token per macro argument. The context has "preprocessor",
+    "location" and "args" attributes; the location is only computed if it is
+    accessed, and "args" creates Token objects on access. The context (and
+    its "args") is only valid for the duration of the call.
+
+    Pragma handlers (see Preprocessor.add_pragma) may use the context
+    calling convention too, receiving the pragma's tokens as "args".
+    """
+
+    fn.__cmonster_context__ = True
+    return fn
+
+
+def pure_macro(fn):
+    """
+    Decorator for function macros whose result depends only on the kinds and
+    spellings of their arguments.
+
+    The expansions of pure macros are memoized in the preprocessor's macro
+    cache (see Preprocessor.set_macro_cache), so the function is only called
+    once for each distinct set of arguments. The result is re-lexed from its
+    spelling on a cache hit. Expansions are keyed by the decorated function,
+    so a redefinition of the macro does not see the old expansions.
+    """
+
+    fn.__cmonster_pure__ = True
+    fn.__cmonster_definition__ = "%s#%d" % (
+        getattr(fn, "__qualname__", ""), next(_definition_ids))
+    return fn
+
+
+_definition_ids = itertools.count(1)
+
+
+def _refers_to(code, name):
+    """
+    Check whether a code object, or any code nested within it, refers to a
+    global name.
+    """
+
+    if name in code.co_names:
+        return True
+    return any(_refers_to(c, name) for c in code.co_consts
+               if isinstance(c, types.CodeType))
+
+
+def _string_constant(node):
+    """
+    Get the value of a string constant node, or None if the node is not one.
+    Python < 3.8 parses string constants as ast.Str (deprecated since).
+    """
+
+    if sys.version_info < (3, 8):
+        return node.s if isinstance(node, ast.Str) else None
+    if isinstance(node, ast.Constant) and isinstance(node.value, str):
+        return node.value
+    return None
+
+
+def _template_pieces(node, params, pieces):
+    """
+    Flatten a string template expression into (is_param, text) pieces,
+    returning False if it is not a concatenation of string constants and
+    str(param), or an f-string of the same.
+    """
+
+    text = _string_constant(node)
+    if text is not None:
+        pieces.append((False, text))
+    elif isinstance(node, ast.BinOp) and isinstance(node.op, ast.Add):
+        return (_template_pieces(node.left, params, pieces) and
+                _template_pieces(node.right, params, pieces))
+    elif (isinstance(node, ast.Call) and isinstance(node.func, ast.Name) and
+          node.func.id == "str" and len(node.args) == 1 and
+          not node.keywords and isinstance(node.args[0], ast.Name) and
+          node.args[0].id in params):
+        pieces.append((True, node.args[0].id))
+    elif isinstance(node, getattr(ast, "JoinedStr", ())):
+        for value in node.values:
+            if isinstance(value, ast.FormattedValue):
+                if (value.conversion not in (-1, ord("s")) or
+                    value.format_spec is not None or
+                    not isinstance(value.value, ast.Name) or
+                    value.value.id not in params):
+                    return False
+                pieces.append((True, value.value.id))
+            elif not _template_pieces(value, params, pieces):
+                return False
+    else:
+        return False
+    return True
+
+
+_PASTE_CHARS = re.compile(r"[A-Za-z0-9_]")
+_SEPARATOR_CHARS = re.compile(r"[\s()\[\]{},;]")
+
+
+def _join_template(a, b):
+    """
+    Get the text separating two adjacent template pieces in a macro body,
+    or None if their concatenation can't be expressed there. Characters
+    that would lex as part of the same token are pasted.
+    """
+
+    if a[0] and b[0]:
+        return None
+    c = a[1][-1:] if b[0] else b[1][:1]
+    if not c or _SEPARATOR_CHARS.match(c):
+        return " "
+    if _PASTE_CHARS.match(c):
+        return " ## "
+    return None
+
+
+@functools.lru_cache(maxsize=256)
+def _template_definition(source):
+    """
+    If the py_def function in "source" is a simple string template, return
+    "#define" lines for an equivalent native macro; otherwise return None.
+
+    A template has at most one parameter (a multi-parameter py_def takes one
+    token per parameter, where a native macro splits its arguments at
+    commas), and a body that is a single return of string constants and
+    str(param), joined with "+" or in an f-string. Text adjacent to the
+    parameter that would lex as part of the same token is pasted; as in C,
+    pasting an argument that doesn't form a valid token is an error.
+    """
+
+    try:
+        function = ast.parse(source).body[0]
+    except SyntaxError:
+        return None
+    args = function.args
+    if (args.vararg or args.kwarg or args.kwonlyargs or args.defaults or
+        getattr(args, "posonlyargs", None) or len(args.args) > 1 or
+        function.decorator_list):
+        return None
+    params = [arg.arg for arg in args.args]
+
+    body = function.body
+    if (len(body) == 2 and isinstance(body[0], ast.Expr) and
+        _string_constant(body[0].value) is not None):
+        body = body[1:] # Skip the docstring.
+    if (len(body) != 1 or not isinstance(body[0], ast.Return) or
+        body[0].value is None):
+        return None
+    pieces = []
+    if not _template_pieces(body[0].value, params, pieces):
+        return None
+
+    # Merge adjacent text, which must not contain anything that means
+    # something else in a macro body.
+    merged = []
+    for is_param, text in pieces:
+        if not is_param:
+            text = text.replace("\n", " ")
+            if ("#" in text or "//" in text or "/*" in text or "\\" in text or
+                any(re.search(r"(?<!\w)%s(?!\w)" % p, text)
+                    for p in params + ["__VA_ARGS__"])):
+                return None
+            if not text:
+                continue
+            if merged and not merged[-1][0]:
+                text = merged.pop()[1] + text
+        merged.append((is_param, text))
+
+    replacement = merged[0][1] if merged else ""
+    pasted = False
+    for a, b in zip(merged, merged[1:]):
+        separator = _join_template(a, b)
+        if separator is None:
+            return None
+        pasted = pasted or separator != " "
+        replacement += separator + b[1]
+
+    name = function.name
+    signature = "(%s)" % ", ".join(params)
+    if not pasted:
+        return "#define %s%s %s\n" % (name, signature, replacement)
+
+    # The operands of "##" aren't macro expanded, whereas py_def arguments
+    # are; expanding through a second macro expands them first.
+    helper = "__cmonster_template_" + name
+    return "#define %s%s %s\n#define %s%s %s%s\n" % (
+        helper, signature, replacement, name, signature, helper, signature)
+
+
+class CodeCache(object):
+    """
+    A cache of compiled py_def functions, keyed by a hash of their source.
+
+    Code objects are kept in memory, up to "capacity" of them, and if a
+    directory is given they are also marshalled to disk, so other processes
+    can skip compilation too. The key includes the interpreter's bytecode
+    magic number, so a cache directory may be shared by different versions
+    of Python.
+    """
+
+    def __init__(self, directory=None, capacity=4096):
+        self.directory = directory
+        self.capacity = capacity
+        self.hits = 0
+        self.misses = 0
+        self.__entries = collections.OrderedDict()
+
+    def compile(self, source, key=None):
+        """
+        Get the code object for a module containing a py_def function,
+        compiling it if necessary.
+
+        If given, "key" is a sequence of strings that the source is formatted
+        from, and is hashed in place of the source; "source" may then be a
+        function that formats it, which is only called if the code must be
+        compiled.
+        """
+
+        if key is None:
+            key = (source,)
+        key = hashlib.sha1(
+            _MAGIC_NUMBER + "\0".join(key).encode("utf-8")).hexdigest()
+        code = self.__entries.get(key)
+        if code is not None:
+            self.hits += 1
+            return code
+
+        self.misses += 1
+        code = self.__load(key)
+        if code is None:
+            if callable(source):
+                source = source()
+            code = compile(source, "<cmonster>", "exec")
+            self.__store(key, code)
+        if self.capacity > 0:
+            while len(self.__entries) >= self.capacity:
+                self.__entries.popitem(last=False)
+            self.__entries[key] = code
+        return code
+
+    def info(self):
+        "Get the hit/miss counters and occupancy of the in-memory cache."
+        return {"hits": self.hits, "misses": self.misses,
+                "size": len(self.__entries), "capacity": self.capacity}
+
+    def __path(self, key):
+        return os.path.join(self.directory, "py_def-%s.bin" % key)
+
+    def __load(self, key):
+        if self.directory is None:
+            return None
+        try:
+            with open(self.__path(key), "rb") as f:
+                code = marshal.load(f)
+        except (IOError, OSError, EOFError, ValueError, TypeError):
+            return None
+        return code if isinstance(code, types.CodeType) else None
+
+    def __store(self, key, code):
+        if self.directory is not None:
+            write_atomically(self.__path(key), marshal.dumps(code))
+
+
+_default_code_cache = None
+
+
+def default_code_cache():
+    """
+    Get the code cache shared by py_def handlers in this process. Set
+    CMONSTER_PY_DEF_CACHE_DIR to also keep compiled py_def functions on disk.
+    """
+
+    global _default_code_cache
+    if _default_code_cache is None:
+        directory = os.environ.get("CMONSTER_PY_DEF_CACHE_DIR") or None
+        _default_code_cache = CodeCache(directory)
+    return _default_code_cache
+
+
 class PyDefHandler(object):
-    def __init__(self, preprocessor):
+    def __init__(self, preprocessor, code_cache=None, templates=True):
+        """
+        code_cache is the CodeCache used to compile py_def functions; by
+        default, the cache shared by the process is used.
+
+        If templates is true, py_def functions that are simple string
+        templates are defined as native macros, which expand without
+        calling into Python.
+        """
         self.__preprocessor = preprocessor
+        if code_cache is None:
+            code_cache = default_code_cache()
+        self.__code_cache = code_cache
+        self.__templates = templates
 
     def __call__(self, *signature_tokens):
         """
         Callback method for handling "py_def" pragmas.
+
+        "py_def pure NAME(...)" defines a pure macro (see pure_macro).
         """
 
-        # Grab all of the tokens up to and including the "py_end" token.
-        body = []
-        while True:
-            tok = self.next(False) # Get next unexpanded token
-            if tok.token_id == tok_identifier and str(tok) == "py_end":
-                break
-            body.append(tok)
-
-        # Format the Python function.
-        signature = self.__preprocessor.format_tokens(signature_tokens)
-        body = self.__preprocessor.format_tokens(body)
-        function_source = "def %s:\n%s" % (signature, body)
-
-        # Compile the Python function.
-        code = compile(function_source, "<cmonster>", "exec")
+        pure = (len(signature_tokens) > 1 and
+                str(signature_tokens[0]) == "pure" and
+                signature_tokens[1].token_id == tok_identifier)
+        if pure:
+            signature_tokens = signature_tokens[1:]
+
+        # Grab the source text up to the "py_end" token, consuming it.
+        body = self.__preprocessor.read_until("py_end")
+        spellings = [str(token) for token in signature_tokens]
+        name = spellings[0]
+
+        # Define simple string templates natively. A template's signature is
+        # "NAME()" or "NAME(param)", so its source is formatted directly. If a
+        # different macro of the same name (or of its helper's name) exists,
+        # nothing is defined, and the function is defined as usual.
+        if (self.__templates and len(spellings) in (3, 4) and
+            spellings[1] == "(" and spellings[-1] == ")"):
+            definition = _template_definition("def %s(%s):\n%s" % (
+                name, "".join(spellings[2:-1]), body))
+            if definition is not None:
+                if self.__preprocessor.load_macro_buffer(
+                        definition, atomic=True):
+                    return
+
+        # Compile the Python function, or fetch it from the cache. The cache
+        # is keyed by the signature's spellings and the body, so the function
+        # is only formatted if it must be compiled.
+        def format_source():
+            signature = self.__preprocessor.format_tokens(signature_tokens)
+            return "def %s:\n%s" % (signature, body)
+        key = spellings + [body]
+        code = self.__code_cache.compile(format_source, key)
+
+        # The body gets its own globals, so "preprocessor" is bound once
+        # here, and "location" is only computed for each expansion if the
+        # body refers to it.
+        globals_ = {"preprocessor": self.__preprocessor}
         locals_ = {}
-        eval(code, globals(), locals_)
-        fn = locals_[str(signature_tokens[0])]
+        eval(code, globals_, locals_)
+        fn = locals_[name]
+
+        if _refers_to(code, "location"):
+            def macro(context):
+                globals_["location"] = context.location
+                return fn(*context.args)
+        else:
+            def macro(context):
+                return fn(*context.args)
+        macro.__name__ = name
+
+        # Pure macros defined from the same source expand identically, so
+        # they may share memoized expansions.
+        macro.__cmonster_definition__ = hashlib.sha1(
+            "\0".join(key).encode("utf-8")).hexdigest()
 
         # Define the macro.
-        self.__preprocessor.define(fn)
+        self.__preprocessor.define(context_macro(macro), pure=pure)
 
 
 def Preprocessor(*args, **kwargs):
@@ -30,6 +30,9 @@ def cli_main():
         "-I", action="append", dest="include_dirs")
     parser.add_argument(
         "-D", action="append", dest="defines")
+    parser.add_argument(
+        "--plugin", action="append", dest="plugins", metavar="PATH",
+        help="load native macros from a cmonster plugin (shared object)")
     args = parser.parse_args()
 
     # Create the preprocessor.
@@ -48,5 +51,8 @@ def cli_main():
             else:
                 name, value = define[:assign], define[assign+1:]
                 parser.preprocessor.define(name, value)
+    if args.plugins:
+        for plugin in args.plugins:
+            parser.preprocessor.load_plugin(plugin)
     parser.preprocessor.preprocess()
 
@@ -18,8 +18,94 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
-def configure(preprocessor):
+from .. import _cmonster
+
+
+class Configuration(_cmonster.Configuration):
+    """
+    A preprocessor configuration, built once and installed into any number of
+    preprocessors.
+
+    The predefined macros and include directories are held natively, and are
+    installed with a single call to Preprocessor.configure. In addition, a
+    configuration may create an include locator for each preprocessor,
+    define the "py_def" pragma, and share macro and include caches between
+    preprocessors.
+    """
+
+    def __init__(self, include_locator=None, py_def=False, macro_cache=None,
+                 include_cache=None, include_locator_first=()):
+        """
+        include_locator, if specified, is called with each preprocessor the
+        configuration is installed into, and should return an include locator
+        for it.
+
+        include_locator_first is a sequence of include prefixes, such as
+        "generated/", whose includes are given to the include locator without
+        searching the include directories first.
+
+        macro_cache, if specified, is a MacroCache used by every preprocessor
+        the configuration is installed into, so the expansions of pure macros
+        are shared between them. Otherwise, each preprocessor has a cache of
+        its own.
+
+        include_cache, if specified, is an IncludeCache used by every
+        preprocessor the configuration is installed into, so each include is
+        only located once. The include locators must then be equivalent.
+        """
+        _cmonster.Configuration.__init__(self)
+        self.include_locator = include_locator
+        self.py_def = py_def
+        self.macro_cache = macro_cache
+        self.include_cache = include_cache
+        self.include_locator_first = include_locator_first
+
+    def install(self, preprocessor):
+        "Install the configuration into a preprocessor."
+        preprocessor.configure(self)
+        if self.macro_cache is not None:
+            preprocessor.set_macro_cache(self.macro_cache)
+        if self.include_locator is not None:
+            preprocessor.set_include_locator(
+                self.include_locator(preprocessor))
+            if self.include_locator_first:
+                preprocessor.set_include_locator_priority(
+                    first=self.include_locator_first)
+        if self.include_cache is not None:
+            preprocessor.set_include_cache(self.include_cache)
+        if self.py_def:
+            from .._preprocessor import PyDefHandler
+            preprocessor.define("py_def", PyDefHandler(preprocessor))
+
+
+_default_configuration = None
+
+
+def default_configuration():
+    """
+    Get the configuration used by Parser when none is specified. It is
+    created on first use, and shared thereafter.
+    """
+
+    global _default_configuration
+    if _default_configuration is None:
+        # TODO make configurable/detectable
+        from . import gcc
+        config = gcc.create_configuration()
+        # XXX Should this be configurable?
+        config.add_include_dir(".", False)
+        config.py_def = True
+        _default_configuration = config
+    return _default_configuration
+
+
+def configure(preprocessor, include_locator="compiler"):
+    """
+    Configure a preprocessor for the system compiler. include_locator is
+    "compiler" to locate missing includes by running the compiler, or
+    "search" to search the compiler's include directories natively.
+    """
+
     # TODO make configurable/detectable
     from . import gcc
-    gcc.configure(preprocessor)
-
+    gcc.configure(preprocessor, include_locator=include_locator)
@@ -18,35 +18,179 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+import atexit
+import hashlib
+import json
 import os
 import subprocess
 
+from .. import _cmonster
+from .._cache import cache_dir, write_atomically
 
-def _get_predefined_macros(executable):
-    "Determine the predefined macros for gcc/g++."
+
+# Bump this when the format of cached profiles changes.
+_PROFILE_VERSION = 2
+
+# Profiles loaded by this process, keyed by (executable, language).
+_profiles = {}
+
+
+def _find_executable(executable):
+    "Find the absolute path of an executable, searching PATH if necessary."
+    if os.path.dirname(executable):
+        return os.path.abspath(executable)
+    for dir_ in os.environ.get("PATH", os.defpath).split(os.pathsep):
+        path = os.path.join(dir_, executable)
+        if os.path.isfile(path) and os.access(path, os.X_OK):
+            return path
+    raise RuntimeError("Failed to find compiler: %s" % executable)
+
+
+def _parse_search_dirs(output):
+    "Parse the system include directories from the output of 'gcc -E -v'."
+    dirs = []
+    in_list = False
+    for line in output.splitlines():
+        if line.startswith("#include <...> search starts here:"):
+            in_list = True
+        elif line.startswith("End of search list."):
+            break
+        elif in_list and line.startswith(" "):
+            path = line.strip()
+            # Darwin lists framework directories, which we can't use.
+            if not path.endswith("(framework directory)"):
+                dirs.append(os.path.normpath(path))
+    return dirs
+
+
+def _parse_version(output):
+    "Parse the version line (e.g. 'gcc version 4.6.1') from 'gcc -v' output."
+    for line in output.splitlines():
+        if " version " in line:
+            return line.strip()
+    return ""
+
+
+def _discover_profile(executable, language):
+    """
+    Determine the predefined macros and system include directories for
+    gcc/g++, with a single invocation of the compiler.
+    """
     proc = subprocess.Popen(
-        [executable, "-E", "-dM", "-"],
+        [executable, "-x", language, "-E", "-dM", "-v", "-"],
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         stdin=subprocess.PIPE)
     stdout, stderr = proc.communicate()
+    stderr = stderr.decode(errors="replace")
     if proc.returncode != 0:
         msg = "Failed to determine predefined macros:\n%s" % stderr
         raise RuntimeError(msg)
-    for line in stdout.splitlines():
-        line = line.decode()[len("#define "):].rstrip()
-        space = line.find(" ")
-        macro = (line[:space], line[space+1:])
-        yield macro
+    return {"predefines": stdout.decode(),
+            "include_dirs": _parse_search_dirs(stderr),
+            "version": _parse_version(stderr)}
+
+
+def _read_profile(path):
+    "Read a cached profile, returning None if it is missing or unreadable."
+    try:
+        with open(path) as f:
+            data = json.load(f)
+    except (IOError, OSError, ValueError):
+        return None
+    if not isinstance(data, dict) or \
+       not isinstance(data.get("predefines"), str) or \
+       not isinstance(data.get("include_dirs"), list) or \
+       not isinstance(data.get("version"), str):
+        return None
+    return data
+
+
+def _write_profile(path, data):
+    "Cache a profile. Failure to write the cache is not an error."
+    write_atomically(path, json.dumps(data).encode())
+
+
+class Profile:
+    """
+    The predefined macros and system include directories of a gcc/g++
+    executable, for a given language.
+
+    Nothing is discovered until one of the properties is first accessed.
+    Discovered profiles are cached on disk, keyed by the executable's path,
+    modification time and size, and the language, so the compiler is only
+    run again when it changes. A wrapper script whose underlying compiler
+    changes must be touched for its profile to be discovered again. Set
+    CMONSTER_CACHE_DIR to change where the cache is kept.
+    """
+
+    def __init__(self, executable="g++", language="c++"):
+        self.executable = executable
+        self.language = language
+        self.__data = None
+        self.__key = None
+
+    @property
+    def predefines(self):
+        "The predefined macros, as a buffer of #define directives."
+        return self.__load()["predefines"]
+
+    @property
+    def include_dirs(self):
+        "The system include directories, in search order."
+        return self.__load()["include_dirs"]
+
+    @property
+    def version(self):
+        "The compiler's version, as reported by '-v'."
+        return self.__load()["version"]
+
+    @property
+    def key(self):
+        """
+        A key identifying the executable, as it was when the key was first
+        requested, and the language.
+        """
+        if self.__key is None:
+            path = _find_executable(self.executable)
+            stat = os.stat(path)
+            key = "\0".join(map(str, (
+                _PROFILE_VERSION, path, stat.st_mtime, stat.st_size,
+                self.language)))
+            self.__key = hashlib.sha1(key.encode()).hexdigest()
+        return self.__key
+
+    def __load(self):
+        if self.__data is None:
+            path = os.path.join(cache_dir(), "gcc-%s.json" % self.key)
+            data = _read_profile(path)
+            if data is None:
+                data = _discover_profile(self.executable, self.language)
+                _write_profile(path, data)
+            self.__data = data
+        return self.__data
+
+
+def get_profile(executable="g++", language="c++"):
+    """
+    Get the (lazily discovered) profile for a gcc/g++ executable and
+    language. Profiles are shared by all callers within a process.
+    """
+    key = (executable, language)
+    profile = _profiles.get(key)
+    if profile is None:
+        profile = _profiles[key] = Profile(executable, language)
+    return profile
 
 
 class IncludeLocator:
     """
     An "include locator" that consults GCC for the location of an include
     file.
-    
-    On success, the parent directory will be added to the preprocessor as a
-    system include directory.
+
+    The locator leaves the preprocessor's include directories alone, as they
+    form part of the key for cached results; the compiler's own directories
+    are configured up front by the profile.
     """
 
     def __init__(self, preprocessor, executable):
@@ -74,28 +218,87 @@ class IncludeLocator:
                 assert end > start
                 path = line[start+1:end].decode()
 
-                # Add the parent directory to the preprocessor's
-                # system include paths.
                 norm_include = os.path.normpath(include[1:-1])
                 abs_path = os.path.abspath(path)
                 assert abs_path.endswith(norm_include)
-                include_dir = abs_path[:-len(norm_include)-1]
-                self.__preprocessor.add_include_dir(include_dir, True)
-
-                # Return the 
                 return abs_path
 
 
-def configure(preprocessor, executable="g++"):
+def _save_include_cache(cache, path):
+    "Save an include cache, if it has changed. Failure is not an error."
+    if cache.modified():
+        try:
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            cache.save(path)
+        except (OSError, RuntimeError):
+            pass
+
+
+def _load_include_cache(profile):
     """
-    Add the gcc/g++ predefined macros and system include paths to the cmonster
-    preprocessor object.
+    Get an include cache for the IncludeLocator of a profile's executable,
+    loaded from disk, and saved back to disk when the process exits.
     """
+    cache = _cmonster.IncludeCache()
+    path = os.path.join(cache_dir(), "includes-%s.bin" % profile.key)
+    cache.load(path)
+    atexit.register(_save_include_cache, cache, path)
+    return cache
 
-    # Define builtin macros.
-    for (name, value) in _get_predefined_macros(executable):
-        preprocessor.define(name, value)
 
-    # Add an include locator.
-    preprocessor.set_include_locator(IncludeLocator(preprocessor, executable))
+# Configurations created by configure(), keyed by (executable, language,
+# include_locator).
+_configurations = {}
+
+
+def create_configuration(executable="g++", language="c++",
+                         persist_includes=True, include_locator="compiler"):
+    """
+    Create a cmonster Configuration holding the gcc/g++ predefined macros and
+    system include paths, with an include locator as a fallback for locating
+    includes.
+
+    If include_locator is "compiler", includes are located by running the
+    compiler (see IncludeLocator). Its results are cached, so each distinct
+    include is only located this way once. If persist_includes is true, the
+    cache is kept on disk (see Profile), and shared with other processes.
+
+    If include_locator is "search", includes are located natively by a
+    SearchPathIncludeLocator, over the compiler's include search list.
+    """
+
+    from . import Configuration
+    profile = get_profile(executable, language)
+    if include_locator == "compiler":
+        if persist_includes:
+            include_cache = _load_include_cache(profile)
+        else:
+            include_cache = _cmonster.IncludeCache()
+        config = Configuration(
+            include_locator=lambda pp: IncludeLocator(pp, executable),
+            include_cache=include_cache)
+    elif include_locator == "search":
+        locator = _cmonster.SearchPathIncludeLocator(profile.include_dirs)
+        config = Configuration(include_locator=lambda pp: locator)
+    else:
+        raise ValueError("Unknown include locator: %r" % include_locator)
+    config.load_macro_buffer(profile.predefines)
+    for include_dir in profile.include_dirs:
+        config.add_include_dir(include_dir, True)
+    return config
+
+
+def configure(preprocessor, executable="g++", language="c++",
+              include_locator="compiler"):
+    """
+    Add the gcc/g++ predefined macros and system include paths to the cmonster
+    preprocessor object. include_locator selects how includes are located
+    when the preprocessor's own search fails (see create_configuration).
+    """
 
+    key = (executable, language, include_locator)
+    config = _configurations.get(key)
+    if config is None:
+        config = _configurations[key] = create_configuration(
+            executable, language, include_locator=include_locator)
+    config.install(preprocessor)
@@ -57,25 +57,41 @@ class build_ext(Cython.Distutils.build_ext):
 _cmonster_extension = Extension(
     "cmonster._cmonster",
     [
+        "src/cmonster/core/impl/configuration.cpp",
         "src/cmonster/core/impl/exception_diagnostic_client.cpp",
+        "src/cmonster/core/impl/include_cache.cpp",
         "src/cmonster/core/impl/include_locator_impl.cpp",
         "src/cmonster/core/impl/function_macro.cpp",
+        "src/cmonster/core/impl/header_index.cpp",
+        "src/cmonster/core/impl/macro_cache.cpp",
+        "src/cmonster/core/impl/macro_expander.cpp",
         "src/cmonster/core/impl/parser.cpp",
         "src/cmonster/core/impl/parse_result.cpp",
+        "src/cmonster/core/impl/pipelined_token_iterator.cpp",
+        "src/cmonster/core/impl/plugin.cpp",
         "src/cmonster/core/impl/preprocessor_impl.cpp",
+        "src/cmonster/core/impl/search_path_include_locator.cpp",
+        "src/cmonster/core/impl/token_arena.cpp",
+        "src/cmonster/core/impl/token_batch.cpp",
         "src/cmonster/core/impl/token_iterator.cpp",
         "src/cmonster/core/impl/token_predicate.cpp",
+        "src/cmonster/core/impl/token_stream.cpp",
         "src/cmonster/core/impl/token.cpp",
 
+        "src/cmonster/python/configuration.cpp",
         "src/cmonster/python/exception.cpp",
+        "src/cmonster/python/include_cache.cpp",
         "src/cmonster/python/include_locator.cpp",
         "src/cmonster/python/function_macro.cpp",
+        "src/cmonster/python/macro_cache.cpp",
+        "src/cmonster/python/macro_context.cpp",
         "src/cmonster/python/module.cpp",
         "src/cmonster/python/parser.cpp",
         "src/cmonster/python/parse_result.cpp",
         "src/cmonster/python/preprocessor.cpp",
         "src/cmonster/python/pyfile_ostream.cpp",
         "src/cmonster/python/rewriter.cpp",
+        "src/cmonster/python/search_path_include_locator.cpp",
         "src/cmonster/python/source_location.cpp",
         "src/cmonster/python/token.cpp",
         "src/cmonster/python/token_iterator.cpp",
@@ -126,6 +142,8 @@ _cmonster_extension = Extension(
         "LLVMMC",
         "LLVMSupport",
         "LLVMCore",
+        "boost_thread",
+        "boost_system",
         "pthread",
         "dl"
     ],
@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_BOUNDED_CACHE_HPP
+#define _CMONSTER_CORE_BOUNDED_CACHE_HPP
+
+#include "cache_stats.hpp"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <deque>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A bounded map from strings to values, which evicts the oldest entry when
+ * it is full, and counts hits and misses. It is not thread-safe.
+ */
+template <typename Value>
+class BoundedCache
+{
+public:
+    explicit BoundedCache(size_t capacity)
+      : m_entries(), m_order(), m_capacity(capacity), m_hits(0), m_misses(0)
+    {}
+
+    /**
+     * Look up the value for a key, counting a hit or a miss.
+     *
+     * @return The cached value, or NULL if the key is not cached. The result
+     *         is invalidated by the next call to insert().
+     */
+    const Value* find(llvm::StringRef key)
+    {
+        if (m_capacity == 0)
+            return NULL;
+        typename Map::const_iterator iter = m_entries.find(key);
+        if (iter == m_entries.end())
+        {
+            ++m_misses;
+            return NULL;
+        }
+        ++m_hits;
+        return &iter->getValue();
+    }
+
+    /**
+     * Cache the value for a key, evicting the oldest entry if the cache is
+     * full. A key that is already cached keeps its value.
+     */
+    void insert(llvm::StringRef key, Value const& value)
+    {
+        if (m_capacity == 0 || m_entries.count(key))
+            return;
+        while (m_entries.size() >= m_capacity && !m_order.empty())
+            evict_oldest();
+
+        // The key is copied into the map entry, so refer to that copy in the
+        // eviction order rather than the caller's string.
+        llvm::StringMapEntry<Value> &entry =
+            m_entries.GetOrCreateValue(key, value);
+        m_order.push_back(entry.getKey());
+    }
+
+    /**
+     * Set the maximum number of entries, evicting entries as necessary. A
+     * capacity of zero disables the cache.
+     */
+    void set_capacity(size_t capacity)
+    {
+        m_capacity = capacity;
+        while (m_entries.size() > m_capacity && !m_order.empty())
+            evict_oldest();
+    }
+
+    /**
+     * Remove all entries, retaining the counters.
+     */
+    void clear()
+    {
+        m_entries.clear();
+        m_order.clear();
+    }
+
+    CacheStats stats() const
+    {
+        CacheStats stats;
+        stats.hits = m_hits;
+        stats.misses = m_misses;
+        stats.size = m_entries.size();
+        stats.capacity = m_capacity;
+        return stats;
+    }
+
+private:
+    typedef llvm::StringMap<Value> Map;
+
+    void evict_oldest()
+    {
+        typename Map::iterator iter = m_entries.find(m_order.front());
+        m_order.pop_front();
+        if (iter != m_entries.end())
+            m_entries.erase(iter);
+    }
+
+    Map                          m_entries;
+    std::deque<llvm::StringRef>  m_order;
+    size_t                       m_capacity;
+    size_t                       m_hits;
+    size_t                       m_misses;
+};
+
+}}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_CONFIGURATION_HPP
+#define _CMONSTER_CORE_CONFIGURATION_HPP
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A reusable preprocessor configuration: predefined macros and include
+ * directories, built once and installed into any number of preprocessors
+ * with Preprocessor::configure().
+ *
+ * Macros are accumulated as a buffer of "#define" directives, which is
+ * handed to Clang as part of the predefines buffer, so installing a
+ * configuration defines no macros itself. Each definition is guarded with
+ * "#ifndef", so macros already defined when the predefines are processed,
+ * i.e. Clang's builtins and those defined on the preprocessor, are kept.
+ */
+class Configuration
+{
+public:
+    Configuration();
+
+    /**
+     * Append a buffer of directives (e.g. the output of "gcc -E -dM") to the
+     * predefines.
+     */
+    void add_predefines(const char *s, size_t len);
+
+    /**
+     * Add a macro definition to the predefines. Equivalent to
+     * "#define name value".
+     */
+    void define(std::string const& name, std::string const& value = "");
+
+    /**
+     * Add an include directory.
+     *
+     * @param path The include directory path to add.
+     * @param sysinclude True if path is a system include directory.
+     */
+    void add_include_dir(std::string const& path, bool sysinclude = true);
+
+    std::string const& predefines() const {return m_predefines;}
+
+    std::vector<std::string> const& user_include_dirs() const
+    {
+        return m_user_include_dirs;
+    }
+
+    std::vector<std::string> const& system_include_dirs() const
+    {
+        return m_system_include_dirs;
+    }
+
+private:
+    std::string              m_predefines;
+    std::vector<std::string> m_user_include_dirs;
+    std::vector<std::string> m_system_include_dirs;
+};
+
+}}
+
+#endif
@@ -27,6 +27,7 @@ SOFTWARE.
 
 #include <clang/Basic/SourceLocation.h>
 
+#include <string>
 #include <vector>
 
 namespace cmonster {
@@ -42,11 +43,21 @@ public:
 
     /**
      * Invoke the function, given a (possibly empty) list of arguments
-     * (tokens), and returning a (possibly empty) list of tokens.
+     * (tokens). The (possibly empty) list of result tokens is appended to
+     * "result".
      */
-    virtual std::vector<Token>
+    virtual void
     operator()(clang::SourceLocation const& location,
-               std::vector<Token> const& args) const = 0;
+               std::vector<Token> const& args,
+               std::vector<Token> &result) const = 0;
+
+    /**
+     * Get a string identifying the function's definition, which keys the
+     * memoized expansions of a pure macro. Functions with the same
+     * non-empty definition must expand identically; if it is empty (the
+     * default), each definition of the macro is distinct.
+     */
+    virtual std::string definition() const;
 };
 
 }}
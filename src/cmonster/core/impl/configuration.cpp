@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../configuration.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+bool is_identifier_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+           c == '$';
+}
+
+/**
+ * Get the name of the macro defined by a "#define" directive, or an empty
+ * string if "line" is not one.
+ */
+std::string defined_name(const char *line, const char *end)
+{
+    const char *pos = line;
+    while (pos != end && (*pos == ' ' || *pos == '\t'))
+        ++pos;
+    if (pos == end || *pos++ != '#')
+        return std::string();
+    while (pos != end && (*pos == ' ' || *pos == '\t'))
+        ++pos;
+    const size_t define_len = std::strlen("define");
+    if (static_cast<size_t>(end - pos) <= define_len ||
+        std::strncmp(pos, "define", define_len) != 0 ||
+        (pos[define_len] != ' ' && pos[define_len] != '\t'))
+    {
+        return std::string();
+    }
+    pos += define_len;
+    while (pos != end && (*pos == ' ' || *pos == '\t'))
+        ++pos;
+    const char *name = pos;
+    while (pos != end && is_identifier_char(*pos))
+        ++pos;
+    return std::string(name, pos);
+}
+
+}
+
+namespace cmonster {
+namespace core {
+
+Configuration::Configuration()
+  : m_predefines(), m_user_include_dirs(), m_system_include_dirs() {}
+
+void Configuration::add_predefines(const char *s, size_t len)
+{
+    const char *const end = s + len;
+    while (s && s != end)
+    {
+        // A directive continues over escaped newlines.
+        const char *line_end = s;
+        while (line_end != end &&
+               (*line_end != '\n' ||
+                (line_end != s && line_end[-1] == '\\')))
+        {
+            ++line_end;
+        }
+
+        const std::string name = defined_name(s, line_end);
+        if (!name.empty())
+            m_predefines.append("#ifndef " + name + "\n");
+        m_predefines.append(s, line_end);
+        m_predefines.push_back('\n');
+        if (!name.empty())
+            m_predefines.append("#endif\n");
+        s = line_end == end ? end : line_end + 1;
+    }
+}
+
+void Configuration::define(std::string const& name, std::string const& value)
+{
+    // Newlines would end the directive early.
+    std::string directive = "#define " + name;
+    if (!value.empty())
+    {
+        const size_t start = directive.size() + 1;
+        directive += " " + value;
+        std::replace(directive.begin() + start, directive.end(), '\n', ' ');
+    }
+    add_predefines(directive.data(), directive.size());
+}
+
+void Configuration::add_include_dir(std::string const& path, bool sysinclude)
+{
+    std::vector<std::string> &dirs =
+        sysinclude ? m_system_include_dirs : m_user_include_dirs;
+    if (std::find(dirs.begin(), dirs.end(), path) == dirs.end())
+        dirs.push_back(path);
+}
+
+}}
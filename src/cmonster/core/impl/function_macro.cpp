@@ -29,5 +29,10 @@ FunctionMacro::~FunctionMacro()
 {
 }
 
+std::string FunctionMacro::definition() const
+{
+    return std::string();
+}
+
 }}
 
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "header_index.hpp"
+
+#include <dirent.h>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+bool has_include_prefix(llvm::StringRef include,
+                        std::vector<std::string> const& prefixes)
+{
+    for (std::vector<std::string>::const_iterator iter = prefixes.begin();
+         iter != prefixes.end(); ++iter)
+    {
+        if (include.startswith(*iter))
+            return true;
+    }
+    return false;
+}
+
+void index_directory(std::string const& path, llvm::StringSet<> &names)
+{
+    DIR *d = opendir(path.c_str());
+    if (!d)
+        return;
+    while (struct dirent *entry = readdir(d))
+        names.insert(entry->d_name);
+    closedir(d);
+}
+
+HeaderIndex::HeaderIndex() : m_dirs(), m_prefixes(), m_bypass(0) {}
+
+void HeaderIndex::set_directories(std::vector<std::string> const& dirs,
+                                  bool index)
+{
+    Map old_dirs;
+    std::swap(old_dirs, m_dirs);
+    for (std::vector<std::string>::const_iterator iter = dirs.begin();
+         iter != dirs.end(); ++iter)
+    {
+        Directory &dir = m_dirs[*iter];
+        if (!index || dir.indexed)
+            continue;
+        dir.indexed = true;
+
+        Map::iterator old = old_dirs.find(*iter);
+        if (old != old_dirs.end() && old->getValue().indexed)
+        {
+            std::swap(dir.names, old->getValue().names);
+            continue;
+        }
+
+        // A directory that can't be read has an empty index, so nothing is
+        // found in it.
+        index_directory(*iter, dir.names);
+    }
+}
+
+void
+HeaderIndex::set_located_prefixes(std::vector<std::string> const& prefixes)
+{
+    m_prefixes = prefixes;
+}
+
+HeaderIndex::Bypass::Bypass(HeaderIndex *index) : m_index(index)
+{
+    if (m_index)
+        ++m_index->m_bypass;
+}
+
+HeaderIndex::Bypass::~Bypass()
+{
+    if (m_index)
+        --m_index->m_bypass;
+}
+
+clang::FileSystemStatCache::LookupResult
+HeaderIndex::getStat(const char *path, struct stat &stat_buf)
+{
+    // Look up the include that follows each prefix of the path that is a
+    // search directory.
+    if (m_bypass == 0 && !m_dirs.empty())
+    {
+        bool located = false, searched = false;
+        llvm::StringRef path_ref(path);
+        for (size_t slash = path_ref.find('/', 1);
+             slash != llvm::StringRef::npos;
+             slash = path_ref.find('/', slash + 1))
+        {
+            Map::const_iterator iter = m_dirs.find(path_ref.substr(0, slash));
+            if (iter == m_dirs.end())
+                continue;
+
+            // The file doesn't exist if any index lacks the first component.
+            llvm::StringRef include = path_ref.substr(slash + 1);
+            Directory const& dir = iter->getValue();
+            llvm::StringRef component = include.substr(0, include.find('/'));
+            if (dir.indexed && !component.empty() &&
+                !dir.names.count(component))
+            {
+                return CacheMissing;
+            }
+
+            if (has_include_prefix(include, m_prefixes))
+                located = true;
+            else
+                searched = true;
+        }
+
+        // Only a probe for a located include in every search directory that
+        // contains it is sure to be one.
+        if (located && !searched)
+            return CacheMissing;
+    }
+    return statChained(path, stat_buf);
+}
+
+}}}
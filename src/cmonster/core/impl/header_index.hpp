@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_HEADER_INDEX_HPP
+#define _CMONSTER_CORE_IMPL_HEADER_INDEX_HPP
+
+#include <clang/Basic/FileSystemStatCache.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * Check whether an include, without delimiters, starts with one of a list
+ * of prefixes.
+ */
+bool has_include_prefix(llvm::StringRef include,
+                        std::vector<std::string> const& prefixes);
+
+/**
+ * Add the names of a directory's entries to a set. These include "." and
+ * "..", so that includes such as "./a.h" are found. A directory that can't
+ * be read adds nothing.
+ */
+void index_directory(std::string const& path, llvm::StringSet<> &names);
+
+/**
+ * A view of the header search directories, installed as the FileManager's
+ * first stat cache.
+ *
+ * Header search probes each directory in turn, with a stat() of the
+ * directory joined with the include's path. For a path within a search
+ * directory, the index answers "missing" itself if the directory is indexed
+ * and does not contain the include's first component, or if the include
+ * starts with one of the "located" prefixes, which are left to the include
+ * locator. Either way, the probe costs a hash lookup rather than a system
+ * call.
+ *
+ * The stat cache isn't told the include being searched for, so a path
+ * within nested search directories is only taken to be a probe for a
+ * located include if it is one for each of the directories. Paths that are
+ * not header search probes must be looked up within a Bypass.
+ *
+ * Files created in an indexed directory after it is indexed are not seen.
+ */
+class HeaderIndex : public clang::FileSystemStatCache
+{
+public:
+    HeaderIndex();
+
+    /**
+     * Set the search directories, indexing the names in each if "index" is
+     * true. Existing indices of the directories are kept.
+     */
+    void set_directories(std::vector<std::string> const& dirs, bool index);
+
+    /**
+     * Set the include prefixes whose probes are answered "missing".
+     */
+    void set_located_prefixes(std::vector<std::string> const& prefixes);
+
+    /**
+     * Suspends the index while in scope, so that files are looked up as
+     * usual. A NULL index is ignored.
+     */
+    class Bypass
+    {
+    public:
+        explicit Bypass(HeaderIndex *index);
+        ~Bypass();
+    private:
+        Bypass(Bypass const&);
+        Bypass& operator=(Bypass const&);
+        HeaderIndex *m_index;
+    };
+
+protected:
+    LookupResult getStat(const char *path, struct stat &stat_buf);
+
+private:
+    struct Directory
+    {
+        Directory() : indexed(false), names() {}
+        bool              indexed;
+        llvm::StringSet<> names;
+    };
+    typedef llvm::StringMap<Directory> Map;
+
+    Map                      m_dirs;
+    std::vector<std::string> m_prefixes;
+    unsigned int             m_bypass;
+};
+
+}}}
+
+#endif
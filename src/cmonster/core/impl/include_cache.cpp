@@ -0,0 +1,190 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../include_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+// Bump the version when the format of saved caches changes. Each entry is
+// saved as "<key length> <path length> <time>\n<key><path>\n".
+const char *const FILE_HEADER = "cmonster-include-cache 2";
+
+}
+
+IncludeCache::IncludeCache(unsigned negative_ttl)
+  : m_mutex(), m_entries(), m_negative_ttl(negative_ttl), m_hits(0),
+    m_misses(0), m_modified(false) {}
+
+bool IncludeCache::find(llvm::StringRef key, bool &located, std::string &path)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    Map::const_iterator iter = m_entries.find(key);
+    if (iter == m_entries.end() ||
+        expired(iter->getValue(), std::time(NULL)))
+    {
+        ++m_misses;
+        return false;
+    }
+    ++m_hits;
+    located = !iter->getValue().path.empty();
+    path = iter->getValue().path;
+    return true;
+}
+
+void
+IncludeCache::insert(llvm::StringRef key, bool located, llvm::StringRef path)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    Entry &entry = m_entries[key];
+    entry.path = located ? path.str() : std::string();
+    entry.time = std::time(NULL);
+    m_modified = true;
+}
+
+void IncludeCache::set_negative_ttl(unsigned negative_ttl)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_negative_ttl = negative_ttl;
+}
+
+bool IncludeCache::expired(Entry const& entry, std::time_t now) const
+{
+    return entry.path.empty() &&
+           (now < entry.time ||
+            now - entry.time >= static_cast<std::time_t>(m_negative_ttl));
+}
+
+void IncludeCache::clear()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_entries.clear();
+}
+
+size_t IncludeCache::load(std::string const& filename)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return load_locked(filename);
+}
+
+size_t IncludeCache::load_locked(std::string const& filename)
+{
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    if (!std::getline(in, line) || line != FILE_HEADER)
+        return 0;
+
+    size_t count = 0;
+    const std::time_t now = std::time(NULL);
+    std::string key;
+    Entry entry;
+    while (std::getline(in, line))
+    {
+        std::istringstream lengths(line);
+        size_t key_length, path_length;
+        if (!(lengths >> key_length >> path_length >> entry.time))
+            break;
+        key.resize(key_length);
+        entry.path.resize(path_length);
+        if ((key_length && !in.read(&key[0], key_length)) ||
+            (path_length && !in.read(&entry.path[0], path_length)) ||
+            in.get() != '\n')
+        {
+            break;
+        }
+        if (!expired(entry, now) && !m_entries.count(key))
+        {
+            m_entries[key] = entry;
+            ++count;
+        }
+    }
+    return count;
+}
+
+void IncludeCache::save(std::string const& filename)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    load_locked(filename);
+
+    std::ostringstream tmp_filename;
+    tmp_filename << filename << "." << getpid() << ".tmp";
+    {
+        std::ofstream out(tmp_filename.str().c_str(),
+                          std::ios::out | std::ios::binary);
+        out << FILE_HEADER << '\n';
+        const std::time_t now = std::time(NULL);
+        for (Map::const_iterator iter = m_entries.begin();
+             iter != m_entries.end(); ++iter)
+        {
+            if (expired(iter->getValue(), now))
+                continue;
+            llvm::StringRef key = iter->getKey();
+            std::string const& path = iter->getValue().path;
+            out << key.size() << ' ' << path.size() << ' '
+                << iter->getValue().time << '\n';
+            out.write(key.data(), key.size());
+            out.write(path.data(), path.size());
+            out << '\n';
+        }
+        out.close();
+        if (!out)
+        {
+            std::remove(tmp_filename.str().c_str());
+            throw std::runtime_error(
+                "failed to write include cache: " + filename);
+        }
+    }
+    if (std::rename(tmp_filename.str().c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tmp_filename.str().c_str());
+        throw std::runtime_error(
+            "failed to write include cache: " + filename);
+    }
+    m_modified = false;
+}
+
+bool IncludeCache::modified() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_modified;
+}
+
+CacheStats IncludeCache::stats() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    CacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.size = m_entries.size();
+    return stats;
+}
+
+}}
@@ -21,17 +21,22 @@ SOFTWARE.
 */
 
 #include "include_locator_impl.hpp"
+#include "header_index.hpp"
 
 #include <clang/Basic/FileManager.h>
 #include <clang/Lex/HeaderSearch.h>
 #include <clang/Lex/LexDiagnostic.h>
 
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 
 #include <boost/exception_ptr.hpp>
 #include <boost/exception/to_string.hpp>
 
+#include <sys/stat.h>
+
 namespace {
 struct DiagnosticsResetter
 {
@@ -43,6 +48,21 @@ private:
     clang::Preprocessor &m_pp;
     clang::DiagnosticsEngine &m_diag;
 };
+
+// 64-bit FNV-1a, over a sequence of NUL-terminated strings.
+struct Hash
+{
+    Hash() : value(14695981039346656037ULL) {}
+    void add(const char *s)
+    {
+        do
+        {
+            value ^= static_cast<unsigned char>(*s);
+            value *= 1099511628211ULL;
+        } while (*s++);
+    }
+    uint64_t value;
+};
 }
 
 namespace cmonster {
@@ -51,8 +71,9 @@ namespace impl {
 
 IncludeLocatorDiagnosticClient::IncludeLocatorDiagnosticClient(
     clang::Preprocessor &pp, clang::DiagnosticConsumer *delegate)
-  : m_locator(), m_pp(pp), m_delegate(delegate), m_include_fid(),
-    m_include_loc() {}
+  : m_locator(), m_cache(), m_first_prefixes(), m_fallback(true),
+    m_header_index(NULL), m_pp(pp),
+    m_delegate(delegate), m_include_fid(), m_include_loc() {}
 
 void
 IncludeLocatorDiagnosticClient::setIncludeLocator(
@@ -61,11 +82,115 @@ IncludeLocatorDiagnosticClient::setIncludeLocator(
     m_locator = locator;
 }
 
+void
+IncludeLocatorDiagnosticClient::setIncludeCache(
+    boost::shared_ptr<IncludeCache> const& cache)
+{
+    m_cache = cache;
+}
+
+boost::shared_ptr<IncludeLocator> const&
+IncludeLocatorDiagnosticClient::getIncludeLocator() const
+{
+    return m_locator;
+}
+
+boost::shared_ptr<IncludeCache> const&
+IncludeLocatorDiagnosticClient::getIncludeCache() const
+{
+    return m_cache;
+}
+
+void
+IncludeLocatorDiagnosticClient::setIncludeLocatorPriority(
+    std::vector<std::string> const& first_prefixes, bool fallback)
+{
+    m_first_prefixes = first_prefixes;
+    m_fallback = fallback;
+}
+
+void IncludeLocatorDiagnosticClient::setHeaderIndex(HeaderIndex *index)
+{
+    m_header_index = index;
+}
+
+std::string
+IncludeLocatorDiagnosticClient::getCacheKey(
+    std::string const& include, clang::SourceLocation loc, bool angled) const
+{
+    Hash hash;
+    clang::HeaderSearch &hs = m_pp.getHeaderSearchInfo();
+    for (clang::HeaderSearch::search_dir_iterator iter = hs.search_dir_begin();
+         iter != hs.search_dir_end(); ++iter)
+    {
+        hash.add(iter->getName());
+    }
+    if (!angled)
+    {
+        // Quoted includes are also looked up relative to the includer.
+        clang::SourceManager &sm = m_pp.getSourceManager();
+        const clang::FileEntry *includer =
+            sm.getFileEntryForID(sm.getFileID(loc));
+        if (includer)
+            hash.add(includer->getDir()->getName());
+    }
+
+    std::ostringstream key;
+    key << include << '\0' << std::hex << std::setw(16) << std::setfill('0')
+        << hash.value;
+    return key.str();
+}
+
+bool
+IncludeLocatorDiagnosticClient::locate(
+    std::string const& include, clang::SourceLocation loc, bool angled,
+    std::string &path)
+{
+    if (!m_cache)
+        return m_locator->locate(include, path);
+
+    // A located file may since have been removed, in which case we ask the
+    // locator again.
+    const std::string key = getCacheKey(include, loc, angled);
+    bool located;
+    if (m_cache->find(key, located, path) &&
+        (!located || getLocatedFile(path)))
+    {
+        return located;
+    }
+    located = m_locator->locate(include, path);
+    m_cache->insert(key, located, path);
+    return located;
+}
+
+const clang::FileEntry*
+IncludeLocatorDiagnosticClient::getLocatedFile(std::string const& path)
+{
+    HeaderIndex::Bypass bypass(m_header_index);
+    clang::FileManager &fm = m_pp.getFileManager();
+    const clang::FileEntry *file = fm.getFile(path);
+
+    // The header index may have answered a header search probe of the path
+    // as missing, which the file manager remembers. A virtual file entry
+    // replaces that.
+    struct stat st;
+    if (!file && m_header_index && ::stat(path.c_str(), &st) == 0 &&
+        S_ISREG(st.st_mode))
+    {
+        file = fm.getVirtualFile(path, st.st_size, st.st_mtime);
+    }
+    return file;
+}
+
 void
 IncludeLocatorDiagnosticClient::HandleDiagnostic(
     clang::DiagnosticsEngine::Level level, const clang::Diagnostic &info)
 {
-    if (m_locator && info.getID() == clang::diag::err_pp_file_not_found)
+    // Includes with a "first" prefix reach here without a search of the
+    // search directories; others only if the locator is the fallback.
+    if (m_locator && info.getID() == clang::diag::err_pp_file_not_found &&
+        (m_fallback ||
+         has_include_prefix(info.getArgStdStr(0), m_first_prefixes)))
     {
         clang::SourceManager &sm = m_pp.getSourceManager();
         clang::SourceLocation loc = info.getLocation();
@@ -90,11 +215,10 @@ IncludeLocatorDiagnosticClient::HandleDiagnostic(
             if (angled) include[include.size()-1] = '>';
 
             std::string path;
-            if (m_locator->locate(include, path))
+            if (locate(include, loc, angled, path))
             {
                 // Enter the located file.
-                clang::FileManager &fm = m_pp.getFileManager();
-                const clang::FileEntry *file = fm.getFile(path);
+                const clang::FileEntry *file = getLocatedFile(path);
                 if (file)
                 {
                     // Nabbed from "clang/lib/Lex/PPDirectives.cpp".
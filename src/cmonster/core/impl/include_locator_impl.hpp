@@ -23,6 +23,7 @@ SOFTWARE.
 #ifndef _CMONSTER_CORE_INCLUDE_LOCATOR_IMPL_HPP
 #define _CMONSTER_CORE_INCLUDE_LOCATOR_IMPL_HPP
 
+#include "../include_cache.hpp"
 #include "../include_locator.hpp"
 
 #include <clang/Basic/Diagnostic.h>
@@ -30,11 +31,15 @@ SOFTWARE.
 
 #include <boost/shared_ptr.hpp>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace cmonster {
 namespace core {
 namespace impl {
 
+class HeaderIndex;
+
 class IncludeLocatorDiagnosticClient : public clang::DiagnosticConsumer
 {
 public:
@@ -52,6 +57,28 @@ public:
      *                location.
      */
     void setIncludeLocator(boost::shared_ptr<IncludeLocator> const& locator);
+    boost::shared_ptr<IncludeLocator> const& getIncludeLocator() const;
+
+    /**
+     * @param cache The cache of include locator results, or NULL to always
+     *              consult the locator.
+     */
+    void setIncludeCache(boost::shared_ptr<IncludeCache> const& cache);
+    boost::shared_ptr<IncludeCache> const& getIncludeCache() const;
+
+    /**
+     * @param first_prefixes The include prefixes for which header search is
+     *                       short-circuited, leaving them to the locator.
+     * @param fallback True to consult the locator for other includes.
+     */
+    void setIncludeLocatorPriority(
+        std::vector<std::string> const& first_prefixes, bool fallback);
+
+    /**
+     * @param index The header index to bypass when looking up located
+     *              files, or NULL.
+     */
+    void setHeaderIndex(HeaderIndex *index);
 
     /**
      * Override for clang::DiagnosticConsumer::HandleDiagnostic.
@@ -70,7 +97,30 @@ public:
     void setDelegate(clang::DiagnosticConsumer *delegate);
 
 private:
+    /**
+     * Build the include cache key for an include: its spelling, then a hash
+     * of the header search directories and, for a quoted include, the
+     * directory of the including file.
+     */
+    std::string getCacheKey(std::string const& include,
+                            clang::SourceLocation loc, bool angled) const;
+
+    /**
+     * Locate an include with the include locator, consulting the cache.
+     */
+    bool locate(std::string const& include, clang::SourceLocation loc,
+                bool angled, std::string &path);
+
+    /**
+     * Get the file entry for a located file, or NULL if it doesn't exist.
+     */
+    const clang::FileEntry* getLocatedFile(std::string const& path);
+
     boost::shared_ptr<IncludeLocator>         m_locator;
+    boost::shared_ptr<IncludeCache>           m_cache;
+    std::vector<std::string>                  m_first_prefixes;
+    bool                                      m_fallback;
+    HeaderIndex                              *m_header_index;
     clang::Preprocessor                      &m_pp;
     std::auto_ptr<clang::DiagnosticConsumer>  m_delegate;
     clang::FileID                             m_include_fid;
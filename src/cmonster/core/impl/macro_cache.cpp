@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../macro_cache.hpp"
+
+namespace cmonster {
+namespace core {
+
+MacroCache::MacroCache(size_t capacity) : m_mutex(), m_cache(capacity) {}
+
+bool MacroCache::find(llvm::StringRef key, std::string &expansion)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    const std::string *cached = m_cache.find(key);
+    if (!cached)
+        return false;
+    expansion = *cached;
+    return true;
+}
+
+void MacroCache::insert(llvm::StringRef key, llvm::StringRef expansion)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_cache.insert(key, expansion.str());
+}
+
+void MacroCache::set_capacity(size_t capacity)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_cache.set_capacity(capacity);
+}
+
+void MacroCache::clear()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_cache.clear();
+}
+
+CacheStats MacroCache::stats() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_cache.stats();
+}
+
+}}
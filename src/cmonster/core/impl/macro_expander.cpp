@@ -0,0 +1,292 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "macro_expander.hpp"
+#include "preprocessor_impl.hpp"
+#include "token_arena.hpp"
+#include "../macro_cache.hpp"
+
+#include <clang/Lex/MacroInfo.h>
+#include <llvm/ADT/SmallString.h>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+/**
+ * Append a token's spelling to a string.
+ */
+void append_spelling(clang::Preprocessor &pp, clang::Token const& token,
+                     std::string &out)
+{
+    llvm::SmallString<64> buffer;
+    llvm::StringRef spelling = pp.getSpelling(token, buffer);
+    out.append(spelling.data(), spelling.size());
+}
+
+/**
+ * Identify a function's definition for memoization, numbering those that
+ * don't identify themselves so each is distinct.
+ */
+std::string
+definition_of(cmonster::core::FunctionMacro const& function)
+{
+    static boost::mutex mutex;
+    static unsigned long generation = 0;
+
+    std::string definition = function.definition();
+    if (definition.empty())
+    {
+        unsigned long id;
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            id = ++generation;
+        }
+        std::ostringstream ss;
+        ss << '#' << id;
+        definition = ss.str();
+    }
+    return definition;
+}
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+BoundFunctionMacro::BoundFunctionMacro(
+    PreprocessorImpl &preprocessor, std::string const& name,
+    boost::shared_ptr<FunctionMacro> const& function, bool pure)
+  : m_preprocessor(preprocessor), m_name(name), m_key_prefix(),
+    m_function(function), m_pure(pure), m_result()
+{
+    if (m_pure)
+    {
+        m_key_prefix = name;
+        m_key_prefix.push_back('\0');
+        m_key_prefix.append(definition_of(*function));
+        m_key_prefix.push_back('\0');
+    }
+}
+
+void BoundFunctionMacro::expand(clang::SourceLocation const& expansion_loc,
+                                std::vector<Token> const& args,
+                                clang::IdentifierInfo *disabled)
+{
+    // Borrow the result vector's storage, which is kept between invocations.
+    // We swap it out rather than using it in place, as the function may
+    // cause this macro to be expanded again.
+    std::vector<Token> result;
+    result.swap(m_result);
+    result.clear();
+
+    boost::shared_ptr<MacroCache> cache;
+    if (m_pure)
+        cache = m_preprocessor.macro_cache();
+    if (cache)
+        invoke_memoized(*cache, expansion_loc, args, result);
+    else
+        (*m_function)(expansion_loc, args, result);
+
+    enter_tokens(m_preprocessor.getClangPreprocessor(),
+                 m_preprocessor.token_arena(), result, disabled);
+    m_result.swap(result);
+}
+
+void BoundFunctionMacro::invoke_memoized(
+    MacroCache &cache, clang::SourceLocation const& expansion_loc,
+    std::vector<Token> const& args, std::vector<Token> &result)
+{
+    clang::Preprocessor &pp = m_preprocessor.getClangPreprocessor();
+
+    // The key is the macro name and definition, then each argument's kind
+    // (as two bytes) and spelling, NUL-terminated.
+    std::string key(m_key_prefix);
+    for (std::vector<Token>::const_iterator iter = args.begin();
+         iter != args.end(); ++iter)
+    {
+        clang::Token const& token = iter->getClangToken();
+        const unsigned kind = static_cast<unsigned>(token.getKind());
+        key.push_back(static_cast<char>(kind & 0xFF));
+        key.push_back(static_cast<char>(kind >> 8));
+        append_spelling(pp, token, key);
+        key.push_back('\0');
+    }
+
+    std::string expansion;
+    if (cache.find(key, expansion))
+    {
+        m_preprocessor.tokenize(expansion.data(), expansion.size(), result);
+        return;
+    }
+
+    const size_t begin = result.size();
+    (*m_function)(expansion_loc, args, result);
+    for (size_t i = begin; i < result.size(); ++i)
+    {
+        if (i > begin)
+            expansion.push_back(' ');
+        append_spelling(pp, result[i].getClangToken(), expansion);
+    }
+    cache.insert(key, expansion);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+MacroExpander::MacroExpander(clang::Preprocessor &pp, TokenArena &arena,
+                             boost::exception_ptr &exception)
+  : m_pp(pp), m_arena(arena), m_exception(exception), m_macros() {}
+
+MacroExpander::~MacroExpander()
+{
+    for (Map::iterator iter = m_macros.begin(); iter != m_macros.end();
+         ++iter)
+    {
+        delete iter->second.macro;
+    }
+}
+
+void MacroExpander::add(clang::IdentifierInfo *hook,
+                        clang::MacroInfo const& info,
+                        clang::IdentifierInfo *name,
+                        BoundFunctionMacro *macro)
+{
+    Entry &entry = m_macros[hook];
+    delete entry.macro;
+    entry.definition = info.getDefinitionLoc();
+    entry.name = name;
+    entry.macro = macro;
+}
+
+void MacroExpander::MacroExpands(const clang::Token &name,
+                                 const clang::MacroInfo *info,
+                                 clang::SourceRange range)
+{
+    Map::const_iterator iter = m_macros.find(name.getIdentifierInfo());
+    if (iter == m_macros.end() ||
+        iter->second.definition != info->getDefinitionLoc())
+    {
+        return;
+    }
+
+    // Copy the entry, as the function may define more macros.
+    const Entry entry = iter->second;
+    try
+    {
+        // The hook is always followed by the argument list from the function
+        // macro's body, which Clang has already macro-expanded.
+        clang::Token l_paren;
+        m_pp.LexUnexpandedToken(l_paren);
+        std::vector<Token> args;
+        read_arguments(entry.name, args);
+
+        clang::SourceLocation expansion_loc =
+            m_pp.getSourceManager().getExpansionLoc(name.getLocation());
+        entry.macro->expand(expansion_loc, args, entry.name);
+        return;
+    }
+    catch (...)
+    {
+        // Clang is compiled without exception support, so store the
+        // exception and tell the preprocessor to stop.
+        m_exception = boost::current_exception();
+    }
+    enter_eof(m_pp);
+}
+
+void MacroExpander::FileChanged(clang::SourceLocation loc,
+                                clang::PPCallbacks::FileChangeReason reason,
+                                clang::SrcMgr::CharacteristicKind file_type)
+{
+    if (reason == clang::PPCallbacks::ExitFile)
+        m_arena.reset();
+}
+
+void MacroExpander::EndOfMainFile()
+{
+    m_arena.reset();
+}
+
+void MacroExpander::read_arguments(clang::IdentifierInfo *name,
+                                   std::vector<Token> &args)
+{
+    unsigned depth = 0;
+    clang::Token token;
+    for (m_pp.LexUnexpandedToken(token);
+         token.isNot(clang::tok::eof) && token.isNot(clang::tok::eod);
+         m_pp.LexUnexpandedToken(token))
+    {
+        if (token.is(clang::tok::l_paren))
+        {
+            ++depth;
+        }
+        else if (token.is(clang::tok::r_paren))
+        {
+            if (depth == 0)
+                return;
+            --depth;
+        }
+        args.push_back(Token(m_pp, token));
+    }
+    boost::throw_exception(std::runtime_error(
+        "unterminated argument list invoking macro \"" +
+        name->getName().str() + "\""));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void enter_tokens(clang::Preprocessor &pp, TokenArena &arena,
+                  std::vector<Token> const& tokens,
+                  clang::IdentifierInfo *disabled)
+{
+    if (tokens.empty())
+        return;
+
+    clang::Token *stream = arena.allocate(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        stream[i] = tokens[i].getClangToken();
+        if (i > 0)
+            stream[i].setFlag(clang::Token::LeadingSpace);
+        if (disabled && stream[i].getIdentifierInfo() == disabled)
+            stream[i].setFlag(clang::Token::DisableExpand);
+    }
+    pp.EnterTokenStream(stream, tokens.size(), false, false);
+}
+
+void enter_eof(clang::Preprocessor &pp)
+{
+    // Not allocated from the arena, as the stream may be left on the lexer
+    // stack indefinitely.
+    clang::Token *tok = new clang::Token[1];
+    tok->startToken();
+    tok->setKind(clang::tok::eof);
+    pp.EnterTokenStream(tok, 1, false, true);
+}
+
+}}}
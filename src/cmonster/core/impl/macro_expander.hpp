@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_MACRO_EXPANDER_HPP
+#define _CMONSTER_CORE_IMPL_MACRO_EXPANDER_HPP
+
+#include "../function_macro.hpp"
+#include "../token.hpp"
+
+#include <clang/Lex/PPCallbacks.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <boost/exception_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+class MacroCache;
+
+namespace impl {
+
+class PreprocessorImpl;
+class TokenArena;
+
+/**
+ * A FunctionMacro bound to the preprocessor it was defined in, along with
+ * the name it was defined with.
+ */
+class BoundFunctionMacro
+{
+public:
+    BoundFunctionMacro(PreprocessorImpl &preprocessor,
+                       std::string const& name,
+                       boost::shared_ptr<FunctionMacro> const& function,
+                       bool pure);
+
+    /**
+     * Invoke the function and enter the result tokens into the preprocessor,
+     * to be lexed next. The result stream is allocated from the
+     * preprocessor's token arena. If the function is pure, the expansion is
+     * memoized in the preprocessor's macro cache, keyed by the macro name,
+     * the function's definition and the kinds and spellings of the
+     * arguments; a cached expansion is re-lexed with tokenize() instead of
+     * calling the function.
+     *
+     * @param expansion_loc The location of the expansion.
+     * @param args The argument tokens.
+     * @param disabled An identifier whose occurrences in the result must not
+     *                 be expanded again, or NULL.
+     */
+    void expand(clang::SourceLocation const& expansion_loc,
+                std::vector<Token> const& args,
+                clang::IdentifierInfo *disabled = NULL);
+
+private:
+    void invoke_memoized(MacroCache &cache,
+                         clang::SourceLocation const& expansion_loc,
+                         std::vector<Token> const& args,
+                         std::vector<Token> &result);
+
+    PreprocessorImpl                 &m_preprocessor;
+    std::string                       m_name;
+    std::string                       m_key_prefix;
+    boost::shared_ptr<FunctionMacro>  m_function;
+    bool                              m_pure;
+    std::vector<Token>                m_result;
+};
+
+/**
+ * A PPCallbacks implementation that expands function macros in place.
+ *
+ * Function macros are defined to Clang as variadic function-like macros,
+ * which pass their arguments to a hidden, empty object-like macro (the
+ * "hook"). Clang expands the arguments as usual; when the hook is expanded,
+ * the expander reads the parenthesised argument list that follows it
+ * straight from the preprocessor, invokes the function, and enters the
+ * result tokens. Clang then lexes the result in place of the (empty) hook
+ * body.
+ *
+ * The expander also resets the token arena whenever a file is exited: by
+ * then, every stream entered while the file was being lexed has been popped
+ * from the lexer stack.
+ */
+class MacroExpander : public clang::PPCallbacks
+{
+public:
+    MacroExpander(clang::Preprocessor &pp, TokenArena &arena,
+                  boost::exception_ptr &exception);
+    ~MacroExpander();
+
+    /**
+     * Register a function macro, taking ownership of it. Expansions of
+     * "hook" are only intercepted while it is defined by "info".
+     * Occurrences of "name" in the function's result are not expanded
+     * again.
+     */
+    void add(clang::IdentifierInfo *hook, clang::MacroInfo const& info,
+             clang::IdentifierInfo *name, BoundFunctionMacro *macro);
+
+    void MacroExpands(const clang::Token &name,
+                      const clang::MacroInfo *info,
+                      clang::SourceRange range);
+
+    void FileChanged(clang::SourceLocation loc,
+                     clang::PPCallbacks::FileChangeReason reason,
+                     clang::SrcMgr::CharacteristicKind file_type);
+
+    void EndOfMainFile();
+
+private:
+    // The definition location identifies the MacroInfo we created, as
+    // MacroInfo objects are recycled after "#undef".
+    struct Entry
+    {
+        clang::SourceLocation  definition;
+        clang::IdentifierInfo *name;
+        BoundFunctionMacro    *macro;
+    };
+    typedef llvm::DenseMap<clang::IdentifierInfo*, Entry> Map;
+
+    /**
+     * Read the tokens of an argument list, up to but excluding the closing
+     * parenthesis. The opening parenthesis must already have been consumed.
+     */
+    void read_arguments(clang::IdentifierInfo *name,
+                        std::vector<Token> &args);
+
+    clang::Preprocessor  &m_pp;
+    TokenArena           &m_arena;
+    boost::exception_ptr &m_exception;
+    Map                   m_macros;
+};
+
+/**
+ * Enter a stream of tokens into the preprocessor, to be lexed next. The
+ * stream is allocated from "arena". Every token but the first is marked as
+ * having leading space. Occurrences of "disabled" (if not NULL) are marked
+ * so that they are not expanded.
+ */
+void enter_tokens(clang::Preprocessor &pp, TokenArena &arena,
+                  std::vector<Token> const& tokens,
+                  clang::IdentifierInfo *disabled = NULL);
+
+/**
+ * Enter an eof token into the preprocessor, to stop preprocessing after an
+ * exception has been stored.
+ */
+void enter_eof(clang::Preprocessor &pp);
+
+}}}
+
+#endif
@@ -0,0 +1,209 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "pipelined_token_iterator.hpp"
+#include "preprocessor_impl.hpp"
+#include "../token_batch.hpp"
+
+#include <clang/Basic/SourceManager.h>
+
+#include <boost/bind.hpp>
+
+#include <cstring>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+PipelinedTokenIteratorImpl::PipelinedTokenIteratorImpl(
+    clang::Preprocessor &pp, boost::exception_ptr &exception,
+    boost::shared_ptr<TokenPredicate> const& predicate, size_t capacity)
+  : m_pp(pp), m_exception(exception), m_predicate(predicate),
+    m_info_arena(), m_buffer(), m_mutex(), m_not_empty(),
+    m_not_full(), m_queue(), m_capacity(capacity), m_current(pp),
+    m_next(pp), m_thread()
+{
+    m_thread = boost::thread(
+        boost::bind(&PipelinedTokenIteratorImpl::produce, this));
+    try
+    {
+        pop(m_next);
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+}
+
+PipelinedTokenIteratorImpl::~PipelinedTokenIteratorImpl()
+{
+    stop();
+}
+
+bool PipelinedTokenIteratorImpl::has_next() const throw()
+{
+    return m_next.getClangToken().isNot(clang::tok::eof);
+}
+
+Token& PipelinedTokenIteratorImpl::next()
+{
+    m_current = m_next;
+    pop(m_next);
+    return m_current;
+}
+
+size_t
+PipelinedTokenIteratorImpl::next_batch(std::vector<Token> &tokens, size_t n)
+{
+    size_t count = 0;
+    for (; count < n && has_next(); ++count)
+    {
+        tokens.push_back(m_next);
+        pop(m_next);
+    }
+    return count;
+}
+
+size_t PipelinedTokenIteratorImpl::next_batch(TokenBatch &batch, size_t n)
+{
+    size_t count = 0;
+    for (; count < n && has_next(); ++count)
+    {
+        batch.push_back(m_next);
+        pop(m_next);
+    }
+    return count;
+}
+
+bool PipelinedTokenIteratorImpl::is_concurrent() const throw()
+{
+    return true;
+}
+
+void PipelinedTokenIteratorImpl::produce()
+{
+    try
+    {
+        try
+        {
+            clang::Token token;
+            lex_first_token(m_pp, token);
+            while (token.isNot(clang::tok::eof) && !m_exception)
+            {
+                if (!m_predicate || (*m_predicate)(Token(m_pp, token)))
+                    push(Token(m_pp, token, resolve(token)));
+                m_pp.Lex(token);
+            }
+        }
+        catch (boost::thread_interrupted const&)
+        {
+            throw;
+        }
+        catch (...)
+        {
+            m_exception = boost::current_exception();
+        }
+
+        // Terminate the stream. The exception (if any) is visible to the
+        // consumer once it has popped this token.
+        clang::Token eof;
+        eof.startToken();
+        eof.setKind(clang::tok::eof);
+        push(Token(m_pp, eof));
+    }
+    catch (boost::thread_interrupted const&)
+    {
+        // The iterator is being destroyed.
+    }
+}
+
+TokenInfo const* PipelinedTokenIteratorImpl::resolve(clang::Token const& token)
+{
+    TokenInfo *info = m_info_arena.Allocate<TokenInfo>();
+
+    // Literal and identifier spellings are already in stable storage; any
+    // other spelling is copied into the arena.
+    if (token.isLiteral() && token.getLiteralData() && !token.needsCleaning())
+    {
+        info->spelling = llvm::StringRef(
+            token.getLiteralData(), token.getLength());
+    }
+    else if (!token.isAnnotation() && token.isNot(clang::tok::raw_identifier)
+             && token.getIdentifierInfo())
+    {
+        info->spelling = token.getIdentifierInfo()->getName();
+    }
+    else
+    {
+        bool invalid = false;
+        m_buffer.clear();
+        llvm::StringRef spelling = m_pp.getSpelling(token, m_buffer, &invalid);
+        if (invalid)
+            spelling = llvm::StringRef();
+        char *data = m_info_arena.Allocate<char>(spelling.size());
+        std::memcpy(data, spelling.data(), spelling.size());
+        info->spelling = llvm::StringRef(data, spelling.size());
+    }
+
+    clang::SourceManager &sm = m_pp.getSourceManager();
+    clang::PresumedLoc ploc = sm.getPresumedLoc(token.getLocation());
+    info->filename = ploc.isValid() ? ploc.getFilename() : NULL;
+    info->line = ploc.isValid() ? ploc.getLine() : 0;
+    info->column = ploc.isValid() ? ploc.getColumn() : 0;
+    info->in_main_file = sm.isFromMainFile(token.getLocation());
+    return info;
+}
+
+void PipelinedTokenIteratorImpl::push(Token const& token)
+{
+    // Waiting on the condition is an interruption point.
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    while (m_queue.size() >= m_capacity)
+        m_not_full.wait(lock);
+    m_queue.push_back(token);
+    m_not_empty.notify_one();
+}
+
+void PipelinedTokenIteratorImpl::pop(Token &token)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        while (m_queue.empty())
+            m_not_empty.wait(lock);
+        token = m_queue.front();
+        m_queue.pop_front();
+        m_not_full.notify_one();
+    }
+    if (token.getClangToken().is(clang::tok::eof) && m_exception)
+        boost::rethrow_exception(m_exception);
+}
+
+void PipelinedTokenIteratorImpl::stop()
+{
+    // The lexing thread only waits (and so only checks for interruption)
+    // when the queue is full, so this will not interrupt it mid-lex.
+    m_thread.interrupt();
+    m_thread.join();
+}
+
+}}}
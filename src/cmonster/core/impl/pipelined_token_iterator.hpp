@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_PIPELINED_TOKEN_ITERATOR_HPP
+#define _CMONSTER_CORE_IMPL_PIPELINED_TOKEN_ITERATOR_HPP
+
+#include "../token_iterator.hpp"
+#include "../token_predicate.hpp"
+
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Allocator.h>
+
+#include <boost/exception_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <deque>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A TokenIterator which lexes on a dedicated thread. Tokens are passed from
+ * the lexing thread to the consumer through a bounded queue; either side
+ * blocks on a condition variable while the queue is full or empty.
+ *
+ * The lexing thread resolves each token's spelling and presumed location
+ * into a TokenInfo allocated from the iterator's arena, as the consumer must
+ * not consult the source manager while the lexing thread is modifying it.
+ * The info is freed with the iterator.
+ *
+ * The lexing thread ends the stream with an eof token. Any exception that
+ * occurs on the lexing thread is stored before the eof token is pushed, and
+ * is rethrown to the consumer when it reaches the eof token.
+ */
+class PipelinedTokenIteratorImpl : public TokenIterator
+{
+public:
+    PipelinedTokenIteratorImpl(
+        clang::Preprocessor &pp, boost::exception_ptr &exception,
+        boost::shared_ptr<TokenPredicate> const& predicate, size_t capacity);
+
+    /**
+     * Stops and joins the lexing thread.
+     */
+    ~PipelinedTokenIteratorImpl();
+
+    bool has_next() const throw();
+    Token& next();
+    size_t next_batch(std::vector<Token> &tokens, size_t n);
+    size_t next_batch(TokenBatch &batch, size_t n);
+    bool is_concurrent() const throw();
+
+private:
+    /**
+     * The lexing thread's entry point.
+     */
+    void produce();
+
+    /**
+     * Resolve a token's spelling and location, on the lexing thread.
+     */
+    TokenInfo const* resolve(clang::Token const& token);
+
+    /**
+     * Push a token into the queue, waiting for space if necessary.
+     */
+    void push(Token const& token);
+
+    /**
+     * Pop a token from the queue, waiting for one if necessary.
+     */
+    void pop(Token &token);
+
+    void stop();
+
+    clang::Preprocessor               &m_pp;
+    boost::exception_ptr              &m_exception;
+    boost::shared_ptr<TokenPredicate>  m_predicate;
+    llvm::BumpPtrAllocator             m_info_arena;
+    llvm::SmallString<64>              m_buffer;
+
+    boost::mutex                       m_mutex;
+    boost::condition_variable          m_not_empty;
+    boost::condition_variable          m_not_full;
+    std::deque<Token>                  m_queue;
+    const size_t                       m_capacity;
+
+    Token                              m_current;
+    Token                              m_next;
+    boost::thread                      m_thread;
+};
+
+}}}
+
+#endif
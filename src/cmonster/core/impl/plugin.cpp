@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../plugin.hpp"
+
+#include <dlfcn.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace cmonster {
+namespace core {
+
+namespace {
+
+typedef unsigned int (*PluginVersionFunction)();
+typedef void (*PluginInitFunction)(Preprocessor&);
+
+std::runtime_error plugin_error(std::string const& path, const char *what)
+{
+    std::ostringstream ss;
+    ss << "failed to load plugin \"" << path << "\": " << what;
+    return std::runtime_error(ss.str());
+}
+
+/**
+ * Make the symbols of the shared object containing cmonster available to
+ * subsequently loaded plugins. Python loads extension modules with
+ * RTLD_LOCAL, so plugins could not otherwise resolve, e.g., the Token
+ * constructors.
+ */
+void export_own_symbols()
+{
+    static bool exported = false;
+    if (exported)
+        return;
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&export_own_symbols), &info) &&
+        info.dli_fname)
+    {
+        dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_GLOBAL);
+    }
+    exported = true;
+}
+
+}
+
+void load_plugin(Preprocessor &preprocessor, std::string const& path)
+{
+    export_own_symbols();
+
+    void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        throw plugin_error(path, dlerror());
+
+    PluginVersionFunction version = reinterpret_cast<PluginVersionFunction>(
+        dlsym(handle, "cmonster_plugin_version"));
+    PluginInitFunction init = reinterpret_cast<PluginInitFunction>(
+        dlsym(handle, "cmonster_plugin_init"));
+    if (!version || !init)
+    {
+        dlclose(handle);
+        throw plugin_error(path, "not a cmonster plugin");
+    }
+    if (version() != CMONSTER_PLUGIN_VERSION)
+    {
+        dlclose(handle);
+        throw plugin_error(path, "incompatible plugin version");
+    }
+    init(preprocessor);
+}
+
+}}
@@ -24,18 +24,31 @@ SOFTWARE.
 //#include <assert.h>
 
 #include "preprocessor_impl.hpp"
+#include "../configuration.hpp"
 #include "../function_macro.hpp"
+#include "../include_cache.hpp"
+#include "../macro_cache.hpp"
+#include "../token_batch.hpp"
 #include "../token_iterator.hpp"
 #include "../token_predicate.hpp"
+#include "../token_stream.hpp"
 #include "../token.hpp"
 #include "exception_diagnostic_client.hpp"
+#include "header_index.hpp"
 #include "include_locator_impl.hpp"
+#include "macro_expander.hpp"
+#include "pipelined_token_iterator.hpp"
 
 #include <clang/Frontend/Utils.h>
 #include <clang/Basic/FileManager.h>
 #include <clang/Lex/HeaderSearch.h>
+#include <clang/Lex/Lexer.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/Pragma.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
 
 #include <boost/exception_ptr.hpp>
 
@@ -44,6 +57,7 @@ SOFTWARE.
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <memory>
 #include <sstream>
@@ -57,175 +71,260 @@ struct null_deleter {
     void operator()(const void *) {}
 };
 
-struct PreprocessorResetter
+struct TokenVectorSink
 {
-    PreprocessorResetter(
-        clang::CompilerInstance &compiler, clang::Preprocessor &pp)
-      : m_compiler(compiler), m_pp(pp) {}
-    ~PreprocessorResetter() {m_compiler.setPreprocessor(&m_pp);}
-private:
-    clang::CompilerInstance &m_compiler;
-    clang::Preprocessor &m_pp;
+    TokenVectorSink(std::vector<cmonster::core::Token> &tokens_)
+      : tokens(tokens_) {}
+    void operator()(clang::Preprocessor &pp, clang::Token const& token)
+    {
+        tokens.push_back(cmonster::core::Token(pp, token));
+    }
+    std::vector<cmonster::core::Token> &tokens;
 };
 
-} // Anonymous namespace.
+struct ClangTokenSink
+{
+    ClangTokenSink(std::vector<clang::Token> &tokens_) : tokens(tokens_) {}
+    void operator()(clang::Preprocessor&, clang::Token const& token)
+    {
+        tokens.push_back(token);
+    }
+    std::vector<clang::Token> &tokens;
+};
 
-namespace cmonster {
-namespace core {
-namespace impl {
+struct TokenBatchSink
+{
+    TokenBatchSink(cmonster::core::TokenBatch &batch_) : batch(batch_) {}
+    void operator()(clang::Preprocessor&, clang::Token const& token)
+    {
+        batch.push_back(token);
+    }
+    cmonster::core::TokenBatch &batch;
+};
 
-struct FileChangePPCallback : public clang::PPCallbacks
+typedef llvm::SmallPtrSet<const clang::DirectoryEntry*, 64> DirectorySet;
+
+/**
+ * Check whether the file at "path" still holds the contents of the buffer
+ * registered as "fid". False if the file can't be read.
+ */
+bool same_contents(clang::SourceManager &sm, clang::FileID fid,
+                   std::string const& path)
 {
-    FileChangePPCallback() : depth(0), location() {}
-    void FileChanged(clang::SourceLocation Loc,
-                     clang::PPCallbacks::FileChangeReason Reason,
-                     clang::SrcMgr::CharacteristicKind FileType)
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    if (llvm::MemoryBuffer::getFile(path, buffer))
+        return false;
+    return buffer->getBuffer() == sm.getBuffer(fid)->getBuffer();
+}
+
+/**
+ * Append lookups for those directories that exist and are not already in
+ * "seen" to "lookups", adding them to "seen".
+ */
+void append_lookups(clang::FileManager &filemgr,
+                    std::vector<std::string> const& dirs,
+                    clang::SrcMgr::CharacteristicKind kind,
+                    DirectorySet &seen,
+                    std::vector<clang::DirectoryLookup> &lookups)
+{
+    for (std::vector<std::string>::const_iterator iter = dirs.begin();
+         iter != dirs.end(); ++iter)
     {
-        location = Loc;
-        switch (Reason)
+        const clang::DirectoryEntry *entry = filemgr.getDirectory(*iter);
+        if (entry && seen.insert(entry))
         {
-            case clang::PPCallbacks::EnterFile: ++depth; break;
-            case clang::PPCallbacks::ExitFile: --depth; break;
-            default: break;
+            lookups.push_back(
+                clang::DirectoryLookup(entry, kind, true, false));
         }
     }
-    unsigned int depth;
-    clang::SourceLocation location;
-};
+}
 
 /**
- * A clang PragmaHandler implementation that stores the pragma arguments. These
- * will later be consumed by a DynamicPragmaHandler.
+ * Parse the parameter list of a function-like macro definition, from the
+ * token after the opening parenthesis up to and including the closing
+ * parenthesis. Parameter names are appended to "args", with "..." for a
+ * C99 variadic parameter.
+ *
+ * @return True if the parameter list is well-formed, in which case "pos" is
+ *         left pointing after the closing parenthesis.
  */
-struct TokenSaverPragmaHandler : public clang::PragmaHandler
+bool parse_macro_parameters(const clang::Token *&pos, const clang::Token *end,
+                            std::vector<std::string> &args)
 {
-    TokenSaverPragmaHandler()
-      : clang::PragmaHandler(llvm::StringRef("cmonster_pragma", 15)),
-        tokens() {}
-    void HandlePragma(clang::Preprocessor &PP,
-                      clang::PragmaIntroducerKind Introducer,
-                      clang::Token &FirstToken)
+    if (pos != end && pos->is(clang::tok::r_paren))
     {
-        tokens.clear();
-        clang::Token token;
-        for (PP.Lex(token); token.isNot(clang::tok::eod); PP.Lex(token))
+        ++pos;
+        return true;
+    }
+    while (pos != end)
+    {
+        if (pos->is(clang::tok::ellipsis))
+            args.push_back("...");
+        else if (pos->getIdentifierInfo())
+            args.push_back(pos->getIdentifierInfo()->getName());
+        else
+            return false;
+
+        if (++pos == end)
+            return false;
+        if (pos->is(clang::tok::r_paren))
         {
-            // TODO set the start of line and leading space tokens. We could
-            // use PPCallbacks::MacroExpands to get the flags of the macro
-            // name.
-            tokens.push_back(cmonster::core::Token(PP, token));
+            ++pos;
+            return true;
         }
+        if (pos->isNot(clang::tok::comma) || args.back() == "...")
+            return false;
+        ++pos;
     }
-    std::vector<cmonster::core::Token> tokens;
-};
+    return false;
+}
+
+/**
+ * Append the source text between two tokens to "out", with comments
+ * replaced by spaces. Line breaks are kept, so the text that follows keeps
+ * its layout.
+ */
+void append_blanking_comments(std::string &out, const char *begin,
+                              const char *end)
+{
+    bool line_comment = false, block_comment = false;
+    for (const char *p = begin; p != end; ++p)
+    {
+        const bool pair = (p + 1) != end;
+        if (!line_comment && !block_comment && *p == '/' && pair &&
+            (p[1] == '/' || p[1] == '*'))
+        {
+            line_comment = (p[1] == '/');
+            block_comment = !line_comment;
+            out.append(2, ' ');
+            ++p;
+        }
+        else if (block_comment && *p == '*' && pair && p[1] == '/')
+        {
+            block_comment = false;
+            out.append(2, ' ');
+            ++p;
+        }
+        else if (*p == '\n' || *p == '\r')
+        {
+            // A line comment continues after an escaped newline.
+            if (*p == '\n' && p != begin && p[-1] != '\\' &&
+                !(p[-1] == '\r' && p - 1 != begin && p[-2] == '\\'))
+            {
+                line_comment = false;
+            }
+            out.push_back(*p);
+        }
+        else if ((line_comment || block_comment) && *p != '\t')
+        {
+            out.push_back(' ');
+        }
+        else
+        {
+            out.push_back(*p);
+        }
+    }
+}
+
+} // Anonymous namespace.
+
+namespace cmonster {
+namespace core {
+namespace impl {
 
 /**
- * A clang PragmaHandler implementation that takes the tokens saved by a
- * TokenSaverPragmaHandler and passes them to a cmonster FunctionMacro object.
- * The resultant tokens (if any) are fed back into the preprocessor.
+ * A clang PragmaHandler implementation that passes the pragma's tokens to a
+ * cmonster FunctionMacro object. The resultant tokens (if any) are fed back
+ * into the preprocessor.
  */
 struct DynamicPragmaHandler : public clang::PragmaHandler
 {
     DynamicPragmaHandler(
-        TokenSaverPragmaHandler &token_saver,
+        PreprocessorImpl &preprocessor,
         std::string const& name,
         boost::shared_ptr<cmonster::core::FunctionMacro> const& function,
         boost::exception_ptr &exception)
       : clang::PragmaHandler(llvm::StringRef(name.c_str(), name.size())),
-        m_token_saver(token_saver), m_function(function),
-        m_exception(exception) {}
+        m_macro(preprocessor, name, function, false),
+        m_exception(exception), m_args()
+    {
+        m_args.reserve(16);
+    }
 
     void HandlePragma(clang::Preprocessor &PP,
                       clang::PragmaIntroducerKind Introducer,
                       clang::Token &FirstToken)
     {
-        // Discard remaining directive tokens (there shouldn't be any before
-        // 'eod').
+        // The remaining directive tokens are the arguments. Borrow the
+        // argument vector's storage, as the handler may be re-entered. The
+        // arguments are passed on by reference, and context handlers see
+        // them through a borrowed view, so they are never copied.
+        std::vector<cmonster::core::Token> args;
+        args.swap(m_args);
+        args.clear();
         clang::Token token;
-        for (PP.Lex(token); token.isNot(clang::tok::eod);)
-             PP.Lex(token);
+        for (PP.Lex(token); token.isNot(clang::tok::eod); PP.Lex(token))
+            args.push_back(cmonster::core::Token(PP, token));
 
-        // Add the result tokens back into the preprocessor.
         try
         {
             clang::SourceLocation expansion_loc =
                 PP.getSourceManager().getExpansionLoc(
                     FirstToken.getLocation());
-
-            std::vector<cmonster::core::Token> result =
-                (*m_function)(expansion_loc, m_token_saver.tokens);
-            if (!result.empty())
-            {
-                // Enter the results back into the preprocessor.
-                clang::Token *tokens(new clang::Token[result.size()]);
-                try
-                {
-                    tokens[0] = result[0].getClangToken();
-                    for (size_t i = 1; i < result.size(); ++i)
-                    {
-                        tokens[i] = result[i].getClangToken();
-                        tokens[i].setFlag(clang::Token::LeadingSpace);
-                    }
-                }
-                catch (...)
-                {
-                    delete [] tokens;
-                    throw;
-                }
-                PP.EnterTokenStream(tokens, result.size(), false, true);
-            }
+            m_macro.expand(expansion_loc, args);
+            m_args.swap(args);
             return;
         }
         catch (...)
         {
-            // Clang is compiled without exception support, so we have to
-            // resort to some nastiness here. Basically we need to insert an
-            // eof token to force the preprocessor to exit. We'll also store
-            // the error message so we can recover it later.
+            // Clang is compiled without exception support, so store the
+            // exception and tell the preprocessor to stop.
             m_exception = boost::current_exception();
         }
 
         // XXX should this be configurable? Allow user to just emit a
         // diagnostic?
-        //
-        // If we get here, an exception was caught. Let's tell the preprocessor
-        // to stop.
-        clang::Token tok;
-        tok.startToken();
-        tok.setKind(clang::tok::eof);
-        PP.EnterTokenStream(&tok, 1, false, true);
+        enter_eof(PP);
     }
 
 private:
-    TokenSaverPragmaHandler                          &m_token_saver;
-    boost::shared_ptr<cmonster::core::FunctionMacro>  m_function;
-    boost::exception_ptr                             &m_exception;
+    BoundFunctionMacro                  m_macro;
+    boost::exception_ptr               &m_exception;
+    std::vector<cmonster::core::Token>  m_args;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void lex_first_token(clang::Preprocessor &pp, clang::Token &token)
+{
+    // Pinched from "clang/lib/Frontend/PrintPreprocessedOutput.cpp". Skip
+    // tokens from the predefines buffer.
+    const clang::SourceManager &sm = pp.getSourceManager();
+    do
+    {
+        pp.Lex(token);
+        if (token.is(clang::tok::eof) || !token.getLocation().isFileID())
+            break;
+        clang::PresumedLoc PLoc = sm.getPresumedLoc(token.getLocation());
+        if (PLoc.isInvalid())
+            break;
+        if (strcmp(PLoc.getFilename(), "<built-in>") != 0)
+            break;
+    } while (true);
+}
+
 class TokenIteratorImpl : public TokenIterator
 {
 public:
-    TokenIteratorImpl(clang::Preprocessor &pp, boost::exception_ptr &exception)
-      : m_pp(pp), m_exception(exception), m_current(m_pp), m_next()
+    TokenIteratorImpl(clang::Preprocessor &pp, boost::exception_ptr &exception,
+                      boost::shared_ptr<TokenPredicate> const& predicate)
+      : m_pp(pp), m_exception(exception), m_predicate(predicate),
+        m_current(m_pp), m_next()
     {
-        // Pinched from "clang/lib/Frontend/PrintPreprocessedOutput.cpp". Skip
-        // tokens from the predefines buffer.
-        const clang::SourceManager &sm = m_pp.getSourceManager();
-        do
-        {
-            m_pp.Lex(m_next);
-            if (m_next.is(clang::tok::eof) || !m_next.getLocation().isFileID())
-                break;
-            clang::PresumedLoc PLoc = sm.getPresumedLoc(m_next.getLocation());
-            if (PLoc.isInvalid())
-                break;
-            if (strcmp(PLoc.getFilename(), "<built-in>") != 0)
-                break;
-        } while (true);
+        lex_first_token(m_pp, m_next);
         if (m_exception)
             boost::rethrow_exception(m_exception);
+        skip();
     }
 
     bool has_next() const throw()
@@ -236,24 +335,76 @@ public:
     Token& next()
     {
         m_current.setClangToken(m_next);
+        advance();
+        return m_current;
+    }
+
+    size_t next_batch(std::vector<Token> &tokens, size_t n)
+    {
+        size_t count = 0;
+        for (; count < n && m_next.isNot(clang::tok::eof); ++count)
+        {
+            tokens.push_back(Token(m_pp, m_next));
+            advance();
+        }
+        return count;
+    }
+
+    size_t next_batch(TokenBatch &batch, size_t n)
+    {
+        size_t count = 0;
+        for (; count < n && m_next.isNot(clang::tok::eof); ++count)
+        {
+            batch.push_back(m_next);
+            advance();
+        }
+        return count;
+    }
+
+private:
+    /**
+     * Lex the next token that satisfies the predicate (if any).
+     */
+    void advance()
+    {
         m_pp.Lex(m_next);
         if (m_exception)
             boost::rethrow_exception(m_exception);
-        return m_current;
+        skip();
     }
 
-private:
-    clang::Preprocessor  &m_pp;
-    boost::exception_ptr &m_exception;
-    Token                 m_current;
-    clang::Token          m_next;
+    /**
+     * Skip tokens until the lookahead token satisfies the predicate.
+     */
+    void skip()
+    {
+        if (!m_predicate)
+            return;
+        TokenPredicate const& predicate = *m_predicate;
+        while (m_next.isNot(clang::tok::eof) &&
+               !predicate(Token(m_pp, m_next)))
+        {
+            m_pp.Lex(m_next);
+            if (m_exception)
+                boost::rethrow_exception(m_exception);
+        }
+    }
+
+    clang::Preprocessor               &m_pp;
+    boost::exception_ptr              &m_exception;
+    boost::shared_ptr<TokenPredicate>  m_predicate;
+    Token                              m_current;
+    clang::Token                       m_next;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
 PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
-  : m_compiler(compiler), m_exception()
+  : m_compiler(compiler), m_exception(), m_has_function_macros(false),
+    m_tokenize_cache(1024), m_macro_cache(new MacroCache), m_token_arena(),
+    m_include_cache_set(false), m_replay_streams(),
+    m_header_index(NULL), m_index_headers(false)
 {
     m_compiler.createPreprocessor();
 
@@ -262,28 +413,18 @@ PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
         m_compiler.getPreprocessor().getIdentifierTable(),
         m_compiler.getPreprocessor().getLangOptions());
 
-    // Set the predefines on the preprocessor.
-    std::string predefines = m_compiler.getPreprocessor().getPredefines();
-    predefines.append(
-        "#define _CMONSTER_PRAGMA(...) _Pragma(#__VA_ARGS__)");
-    m_compiler.getPreprocessor().setPredefines(predefines);
-
-    // Add the "token saver" pragma handler. This will be used to store the
-    // varargs arguments. There may be a more elegant way to do that with
-    // just one pragma, but I couldn't think of it.
-    m_token_saver = new impl::TokenSaverPragmaHandler;
-    m_compiler.getPreprocessor().AddPragmaHandler(m_token_saver);
-
-    // Add preprocessing callbacks so we know when a file is entered or
-    // exited.
-    m_file_change_callback = new impl::FileChangePPCallback;
-    m_compiler.getPreprocessor().addPPCallbacks(m_file_change_callback);
+    // Add the callbacks object that expands function macros.
+    m_macro_expander = new impl::MacroExpander(
+        m_compiler.getPreprocessor(), m_token_arena, m_exception);
+    m_compiler.getPreprocessor().addPPCallbacks(m_macro_expander);
 
     // Set the include locator diagnostic client.
     clang::DiagnosticConsumer *orig_client =
         m_compiler.getDiagnostics().takeClient();
     m_include_locator = new IncludeLocatorDiagnosticClient(
         m_compiler.getPreprocessor(), orig_client);
+    m_include_locator->setIncludeCache(
+        boost::shared_ptr<IncludeCache>(new IncludeCache));
     m_compiler.getDiagnostics().setClient(m_include_locator);
 
     // Tell the diagnostic client that we've entered a source file, or bad
@@ -297,48 +438,137 @@ PreprocessorImpl::PreprocessorImpl(clang::CompilerInstance &compiler)
 
 bool
 PreprocessorImpl::add_include_dir(std::string const& path, bool sysinclude)
+{
+    std::vector<std::string> user_dirs, system_dirs;
+    (sysinclude ? system_dirs : user_dirs).push_back(path);
+    append_include_dirs(user_dirs, system_dirs);
+    const clang::DirectoryEntry *entry =
+        m_compiler.getFileManager().getDirectory(path);
+    return entry != NULL;
+}
+
+void
+PreprocessorImpl::set_include_dirs(std::vector<std::string> const& quoted,
+                                   std::vector<std::string> const& angled,
+                                   std::vector<std::string> const& system,
+                                   bool index)
 {
     clang::HeaderSearch &headers =
         m_compiler.getPreprocessor().getHeaderSearchInfo();
     clang::FileManager &filemgr = headers.getFileMgr();
-    const clang::DirectoryEntry *entry =
-        filemgr.getDirectory(llvm::StringRef(path.c_str(), path.size()));
 
-    // Take a copy of the existing search paths, and add the new one. If
-    // it's a system path, insert it in after "system_dir_end". If it's a
-    // user path, simply add it to the end of the vector.
+    DirectorySet seen;
+    std::vector<clang::DirectoryLookup> search_paths;
+    append_lookups(filemgr, quoted, clang::SrcMgr::C_User, seen,
+                   search_paths);
+    const unsigned int n_quoted = search_paths.size();
+    append_lookups(filemgr, angled, clang::SrcMgr::C_User, seen,
+                   search_paths);
+    const unsigned int n_angled = search_paths.size() - n_quoted;
+    append_lookups(filemgr, system, clang::SrcMgr::C_System, seen,
+                   search_paths);
+    headers.SetSearchPaths(
+        search_paths, n_quoted, n_quoted + n_angled, false);
+
+    // The index is created on first use, and kept thereafter, as removing
+    // a stat cache from the file manager deletes it.
+    if (index && !m_header_index)
+    {
+        m_header_index = new HeaderIndex;
+        filemgr.addStatCache(m_header_index, true);
+        m_include_locator->setHeaderIndex(m_header_index);
+    }
+    m_index_headers = index;
+    update_header_index();
+}
+
+void PreprocessorImpl::append_include_dirs(
+    std::vector<std::string> const& user_dirs,
+    std::vector<std::string> const& system_dirs)
+{
+    clang::HeaderSearch &headers =
+        m_compiler.getPreprocessor().getHeaderSearchInfo();
+    clang::FileManager &filemgr = headers.getFileMgr();
+
+    // Directories already in the search paths are skipped.
+    DirectorySet seen;
+    for (clang::HeaderSearch::search_dir_iterator
+             iter = headers.search_dir_begin();
+         iter != headers.search_dir_end(); ++iter)
+    {
+        if (iter->isNormalDir())
+            seen.insert(iter->getDir());
+    }
+    std::vector<clang::DirectoryLookup> user_lookups, system_lookups;
+    append_lookups(filemgr, user_dirs, clang::SrcMgr::C_User, seen,
+                   user_lookups);
+    append_lookups(filemgr, system_dirs, clang::SrcMgr::C_System, seen,
+                   system_lookups);
+    if (user_lookups.empty() && system_lookups.empty())
+        return;
+
+    // User directories go at the end of the angled range, and system
+    // directories at the end of the system range.
     std::vector<clang::DirectoryLookup> search_paths(
         headers.search_dir_begin(), headers.search_dir_end());
-    // TODO make sure it's not already in the list.
     const unsigned int n_quoted = std::distance(
         headers.quoted_dir_begin(), headers.quoted_dir_end());
     const unsigned int n_angled = std::distance(
         headers.angled_dir_begin(), headers.angled_dir_end());
-    if (sysinclude)
+    search_paths.insert(search_paths.begin() + (n_quoted + n_angled),
+                        user_lookups.begin(), user_lookups.end());
+    search_paths.insert(search_paths.end(),
+                        system_lookups.begin(), system_lookups.end());
+    headers.SetSearchPaths(search_paths, n_quoted,
+                           n_quoted + n_angled + user_lookups.size(), false);
+
+    update_header_index();
+}
+
+void PreprocessorImpl::update_header_index()
+{
+    if (!m_header_index)
+        return;
+    clang::HeaderSearch &headers =
+        m_compiler.getPreprocessor().getHeaderSearchInfo();
+    std::vector<std::string> dirs;
+    for (clang::HeaderSearch::search_dir_iterator
+             iter = headers.search_dir_begin();
+         iter != headers.search_dir_end(); ++iter)
     {
-        clang::DirectoryLookup lookup(
-            entry, clang::SrcMgr::C_System, true, false);
-        search_paths.insert(
-            search_paths.begin() + (n_quoted + n_angled), lookup);
+        if (iter->isNormalDir())
+            dirs.push_back(iter->getDir()->getName());
     }
-    else
+    m_header_index->set_directories(dirs, m_index_headers);
+}
+
+void PreprocessorImpl::configure(Configuration const& config)
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    if (!config.predefines().empty())
     {
-        clang::DirectoryLookup lookup(
-            entry, clang::SrcMgr::C_User, true, false);
-        search_paths.push_back(lookup);
+        // Mark the configuration's directives as being in a system header,
+        // like Clang's own predefines, so redefinitions aren't diagnosed.
+        std::string predefines = pp.getPredefines();
+        predefines.append("# 1 \"<built-in>\" 3\n");
+        predefines.append(config.predefines());
+        pp.setPredefines(predefines);
     }
-    headers.SetSearchPaths(
-        search_paths, n_quoted, n_quoted+n_angled, false);
-    return true;
+    append_include_dirs(
+        config.user_include_dirs(), config.system_include_dirs());
 }
 
+/**
+ * Defines a simple macro.
+ */
 bool
 PreprocessorImpl::define(std::string const& name, std::string const& value)
 {
     // Tokenize the value.
+    // Macro values are rarely repeated, so bypass the tokenize cache.
     std::vector<cmonster::core::Token> value_tokens;
-    if (!value.empty())
-        value_tokens = tokenize(value.c_str(), value.size());
+    TokenVectorSink sink(value_tokens);
+    lex_string(value.c_str(), value.size(), sink);
 
     // TODO move this to a utility function somewhere.
     // Check if it's a function or an object-like macro.
@@ -397,8 +627,100 @@ PreprocessorImpl::define(std::string const& name, std::string const& value)
 }
 
 /**
- * Defines a simple macro.
+ * Defines each macro in a buffer of "#define" directives, lexing the buffer
+ * once rather than once per macro as define() would.
  */
+size_t
+PreprocessorImpl::load_macro_buffer(const char *s, size_t len, bool atomic)
+{
+    // Lex the whole buffer in one go. The raw lexer leaves directives alone,
+    // so lines are delimited by the "start of line" flag.
+    std::vector<clang::Token> tokens;
+    ClangTokenSink sink(tokens);
+    lex_string(s, len, sink);
+    if (tokens.empty())
+        return 0;
+
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    const clang::Token *pos = &tokens[0];
+    const clang::Token *const end = pos + tokens.size();
+    std::vector<cmonster::core::Token> value_tokens;
+    std::vector<std::string> args;
+    size_t count = 0;
+
+    // Atomic loads create every macro before installing any of them.
+    typedef std::vector<std::pair<clang::IdentifierInfo*, clang::MacroInfo*> >
+        PendingMacros;
+    PendingMacros pending;
+    bool failed = false;
+    while (pos != end)
+    {
+        const clang::Token *line_end = pos + 1;
+        while (line_end != end && !line_end->isAtStartOfLine())
+            ++line_end;
+
+        // "#", "define", name.
+        if (line_end - pos >= 3 && pos[0].is(clang::tok::hash) &&
+            pos[1].getIdentifierInfo() &&
+            pos[1].getIdentifierInfo()->isStr("define") &&
+            pos[2].getIdentifierInfo())
+        {
+            const std::string name = pos[2].getIdentifierInfo()->getName();
+            pos += 3;
+
+            // A function-like macro's parameter list must immediately follow
+            // the name.
+            args.clear();
+            bool is_function = false;
+            bool valid = true;
+            if (pos != line_end && pos->is(clang::tok::l_paren) &&
+                !pos->hasLeadingSpace())
+            {
+                is_function = true;
+                ++pos;
+                valid = parse_macro_parameters(pos, line_end, args);
+            }
+
+            if (valid)
+            {
+                value_tokens.clear();
+                for (; pos != line_end; ++pos)
+                    value_tokens.push_back(cmonster::core::Token(pp, *pos));
+                clang::IdentifierInfo *identifier = pp.getIdentifierInfo(name);
+                clang::MacroInfo *macro =
+                    create_macro_info(value_tokens, args, is_function);
+                if (atomic)
+                    pending.push_back(std::make_pair(identifier, macro));
+                else if (install_macro(identifier, macro))
+                    ++count;
+            }
+            else
+            {
+                failed = true;
+            }
+        }
+        pos = line_end;
+    }
+
+    if (atomic)
+    {
+        for (PendingMacros::const_iterator iter = pending.begin();
+             !failed && iter != pending.end(); ++iter)
+        {
+            failed = !can_install_macro(iter->first, *iter->second);
+        }
+        for (PendingMacros::const_iterator iter = pending.begin();
+             iter != pending.end(); ++iter)
+        {
+            if (failed)
+                iter->second->Destroy();
+            else if (install_macro(iter->first, iter->second))
+                ++count;
+        }
+    }
+    return count;
+}
+
 bool
 PreprocessorImpl::add_macro_definition(
     std::string const& name,
@@ -406,7 +728,16 @@ PreprocessorImpl::add_macro_definition(
     std::vector<std::string> const& args, bool is_function)
 {
     clang::Preprocessor &pp = m_compiler.getPreprocessor();
-    clang::IdentifierInfo *macro_identifier = pp.getIdentifierInfo(name);
+    return install_macro(pp.getIdentifierInfo(name),
+                         create_macro_info(value_tokens, args, is_function));
+}
+
+clang::MacroInfo*
+PreprocessorImpl::create_macro_info(
+    std::vector<cmonster::core::Token> const& value_tokens,
+    std::vector<std::string> const& args, bool is_function)
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
     clang::MacroInfo *macro =
         pp.AllocateMacroInfo(clang::SourceLocation());
 
@@ -445,148 +776,94 @@ PreprocessorImpl::add_macro_definition(
         macro->setDefinitionEndLoc(
             value_tokens.back().getClangToken().getLocation());
     }
+    return macro;
+}
 
-    // Is there an existing macro which is different? Then don't define the
-    // new one.
-    clang::MacroInfo *existing_macro = pp.getMacroInfo(macro_identifier);
-    if (existing_macro)
+bool PreprocessorImpl::can_install_macro(clang::IdentifierInfo *name,
+                                         clang::MacroInfo const& macro)
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::MacroInfo *existing_macro = pp.getMacroInfo(name);
+    return !existing_macro || macro.isIdenticalTo(*existing_macro, pp);
+}
+
+bool PreprocessorImpl::install_macro(clang::IdentifierInfo *name,
+                                     clang::MacroInfo *macro)
+{
+    // Is there an existing macro? Then don't define the new one, which is
+    // only as good as the existing one if they're identical.
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    if (pp.getMacroInfo(name))
     {
-        bool result = macro->isIdenticalTo(*existing_macro, pp);
+        const bool result = can_install_macro(name, *macro);
         macro->Destroy();
         return result;
     }
 
-    pp.setMacroInfo(macro_identifier, macro);
+    pp.setMacroInfo(name, macro);
     return true;
 }
 
 bool PreprocessorImpl::define(std::string const& name,
-                          boost::shared_ptr<FunctionMacro> const& function)
+                          boost::shared_ptr<FunctionMacro> const& function,
+                          bool pure)
 {
-    if (function && add_pragma(name, function, true))
-    {
-        clang::Preprocessor &pp = m_compiler.getPreprocessor();
-
-        // Get the IdentifierInfo for the macro name.
-        clang::IdentifierInfo *macro_identifier =
-            pp.getIdentifierInfo(name);
+    if (!function)
+        return false;
 
-        // Make sure the macro isn't already defined?
-        clang::MacroInfo *macro = pp.getMacroInfo(macro_identifier);
-        if (macro)
-        {
-            boost::throw_exception(
-                std::runtime_error("Macro already defined"));
-        }
-
-        // _CMONSTER_PRAGMA(cmonster_pragma __VA_ARGS__)
-        clang::Token t;
-        {
-            t.startToken();
-            t.setKind(clang::tok::identifier);
-            t.setIdentifierInfo(pp.getIdentifierInfo("_CMONSTER_PRAGMA"));
-            pp.CreateString("_CMONSTER_PRAGMA", 16, t);
-
-            // Allocate a new macro.
-            macro = pp.AllocateMacroInfo(t.getLocation());
-            // Make the macro function-like, and varargs-capable.
-            macro->setIsFunctionLike();
-            macro->setIsC99Varargs();
-            clang::IdentifierInfo *va_args =
-                pp.getIdentifierInfo("__VA_ARGS__");
-            macro->setArgumentList(&va_args, 1U,
-                pp.getPreprocessorAllocator());
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::l_paren);
-            pp.CreateString("(", 1, t);
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::identifier);
-            t.setIdentifierInfo(pp.getIdentifierInfo("cmonster_pragma"));
-            pp.CreateString("cmonster_pragma", 15, t);
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::identifier);
-            t.setIdentifierInfo(pp.getIdentifierInfo("__VA_ARGS__"));
-            pp.CreateString("__VA_ARGS__", 11, t);
-            t.setFlag(clang::Token::LeadingSpace);
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::r_paren);
-            pp.CreateString(")", 1, t);
-            macro->AddTokenToBody(t);
-        }
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
 
-        // _Pragma("cmonster" #name)
-        {
-            t.startToken();
-            t.setKind(clang::tok::identifier);
-            t.setIdentifierInfo(pp.getIdentifierInfo("_Pragma"));
-            pp.CreateString("_Pragma", 7, t);
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::l_paren);
-            pp.CreateString("(", 1, t);
-            macro->AddTokenToBody(t);
-        }
-        {
-            std::string qualified_name = "\"cmonster " + name + "\"";
-            t.startToken();
-            t.setKind(clang::tok::string_literal);
-            pp.CreateString(
-                qualified_name.c_str(), qualified_name.size(), t);
-            macro->AddTokenToBody(t);
-        }
-        {
-            t.startToken();
-            t.setKind(clang::tok::r_paren);
-            pp.CreateString(")", 1, t);
-            macro->AddTokenToBody(t);
-            macro->setDefinitionEndLoc(t.getLocation());
-        }
+    // Get the IdentifierInfo for the macro name.
+    clang::IdentifierInfo *macro_identifier = pp.getIdentifierInfo(name);
 
-        // Add the macro to the preprocessor.
-        pp.setMacroInfo(macro_identifier, macro);
-        return true;
+    // Make sure the macro isn't already defined?
+    if (pp.getMacroInfo(macro_identifier))
+    {
+        boost::throw_exception(
+            std::runtime_error("Macro already defined"));
     }
-    return false;
-}
 
-bool PreprocessorImpl::add_pragma(std::string const& name,
-                              boost::shared_ptr<FunctionMacro> const& function)
-{
-    return add_pragma(name, function, false);
+    // Define a hidden, empty object-like macro, whose name can't be spelled
+    // in source. When it is expanded, the macro expander reads the
+    // arguments and enters the function's result.
+    const std::string hook_name = "__cmonster_call " + name;
+    cmonster::core::Token hook(pp, clang::tok::identifier,
+                               hook_name.c_str(), hook_name.size());
+    clang::SourceLocation hook_loc = hook.getClangToken().getLocation();
+    clang::MacroInfo *hook_macro = pp.AllocateMacroInfo(hook_loc);
+    hook_macro->setDefinitionEndLoc(hook_loc);
+
+    // Define the macro itself as "name(...)", expanding to
+    // "hook(__VA_ARGS__)". Clang leaves the name alone if it isn't followed
+    // by an argument list, and macro-expands the arguments, just as it
+    // would for any other function-like macro.
+    std::vector<cmonster::core::Token> body;
+    body.push_back(hook);
+    body.push_back(cmonster::core::Token(pp, clang::tok::l_paren));
+    body.push_back(cmonster::core::Token(
+        pp, clang::tok::identifier, "__VA_ARGS__", 11));
+    body.push_back(cmonster::core::Token(pp, clang::tok::r_paren));
+    std::vector<std::string> args(1, "...");
+    clang::MacroInfo *macro = create_macro_info(body, args, true);
+
+    clang::IdentifierInfo *hook_identifier =
+        hook.getClangToken().getIdentifierInfo();
+    m_macro_expander->add(hook_identifier, *hook_macro, macro_identifier,
+        new BoundFunctionMacro(*this, name, function, pure));
+    pp.setMacroInfo(hook_identifier, hook_macro);
+    pp.setMacroInfo(macro_identifier, macro);
+    m_has_function_macros = true;
+    return true;
 }
 
 bool PreprocessorImpl::add_pragma(std::string const& name,
-                              boost::shared_ptr<FunctionMacro> const& function,
-                              bool with_namespace)
+                              boost::shared_ptr<FunctionMacro> const& function)
 {
     if (function)
     {
-        if (with_namespace)
-        {
-            m_compiler.getPreprocessor().AddPragmaHandler(
-                "cmonster", new DynamicPragmaHandler(
-                    *m_token_saver, name, function, m_exception));
-        }
-        else
-        {
-            m_compiler.getPreprocessor().AddPragmaHandler(
-                new DynamicPragmaHandler(
-                    *m_token_saver, name, function, m_exception));
-        }
+        m_has_function_macros = true;
+        m_compiler.getPreprocessor().AddPragmaHandler(
+            new DynamicPragmaHandler(*this, name, function, m_exception));
         return true;
     }
     return false;
@@ -606,7 +883,8 @@ void PreprocessorImpl::preprocess(long fd)
     check_exception();
 }
 
-TokenIterator* PreprocessorImpl::create_iterator()
+TokenIterator* PreprocessorImpl::create_iterator(
+    boost::shared_ptr<TokenPredicate> const& predicate)
 {
     // Start preprocessing.
     m_compiler.getPreprocessor().EnterMainSourceFile();
@@ -616,86 +894,165 @@ TokenIterator* PreprocessorImpl::create_iterator()
         new ExceptionDiagnosticClient(m_exception));
 
     // Return a TokenIterator.
-    return new TokenIteratorImpl(m_compiler.getPreprocessor(), m_exception);
+    return new TokenIteratorImpl(
+        m_compiler.getPreprocessor(), m_exception, predicate);
 }
 
-// XXX should we just be creating a new Lexer?
-std::vector<cmonster::core::Token>
-PreprocessorImpl::tokenize(const char *s, size_t len)
+TokenIterator* PreprocessorImpl::create_pipelined_iterator(
+    boost::shared_ptr<TokenPredicate> const& predicate, size_t capacity)
 {
-    std::vector<cmonster::core::Token> result;
-    if (!s || !len)
-        return result;
-
-    // If the main preprocessor hasn't yet been entered, create a temporary
-    // one to lex from.
-    clang::Preprocessor &old_pp = m_compiler.getPreprocessor();
-    PreprocessorResetter pp_resetter(m_compiler, old_pp);
-    if (m_file_change_callback->depth == 0)
+    // Function macros and pragma handlers may call back into the
+    // preprocessor (e.g. to lex more tokens), which must not happen
+    // concurrently with the lexing thread. Predicates and include locators
+    // that call into an interpreter may need a lock the consumer holds.
+    // Fall back to the synchronous iterator in either case.
+    boost::shared_ptr<IncludeLocator> const& locator =
+        m_include_locator->getIncludeLocator();
+    if (m_has_function_macros || capacity == 0 ||
+        (predicate && !predicate->is_concurrent_safe()) ||
+        (locator && !locator->is_concurrent_safe()))
     {
-        m_compiler.resetAndLeakPreprocessor();
-        m_compiler.createPreprocessor();
-        m_compiler.getPreprocessor().EnterMainSourceFile();
+        return create_iterator(predicate);
     }
 
-    // Create a memory buffer.
-    std::auto_ptr<llvm::MemoryBuffer> mem(
-        llvm::MemoryBuffer::getMemBufferCopy(
-            llvm::StringRef(s, len), "<generated>"));
+    m_compiler.getPreprocessor().EnterMainSourceFile();
+    m_include_locator->setDelegate(
+        new ExceptionDiagnosticClient(m_exception));
+    return new PipelinedTokenIteratorImpl(
+        m_compiler.getPreprocessor(), m_exception, predicate, capacity);
+}
 
-    // Create a file ID and enter it into the preprocessor.
+ReplayTokenIterator*
+PreprocessorImpl::create_replay_iterator(std::string const& path)
+{
+    // The source manager keeps every buffer registered with it, so register
+    // each stream once, and again only if its contents have changed, i.e.
+    // it has been re-recorded. Reading the file is cheap next to replaying
+    // it. If the file can't be read, registering it reports the error.
     clang::Preprocessor &pp = m_compiler.getPreprocessor();
-    clang::SourceManager &srcmgr = m_compiler.getSourceManager();
-
-    // Transfer ownership of the memory buffer to the source manager.
-    clang::FileID fid = srcmgr.createFileIDForMemBuffer(mem.release());
-
-    // Record the current include depth, and enter the file. We can use the
-    // file change callback to (a) ensure the memory buffer file was entered,
-    // and (b) to determine when to stop lexing.
-    //
-    // Unfortunately the use of a "file" means the preprocessor output is
-    // littered with line markers. It would be nice if we could get rid of
-    // them.
-    const unsigned int old_depth = m_file_change_callback->depth;
-    pp.EnterSourceFile(fid, pp.GetCurDirLookup(), clang::SourceLocation());
-
-    // Did something go awry when trying to enter the file? Bail out.
-    if ((&pp == &old_pp) && m_file_change_callback->depth <= old_depth)
-        return result;
+    clang::FileID &fid = m_replay_streams[path];
+    if (fid.isInvalid() || !same_contents(pp.getSourceManager(), fid, path))
+    {
+        fid = clang::FileID();
+        fid = register_token_stream(pp, path);
+    }
+    return cmonster::core::create_replay_iterator(pp, fid);
+}
+
+void PreprocessorImpl::tokenize(
+    const char *s, size_t len, std::vector<cmonster::core::Token> &result)
+{
+    TokenVectorSink sink(result);
+    lex_string_cached(s, len, sink);
+}
+
+void PreprocessorImpl::tokenize(const char *s, size_t len, TokenBatch &result)
+{
+    TokenBatchSink sink(result);
+    lex_string_cached(s, len, sink);
+}
+
+void PreprocessorImpl::set_tokenize_cache_capacity(size_t capacity)
+{
+    m_tokenize_cache.set_capacity(capacity);
+}
 
-    // Lex until we leave the file. We peek the next token, and if it's
-    // eof or from a different file, bail out.
-    //
-    // Note: I was originally using the file change PP callback's depth
-    // tracking to handle this, but I ran into a problem. The "ExitFile"
-    // callback is not invoked until the next token is lexed, so we would
-    // have to backtrack once we've exited the file. I found that if I had
-    // two macros, one calling the other, both using tokenize, the second
-    // entry to tokenize would start lexing the backtracked tokens before
-    // the tokens from the memory buffer.
+CacheStats PreprocessorImpl::tokenize_cache_stats() const
+{
+    return m_tokenize_cache.stats();
+}
+
+void PreprocessorImpl::set_macro_cache(
+    boost::shared_ptr<MacroCache> const& cache)
+{
+    m_macro_cache = cache;
+}
+
+boost::shared_ptr<MacroCache> PreprocessorImpl::macro_cache() const
+{
+    return m_macro_cache;
+}
+
+void PreprocessorImpl::set_include_cache(
+    boost::shared_ptr<IncludeCache> const& cache)
+{
+    m_include_locator->setIncludeCache(cache);
+    m_include_cache_set = true;
+}
+
+boost::shared_ptr<IncludeCache> PreprocessorImpl::include_cache() const
+{
+    return m_include_locator->getIncludeCache();
+}
+
+ArenaStats PreprocessorImpl::token_arena_stats() const
+{
+    return m_token_arena.stats();
+}
+
+template <typename Sink>
+void PreprocessorImpl::lex_string(const char *s, size_t len, Sink &sink)
+{
+    if (!s || !len)
+        return;
+    if (len > std::numeric_limits<unsigned>::max())
+        boost::throw_exception(std::length_error("string is too long"));
+
+    // Copy the string into the preprocessor's scratch buffer. The scratch
+    // buffer is allocated in large chunks, each with a single FileID, and
+    // NUL-terminates each string it is given, so it can be lexed in place
+    // and the resulting tokens remain spellable for as long as the
+    // preprocessor lives.
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::Token scratch;
+    scratch.startToken();
+    scratch.setKind(clang::tok::raw_identifier);
+    pp.CreateString(s, static_cast<unsigned>(len), scratch);
+    const char *begin = scratch.getRawIdentifierData();
+
+    // Lex with a raw lexer. This doesn't touch the preprocessor's state, so
+    // it works the same whether or not the main file has been entered, and
+    // directives and macros in the string are left as they are. Identifiers
+    // are resolved against the preprocessor's identifier table, which also
+    // gives keywords their proper kind.
+    clang::Lexer lexer(scratch.getLocation(), m_compiler.getLangOpts(),
+                       begin, begin, begin + len);
     clang::Token tok;
-    while (pp.LookAhead(0).isNot(clang::tok::eof) &&
-           srcmgr.getFileID(pp.LookAhead(0).getLocation()) == fid)
+    for (lexer.LexFromRawLexer(tok); tok.isNot(clang::tok::eof);
+         lexer.LexFromRawLexer(tok))
     {
-        pp.LexUnexpandedToken(tok);
+        if (tok.is(clang::tok::raw_identifier))
+            pp.LookUpIdentifierInfo(tok);
+        sink(pp, tok);
+    }
+}
 
-        // If we've had to create another preprocessor, then make sure we
-        // recreate the IdentifierInfo objects in the existing preprocessor.
-        // Everything else (importantly, the source manager) is shared between
-        // the two preprocessor objects.
-        if (&pp != &old_pp && tok.isAnyIdentifier())
-        {
-            clang::IdentifierInfo *II = tok.getIdentifierInfo();
-            if (II)
-                tok.setIdentifierInfo(old_pp.getIdentifierInfo(II->getName()));
-        }
-        result.push_back(cmonster::core::Token(pp, tok));
+template <typename Sink>
+void PreprocessorImpl::lex_string_cached(const char *s, size_t len, Sink &sink)
+{
+    if (!s || !len)
+        return;
+
+    const llvm::StringRef key(s, len);
+    const impl::TokenizeCache::Tokens *tokens = m_tokenize_cache.find(key);
+    impl::TokenizeCache::Tokens lexed;
+    if (!tokens)
+    {
+        ClangTokenSink collector(lexed);
+        lex_string(s, len, collector);
+        m_tokenize_cache.insert(key, lexed);
+        tokens = &lexed;
+    }
+
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    for (impl::TokenizeCache::Tokens::const_iterator iter = tokens->begin();
+         iter != tokens->end(); ++iter)
+    {
+        sink(pp, *iter);
     }
-    return result;
 }
 
-Token* PreprocessorImpl::next(bool expand)
+Token PreprocessorImpl::next(bool expand)
 {
     clang::Preprocessor &pp = m_compiler.getPreprocessor();
     clang::Token tok;
@@ -704,7 +1061,87 @@ Token* PreprocessorImpl::next(bool expand)
     else
         pp.LexUnexpandedToken(tok);
     check_exception();
-    return new Token(m_compiler.getPreprocessor(), tok);
+    return Token(pp, tok);
+}
+
+std::string PreprocessorImpl::read_until(std::string const& terminator)
+{
+    clang::Preprocessor &pp = m_compiler.getPreprocessor();
+    clang::SourceManager &sm = pp.getSourceManager();
+
+    // Lex up to the terminator, noting whether all of the tokens were
+    // lexed from the same file buffer. The tokens themselves are only
+    // needed if they were not.
+    std::vector<Token> tokens;
+    clang::SourceLocation begin;
+    clang::FileID fid;
+    bool contiguous = true;
+    clang::Token tok;
+    for (;;)
+    {
+        pp.LexUnexpandedToken(tok);
+        check_exception();
+        if (tok.is(clang::tok::eof))
+        {
+            throw std::runtime_error(
+                "reached end of input while looking for \"" +
+                terminator + "\"");
+        }
+
+        clang::IdentifierInfo *ii = tok.getIdentifierInfo();
+        if (ii && ii->getName() == terminator)
+            break;
+
+        clang::SourceLocation loc = tok.getLocation();
+        if (begin.isInvalid())
+        {
+            begin = loc;
+            if (loc.isFileID())
+                fid = sm.getFileID(loc);
+        }
+        contiguous = contiguous && loc.isFileID() && sm.getFileID(loc) == fid;
+        tokens.push_back(Token(pp, tok));
+    }
+
+    if (tokens.empty())
+        return std::string();
+
+    clang::SourceLocation end = tok.getLocation();
+    if (!contiguous || !end.isFileID() || sm.getFileID(end) != fid)
+    {
+        std::ostringstream ss;
+        format(ss, tokens);
+        return ss.str();
+    }
+
+    // Slice the text out of the file buffer, preceded by whitespace in
+    // place of whatever precedes the first token on its line. The text
+    // between tokens is copied with its comments blanked out.
+    bool invalid = false;
+    const char *first = sm.getCharacterData(begin, &invalid);
+    const char *last = sm.getCharacterData(end, &invalid);
+    if (invalid)
+        throw std::runtime_error("failed to read source buffer");
+    const unsigned int column = sm.getSpellingColumnNumber(begin);
+    const unsigned int offset = sm.getFileOffset(begin);
+
+    std::string text;
+    text.reserve((column - 1) + (last - first));
+    for (const char *p = first - (column - 1); p != first; ++p)
+        text.push_back(*p == '\t' ? '\t' : ' ');
+    const char *p = first;
+    for (std::vector<Token>::const_iterator iter = tokens.begin();
+         iter != tokens.end(); ++iter)
+    {
+        clang::Token const& token = iter->getClangToken();
+        const char *start =
+            first + (sm.getFileOffset(token.getLocation()) - offset);
+        append_blanking_comments(text, p, start);
+        text.append(start, start + token.getLength());
+        p = start + token.getLength();
+    }
+    append_blanking_comments(text, p, last);
+    return text;
 }
 
 // XXX it would be nice to just use Clang's "DoPrintPreprocessedInput",
@@ -755,14 +1192,38 @@ void
 PreprocessorImpl::set_include_locator(
     boost::shared_ptr<IncludeLocator> const& locator)
 {
+    // The cached results of another locator don't apply to our own cache.
+    // An explicitly set cache is kept: its users share locators by contract.
     m_include_locator->setIncludeLocator(locator);
+    if (!m_include_cache_set)
+    {
+        m_include_locator->setIncludeCache(
+            boost::shared_ptr<IncludeCache>(new IncludeCache));
+    }
 }
 
-Token* PreprocessorImpl::create_token(clang::tok::TokenKind kind,
-                                      const char *value, size_t value_len)
+void
+PreprocessorImpl::set_include_locator_priority(
+    std::vector<std::string> const& first_prefixes, bool fallback)
 {
-    return new Token(m_compiler.getPreprocessor(),
-                     kind, value, value_len);
+    // Header search is short-circuited for the prefixes by the header
+    // index, which is created here if need be.
+    if (!first_prefixes.empty() && !m_header_index)
+    {
+        m_header_index = new HeaderIndex;
+        m_compiler.getFileManager().addStatCache(m_header_index, true);
+        m_include_locator->setHeaderIndex(m_header_index);
+        update_header_index();
+    }
+    if (m_header_index)
+        m_header_index->set_located_prefixes(first_prefixes);
+    m_include_locator->setIncludeLocatorPriority(first_prefixes, fallback);
+}
+
+Token PreprocessorImpl::create_token(clang::tok::TokenKind kind,
+                                     const char *value, size_t value_len)
+{
+    return Token(m_compiler.getPreprocessor(), kind, value, value_len);
 }
 
 void PreprocessorImpl::check_exception()
@@ -780,5 +1241,10 @@ const clang::Preprocessor& PreprocessorImpl::getClangPreprocessor() const
     return m_compiler.getPreprocessor();
 }
 
+clang::Preprocessor& PreprocessorImpl::getClangPreprocessor()
+{
+    return m_compiler.getPreprocessor();
+}
+
 }}}
 
@@ -25,8 +25,11 @@ SOFTWARE.
 
 #include "../preprocessor.hpp"
 #include "include_locator_impl.hpp"
+#include "token_arena.hpp"
+#include "tokenize_cache.hpp"
 
 #include <clang/Frontend/CompilerInstance.h>
+#include <llvm/ADT/StringMap.h>
 
 #include <boost/exception_ptr.hpp>
 
@@ -34,8 +37,14 @@ namespace cmonster {
 namespace core {
 namespace impl {
 
-class TokenSaverPragmaHandler;
-class FileChangePPCallback;
+class HeaderIndex;
+class MacroExpander;
+
+/**
+ * Lex the first token of the main file, skipping over the tokens from the
+ * predefines buffer.
+ */
+void lex_first_token(clang::Preprocessor &pp, clang::Token &token);
 
 class PreprocessorImpl : public Preprocessor
 {
@@ -47,16 +56,35 @@ public:
      */
     bool add_include_dir(std::string const& path, bool sysinclude = true);
 
+    /**
+     * @see Preprocessor::set_include_dirs.
+     */
+    void set_include_dirs(std::vector<std::string> const& quoted,
+                          std::vector<std::string> const& angled,
+                          std::vector<std::string> const& system,
+                          bool index = false);
+
     /**
      * @see Preprocessor::define.
      */
     bool define(std::string const& name, std::string const& value="");
 
+    /**
+     * @see Preprocessor::configure.
+     */
+    void configure(Configuration const& config);
+
+    /**
+     * @see Preprocessor::load_macro_buffer.
+     */
+    size_t load_macro_buffer(const char *s, size_t len, bool atomic = false);
+
     /**
      * @see Preprocessor::define.
      */
     bool define(std::string const& name,
-                boost::shared_ptr<FunctionMacro> const& function);
+                boost::shared_ptr<FunctionMacro> const& function,
+                bool pure = false);
 
     /**
      * @see Preprocessor::add_pragma.
@@ -67,18 +95,79 @@ public:
     /**
      * @see Preprocessor::create_iterator.
      */
-    TokenIterator* create_iterator();
+    TokenIterator* create_iterator(
+        boost::shared_ptr<TokenPredicate> const& predicate =
+            boost::shared_ptr<TokenPredicate>());
+
+    /**
+     * @see Preprocessor::create_pipelined_iterator.
+     */
+    TokenIterator* create_pipelined_iterator(
+        boost::shared_ptr<TokenPredicate> const& predicate =
+            boost::shared_ptr<TokenPredicate>(),
+        size_t capacity = 4096);
+
+    /**
+     * @see Preprocessor::create_replay_iterator.
+     */
+    ReplayTokenIterator* create_replay_iterator(std::string const& path);
+
+    /**
+     * @see Preprocessor::tokenize.
+     */
+    void tokenize(const char *s, size_t len,
+                  std::vector<cmonster::core::Token> &result);
 
     /**
      * @see Preprocessor::tokenize.
      */
-    std::vector<cmonster::core::Token> tokenize(const char *s, size_t len);
+    void tokenize(const char *s, size_t len, TokenBatch &result);
+
+    /**
+     * @see Preprocessor::set_tokenize_cache_capacity.
+     */
+    void set_tokenize_cache_capacity(size_t capacity);
+
+    /**
+     * @see Preprocessor::tokenize_cache_stats.
+     */
+    CacheStats tokenize_cache_stats() const;
+
+    /**
+     * @see Preprocessor::set_macro_cache.
+     */
+    void set_macro_cache(boost::shared_ptr<MacroCache> const& cache);
+
+    /**
+     * @see Preprocessor::macro_cache.
+     */
+    boost::shared_ptr<MacroCache> macro_cache() const;
+
+    /**
+     * @see Preprocessor::set_include_cache.
+     */
+    void set_include_cache(boost::shared_ptr<IncludeCache> const& cache);
+
+    /**
+     * @see Preprocessor::include_cache.
+     */
+    boost::shared_ptr<IncludeCache> include_cache() const;
+
+    /**
+     * @see Preprocessor::token_arena_stats.
+     */
+    ArenaStats token_arena_stats() const;
+
+    /**
+     * Get the arena from which macro result streams are allocated.
+     */
+    impl::TokenArena& token_arena() {return m_token_arena;}
 
     /**
      * @see Preprocessor::create_token.
      */
-    Token* create_token(clang::tok::TokenKind kind,
-                        const char *value = NULL, size_t value_len = 0);
+    Token create_token(clang::tok::TokenKind kind,
+                       const char *value = NULL, size_t value_len = 0);
 
     /**
      * @see Preprocessor::preprocess.
@@ -88,7 +177,12 @@ public:
     /**
      * @see Preprocessor::next.
      */
-    Token* next(bool expand = true);
+    Token next(bool expand = true);
+
+    /**
+     * @see Preprocessor::read_until.
+     */
+    std::string read_until(std::string const& terminator);
 
     /**
      * @see Preprocessor::format.
@@ -102,6 +196,12 @@ public:
      */
     void set_include_locator(boost::shared_ptr<IncludeLocator> const& locator);
 
+    /**
+     * @see Preprocessor::set_include_locator_priority.
+     */
+    void set_include_locator_priority(
+        std::vector<std::string> const& first_prefixes, bool fallback);
+
     /**
      * Check if an exception is pending, and if so, throw it.
      */
@@ -112,10 +212,37 @@ public:
      */
     const clang::Preprocessor& getClangPreprocessor() const;
 
+    /**
+     * @see Preprocessor::getClangPreprocessor.
+     */
+    clang::Preprocessor& getClangPreprocessor();
+
 private: // Methods
-    bool add_pragma(std::string const& name,
-                    boost::shared_ptr<FunctionMacro> const& handler,
-                    bool with_namespace);
+    /**
+     * Lex a string with a raw lexer, passing each token to "sink" along with
+     * the preprocessor that owns it. No preprocessor or FileID is created.
+     */
+    template <typename Sink>
+    void lex_string(const char *s, size_t len, Sink &sink);
+
+    /**
+     * As lex_string, but consulting and populating the tokenize cache.
+     */
+    template <typename Sink>
+    void lex_string_cached(const char *s, size_t len, Sink &sink);
+
+    /**
+     * Append user directories to the angled search paths, and system
+     * directories to the system search paths, in one step. Nonexistent
+     * directories, and those already in the search paths, are skipped.
+     */
+    void append_include_dirs(std::vector<std::string> const& user_dirs,
+                             std::vector<std::string> const& system_dirs);
+
+    /**
+     * Bring the header index, if any, up to date with the search paths.
+     */
+    void update_header_index();
 
     bool
     add_macro_definition(
@@ -123,14 +250,52 @@ private: // Methods
         std::vector<cmonster::core::Token> const& value_tokens,
         std::vector<std::string> const& args, bool is_function);
 
+    /**
+     * Create, but don't install, a macro with the given body and arguments.
+     */
+    clang::MacroInfo*
+    create_macro_info(
+        std::vector<cmonster::core::Token> const& value_tokens,
+        std::vector<std::string> const& args, bool is_function);
+
+    /**
+     * Check whether a macro may be installed under a name: it may, unless a
+     * different macro of the same name is already defined.
+     */
+    bool can_install_macro(clang::IdentifierInfo *name,
+                           clang::MacroInfo const& macro);
+
+    /**
+     * Install a macro under a name, taking ownership of it. If the macro
+     * can't be installed, or is identical to the existing definition, it is
+     * destroyed.
+     *
+     * @return True if the name is now defined as the macro.
+     */
+    bool install_macro(clang::IdentifierInfo *name, clang::MacroInfo *macro);
+
 private: // Attributes
-    clang::CompilerInstance &m_compiler;
-    boost::exception_ptr     m_exception;
+    clang::CompilerInstance       &m_compiler;
+    boost::exception_ptr           m_exception;
+    bool                           m_has_function_macros;
+    impl::TokenizeCache            m_tokenize_cache;
+    boost::shared_ptr<MacroCache>  m_macro_cache;
+    impl::TokenArena               m_token_arena;
 
     // All of these are owned by the Clang preprocessor object.
-    impl::TokenSaverPragmaHandler  *m_token_saver;
-    impl::FileChangePPCallback     *m_file_change_callback;
+    impl::MacroExpander            *m_macro_expander;
     IncludeLocatorDiagnosticClient *m_include_locator;
+
+    // Whether the include cache was set explicitly, rather than being the
+    // preprocessor's own.
+    bool                            m_include_cache_set;
+
+    // Token streams registered for replay, keyed by path.
+    llvm::StringMap<clang::FileID>  m_replay_streams;
+
+    // Owned by the file manager, once created.
+    impl::HeaderIndex              *m_header_index;
+    bool                            m_index_headers;
 };
 
 }}}
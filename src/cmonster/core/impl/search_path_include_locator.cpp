@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../search_path_include_locator.hpp"
+#include "header_index.hpp"
+
+#include <sys/stat.h>
+
+namespace cmonster {
+namespace core {
+
+SearchPathIncludeLocator::SearchPathIncludeLocator(
+    std::vector<std::string> const& dirs)
+  : m_mutex(), m_dirs()
+{
+    m_dirs.reserve(dirs.size());
+    for (std::vector<std::string>::const_iterator iter = dirs.begin();
+         iter != dirs.end(); ++iter)
+    {
+        std::string path(*iter);
+        while (path.size() > 1 && path[path.size()-1] == '/')
+            path.erase(path.size()-1);
+        if (!path.empty())
+            m_dirs.push_back(Directory(path));
+    }
+}
+
+bool SearchPathIncludeLocator::locate(std::string const& filename,
+                                      std::string &absolute_path) const
+{
+    // Strip the delimiters, and find the first path component.
+    if (filename.size() < 3)
+        return false;
+    const std::string name(filename, 1, filename.size() - 2);
+    llvm::StringRef first(name);
+    first = first.substr(0, first.find('/'));
+    if (first.empty())
+        return false;
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (std::vector<Directory>::iterator iter = m_dirs.begin();
+         iter != m_dirs.end(); ++iter)
+    {
+        if (!iter->indexed)
+            index(*iter);
+        if (!iter->names.count(first))
+            continue;
+
+        // The first component is in the index, but the file itself may
+        // be deeper, or not a regular file.
+        std::string path(iter->path);
+        path.push_back('/');
+        path.append(name);
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            absolute_path.swap(path);
+            return true;
+        }
+    }
+    return false;
+}
+
+void SearchPathIncludeLocator::refresh()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (std::vector<Directory>::iterator iter = m_dirs.begin();
+         iter != m_dirs.end(); ++iter)
+    {
+        iter->names.clear();
+        iter->indexed = false;
+    }
+}
+
+std::vector<std::string> SearchPathIncludeLocator::directories() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    std::vector<std::string> dirs;
+    dirs.reserve(m_dirs.size());
+    for (std::vector<Directory>::const_iterator iter = m_dirs.begin();
+         iter != m_dirs.end(); ++iter)
+    {
+        dirs.push_back(iter->path);
+    }
+    return dirs;
+}
+
+void SearchPathIncludeLocator::index(Directory &dir)
+{
+    // A directory that can't be read has an empty index.
+    dir.indexed = true;
+    impl::index_directory(dir.path, dir.names);
+}
+
+}}
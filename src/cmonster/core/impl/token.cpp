@@ -23,38 +23,38 @@ SOFTWARE.
 #include "../token.hpp"
 
 #include <boost/exception/exception.hpp>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 namespace cmonster {
 namespace core {
 
-class TokenImpl
+Token::Token() : m_preprocessor(NULL), m_token(), m_info(NULL)
 {
-public:
-    TokenImpl(clang::Preprocessor &pp) : preprocessor(pp), token()
-    {
-        token.startToken();
-    }
-    TokenImpl(clang::Preprocessor &pp, clang::Token const& token_)
-      : preprocessor(pp), token(token_) {}
-    clang::Preprocessor &preprocessor;
-    clang::Token         token;
-};
-
-Token::Token() : m_impl() {}
+    m_token.startToken();
+}
 
-Token::Token(clang::Preprocessor &pp) : m_impl(new TokenImpl(pp)) {}
+Token::Token(clang::Preprocessor &pp)
+  : m_preprocessor(&pp), m_token(), m_info(NULL)
+{
+    m_token.startToken();
+}
 
 Token::Token(clang::Preprocessor &pp, clang::Token const& token)
-  : m_impl(new TokenImpl(pp, token)) {}
+  : m_preprocessor(&pp), m_token(token), m_info(NULL) {}
+
+Token::Token(clang::Preprocessor &pp, clang::Token const& token,
+             TokenInfo const* info)
+  : m_preprocessor(&pp), m_token(token), m_info(info) {}
 
 Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
              const char *value, size_t value_len)
-  : m_impl(new TokenImpl(pp))
+  : m_preprocessor(&pp), m_token(), m_info(NULL)
 {
-    clang::Token &token = m_impl->token;
-    token.setKind(kind);
-    if (token.isAnyIdentifier())
+    m_token.startToken();
+    m_token.setKind(kind);
+    if (m_token.isAnyIdentifier())
     {
         if (!value || !value_len)
         {
@@ -62,15 +62,14 @@ Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
                 "Expected a non-empty value for identifier"));
         }
         llvm::StringRef s(value, value_len);
-        token.setIdentifierInfo(
-            m_impl->preprocessor.getIdentifierInfo(s));
-        m_impl->preprocessor.CreateString(value, value_len, token);
+        m_token.setIdentifierInfo(pp.getIdentifierInfo(s));
+        pp.CreateString(value, value_len, m_token);
     }
     else
     {
         if (!value || !value_len)
         {
-            if (token.isLiteral())
+            if (m_token.isLiteral())
             {
                 boost::throw_exception(std::invalid_argument(
                     "Expected a non-empty value for literal"));
@@ -84,48 +83,26 @@ Token::Token(clang::Preprocessor &pp, clang::tok::TokenKind kind,
         }
         // Must use this, as it stores the value in a "scratch buffer" for
         // later reference.
-        pp.CreateString(value, value_len, token);
+        pp.CreateString(value, value_len, m_token);
     }
 }
 
-Token::Token(Token const& rhs) : m_impl(new TokenImpl(*rhs.m_impl))
-{
-}
-
-Token& Token::operator=(Token const& rhs)
-{
-    // XXX can we do some kind of COW here?
-    if (rhs.m_impl)
-        m_impl.reset(new TokenImpl(*rhs.m_impl));
-    else
-        m_impl.reset();
-    return *this;
-}
-
-void Token::setClangToken(clang::Token const& token)
-{
-    m_impl->token = token;
-}
-
-clang::Token& Token::getClangToken()
-{
-    return m_impl->token;
-}
-
-const clang::Token& Token::getClangToken() const
+void Token::swap(Token &rhs)
 {
-    return m_impl->token;
-}
-
-const char* Token::getName() const
-{
-    return m_impl->token.getName();
+    std::swap(m_preprocessor, rhs.m_preprocessor);
+    std::swap(m_token, rhs.m_token);
+    std::swap(m_info, rhs.m_info);
 }
 
 std::ostream& operator<<(std::ostream &out, Token const& token)
 {
-    clang::Token const& tok = token.m_impl->token;
-    if (tok.isLiteral())
+    clang::Token const& tok = token.m_token;
+    if (token.m_info)
+    {
+        llvm::StringRef spelling = token.m_info->spelling;
+        out.write(spelling.data(), spelling.size());
+    }
+    else if (tok.isLiteral())
     {
         out << std::string(tok.getLiteralData(), tok.getLength());
     }
@@ -134,10 +111,10 @@ std::ostream& operator<<(std::ostream &out, Token const& token)
         clang::IdentifierInfo *i = tok.getIdentifierInfo();
         out << std::string(i->getNameStart(), i->getLength());
     }
-    else
+    else if (token.m_preprocessor)
     {
         bool invalid = false;
-        out << token.m_impl->preprocessor.getSpelling(tok, &invalid);
+        out << token.m_preprocessor->getSpelling(tok, &invalid);
         if (invalid)
             out << "<invalid>";
     }
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_TOKEN_ARENA_HPP
+#define _CMONSTER_CORE_IMPL_TOKEN_ARENA_HPP
+
+#include "../arena_stats.hpp"
+
+#include <clang/Lex/Token.h>
+#include <llvm/Support/Allocator.h>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A bump allocation arena for the token streams entered into the
+ * preprocessor as macro results. Streams are entered without ownership, so
+ * entering one costs no more than a pointer bump, and the arena's memory is
+ * reclaimed all at once by reset().
+ *
+ * reset() may only be called when no stream allocated from the arena is
+ * still on the preprocessor's lexer stack.
+ */
+class TokenArena
+{
+public:
+    TokenArena();
+
+    /**
+     * Allocate space for "n" tokens. The tokens are uninitialised.
+     */
+    clang::Token* allocate(size_t n);
+
+    /**
+     * Release every stream allocated from the arena, keeping the first slab
+     * of memory for reuse.
+     */
+    void reset();
+
+    ArenaStats stats() const;
+
+private:
+    llvm::BumpPtrAllocator m_allocator;
+    size_t                 m_bytes_in_use;
+    size_t                 m_resets;
+};
+
+}}}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../token_batch.hpp"
+
+#include "token_util.hpp"
+
+#include <clang/Basic/SourceManager.h>
+
+namespace cmonster {
+namespace core {
+
+namespace impl {
+
+bool has_identifier_info(clang::Token const& tok)
+{
+    if (tok.isLiteral() || tok.isAnnotation())
+        return false;
+    switch (tok.getKind())
+    {
+    case clang::tok::unknown:
+    case clang::tok::eof:
+    case clang::tok::eod:
+    case clang::tok::code_completion:
+    case clang::tok::raw_identifier:
+        return false;
+    default:
+        return !clang::tok::getTokenSimpleSpelling(tok.getKind());
+    }
+}
+
+}
+
+TokenBatch::TokenBatch(clang::Preprocessor &pp)
+  : m_preprocessor(&pp), m_kinds(), m_flags(), m_locations(), m_lengths(),
+    m_spelling_ids(), m_spelling_table(), m_spellings(), m_buffer() {}
+
+void TokenBatch::push_back(clang::Token const& token)
+{
+    llvm::StringRef spelling;
+    if (token.isLiteral() && token.getLiteralData() && !token.needsCleaning())
+    {
+        spelling = llvm::StringRef(
+            token.getLiteralData(), token.getLength());
+    }
+    else if (!token.isAnnotation() && token.isNot(clang::tok::raw_identifier)
+             && token.getIdentifierInfo())
+    {
+        spelling = token.getIdentifierInfo()->getName();
+    }
+    else
+    {
+        bool invalid = false;
+        m_buffer.clear();
+        spelling = m_preprocessor->getSpelling(token, m_buffer, &invalid);
+        if (invalid)
+            spelling = llvm::StringRef();
+    }
+    append(token, spelling);
+}
+
+void TokenBatch::push_back(Token const& token)
+{
+    if (token.getInfo())
+        append(token.getClangToken(), token.getInfo()->spelling);
+    else
+        push_back(token.getClangToken());
+}
+
+void TokenBatch::append(clang::Token const& token, llvm::StringRef spelling)
+{
+    m_kinds.push_back(static_cast<unsigned short>(token.getKind()));
+    m_flags.push_back(static_cast<unsigned char>(token.getFlags()));
+    m_locations.push_back(token.getLocation().getRawEncoding());
+    m_lengths.push_back(token.getLength());
+    m_spelling_ids.push_back(intern(spelling));
+}
+
+void TokenBatch::clear()
+{
+    m_kinds.clear();
+    m_flags.clear();
+    m_locations.clear();
+    m_lengths.clear();
+    m_spelling_ids.clear();
+}
+
+void TokenBatch::reset()
+{
+    clear();
+    m_spelling_table.clear();
+    m_spellings.clear();
+}
+
+void TokenBatch::reserve(size_t n)
+{
+    m_kinds.reserve(n);
+    m_flags.reserve(n);
+    m_locations.reserve(n);
+    m_lengths.reserve(n);
+    m_spelling_ids.reserve(n);
+}
+
+Token TokenBatch::token(size_t i) const
+{
+    clang::Token tok;
+    tok.startToken();
+    tok.setKind(kind(i));
+    tok.setLocation(location(i));
+    tok.setLength(length(i));
+    for (unsigned bit = 1; bit <= 0x80; bit <<= 1)
+    {
+        if (m_flags[i] & bit)
+            tok.setFlag(static_cast<clang::Token::TokenFlags>(bit));
+    }
+
+    // Literal data points into the buffer the token was lexed from, which
+    // the source manager keeps alive for as long as the preprocessor lives.
+    if (tok.isLiteral())
+    {
+        clang::SourceManager &sm = m_preprocessor->getSourceManager();
+        tok.setLiteralData(sm.getCharacterData(tok.getLocation()));
+    }
+    else if (impl::has_identifier_info(tok))
+    {
+        tok.setIdentifierInfo(m_preprocessor->getIdentifierInfo(spelling(i)));
+    }
+    return Token(*m_preprocessor, tok);
+}
+
+unsigned TokenBatch::intern(llvm::StringRef spelling)
+{
+    const unsigned next_id = static_cast<unsigned>(m_spellings.size());
+    llvm::StringMapEntry<unsigned> &entry =
+        m_spelling_table.GetOrCreateValue(spelling, next_id);
+    if (entry.getValue() == next_id)
+        m_spellings.push_back(entry.getKey());
+    return entry.getValue();
+}
+
+}}
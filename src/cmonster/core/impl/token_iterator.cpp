@@ -21,6 +21,7 @@ SOFTWARE.
 */
 
 #include "../token_iterator.hpp"
+#include "../token_batch.hpp"
 
 namespace cmonster {
 namespace core {
@@ -29,5 +30,26 @@ TokenIterator::~TokenIterator()
 {
 }
 
+bool TokenIterator::is_concurrent() const throw()
+{
+    return false;
+}
+
+size_t TokenIterator::next_batch(std::vector<Token> &tokens, size_t n)
+{
+    size_t count = 0;
+    for (; count < n && has_next(); ++count)
+        tokens.push_back(next());
+    return count;
+}
+
+size_t TokenIterator::next_batch(TokenBatch &batch, size_t n)
+{
+    size_t count = 0;
+    for (; count < n && has_next(); ++count)
+        batch.push_back(next());
+    return count;
+}
+
 }}
 
@@ -22,6 +22,150 @@ SOFTWARE.
 
 #include "../token_predicate.hpp"
 
+#include <clang/Basic/FileManager.h>
+#include <llvm/ADT/SmallPtrSet.h>
+
+namespace {
+
+using cmonster::core::Token;
+using cmonster::core::TokenPredicate;
+
+class KindPredicate : public TokenPredicate
+{
+public:
+    KindPredicate(std::vector<clang::tok::TokenKind> const& kinds)
+      : m_kinds(clang::tok::NUM_TOKENS, false)
+    {
+        for (size_t i = 0; i < kinds.size(); ++i)
+            m_kinds[kinds[i]] = true;
+    }
+
+    bool operator()(Token const& token) const
+    {
+        return m_kinds[token.getClangToken().getKind()];
+    }
+
+private:
+    std::vector<bool> m_kinds;
+};
+
+class IdentifierPredicate : public TokenPredicate
+{
+public:
+    IdentifierPredicate(clang::Preprocessor &pp,
+                        std::vector<std::string> const& names)
+      : m_identifiers()
+    {
+        for (size_t i = 0; i < names.size(); ++i)
+            m_identifiers.insert(pp.getIdentifierInfo(names[i]));
+    }
+
+    bool operator()(Token const& token) const
+    {
+        clang::Token const& tok = token.getClangToken();
+        if (tok.isLiteral() || tok.isAnnotation() ||
+            tok.is(clang::tok::raw_identifier))
+            return false;
+        clang::IdentifierInfo *II = tok.getIdentifierInfo();
+        return II && m_identifiers.count(II);
+    }
+
+private:
+    llvm::SmallPtrSet<clang::IdentifierInfo*, 16> m_identifiers;
+};
+
+class MainFilePredicate : public TokenPredicate
+{
+public:
+    MainFilePredicate(clang::SourceManager const& sm) : m_sm(sm) {}
+
+    bool operator()(Token const& token) const
+    {
+        clang::SourceLocation loc = token.getClangToken().getLocation();
+        if (loc.isInvalid())
+            return false;
+        return m_sm.getFileID(m_sm.getExpansionLoc(loc)) ==
+            m_sm.getMainFileID();
+    }
+
+private:
+    clang::SourceManager const& m_sm;
+};
+
+class FileSetPredicate : public TokenPredicate
+{
+public:
+    FileSetPredicate(clang::SourceManager &sm,
+                     std::vector<std::string> const& filenames)
+      : m_sm(sm), m_files(), m_last_fid(), m_last_result(false)
+    {
+        clang::FileManager &fm = sm.getFileManager();
+        for (size_t i = 0; i < filenames.size(); ++i)
+        {
+            const clang::FileEntry *file = fm.getFile(filenames[i]);
+            if (file)
+                m_files.insert(file);
+        }
+    }
+
+    bool operator()(Token const& token) const
+    {
+        clang::SourceLocation loc = token.getClangToken().getLocation();
+        if (loc.isInvalid())
+            return false;
+
+        // Consecutive tokens nearly always come from the same file, so
+        // remember the last answer.
+        clang::FileID fid = m_sm.getFileID(m_sm.getExpansionLoc(loc));
+        if (fid != m_last_fid)
+        {
+            const clang::FileEntry *file = m_sm.getFileEntryForID(fid);
+            m_last_fid = fid;
+            m_last_result = file && m_files.count(file);
+        }
+        return m_last_result;
+    }
+
+private:
+    clang::SourceManager                           &m_sm;
+    llvm::SmallPtrSet<const clang::FileEntry*, 8>   m_files;
+    mutable clang::FileID                           m_last_fid;
+    mutable bool                                    m_last_result;
+};
+
+class Conjunction : public TokenPredicate
+{
+public:
+    Conjunction(
+        std::vector<boost::shared_ptr<TokenPredicate> > const& predicates)
+      : m_predicates(predicates) {}
+
+    bool operator()(Token const& token) const
+    {
+        for (size_t i = 0; i < m_predicates.size(); ++i)
+        {
+            if (!(*m_predicates[i])(token))
+                return false;
+        }
+        return true;
+    }
+
+    bool is_concurrent_safe() const
+    {
+        for (size_t i = 0; i < m_predicates.size(); ++i)
+        {
+            if (!m_predicates[i]->is_concurrent_safe())
+                return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<boost::shared_ptr<TokenPredicate> > m_predicates;
+};
+
+}
+
 namespace cmonster {
 namespace core {
 
@@ -29,5 +173,46 @@ TokenPredicate::~TokenPredicate()
 {
 }
 
-}}
+bool TokenPredicate::is_concurrent_safe() const
+{
+    return true;
+}
+
+boost::shared_ptr<TokenPredicate>
+create_kind_predicate(std::vector<clang::tok::TokenKind> const& kinds)
+{
+    return boost::shared_ptr<TokenPredicate>(new KindPredicate(kinds));
+}
 
+boost::shared_ptr<TokenPredicate>
+create_identifier_predicate(clang::Preprocessor &pp,
+                            std::vector<std::string> const& names)
+{
+    return boost::shared_ptr<TokenPredicate>(
+        new IdentifierPredicate(pp, names));
+}
+
+boost::shared_ptr<TokenPredicate>
+create_main_file_predicate(clang::SourceManager const& sm)
+{
+    return boost::shared_ptr<TokenPredicate>(new MainFilePredicate(sm));
+}
+
+boost::shared_ptr<TokenPredicate>
+create_file_set_predicate(clang::SourceManager &sm,
+                          std::vector<std::string> const& filenames)
+{
+    return boost::shared_ptr<TokenPredicate>(
+        new FileSetPredicate(sm, filenames));
+}
+
+boost::shared_ptr<TokenPredicate>
+create_conjunction(
+    std::vector<boost::shared_ptr<TokenPredicate> > const& predicates)
+{
+    if (predicates.size() == 1)
+        return predicates[0];
+    return boost::shared_ptr<TokenPredicate>(new Conjunction(predicates));
+}
+
+}}
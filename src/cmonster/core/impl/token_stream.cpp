@@ -0,0 +1,460 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../token_stream.hpp"
+#include "../token_batch.hpp"
+#include "token_util.hpp"
+
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Token stream file layout. All fixed-width integers are little-endian.
+//
+//   magic         "CMTS"
+//   header        HEADER_FIELDS u32s, indexed by HeaderField
+//   kinds         one byte per token; KIND_ESCAPE is followed by a u16 kind
+//   flags         one byte per token
+//   locations     varint per token: zigzag-encoded delta of the raw location
+//                 from the previous token's
+//   lengths       varint per token
+//   spelling ids  varint per token
+//   pool index    u32 offset of each spelling in the pool, then the pool size
+//   pool          the distinct spellings, each followed by a NUL byte
+//
+// The header records the size in bytes of each section, so each column can
+// be located without decoding the ones before it.
+
+const char MAGIC[4] = {'C', 'M', 'T', 'S'};
+const unsigned VERSION = 1;
+const unsigned char KIND_ESCAPE = 0xFF;
+const size_t RECORD_BATCH_SIZE = 4096;
+
+enum HeaderField
+{
+    HEADER_VERSION,
+    HEADER_TOKENS,
+    HEADER_SPELLINGS,
+    HEADER_KINDS_SIZE,
+    HEADER_FLAGS_SIZE,
+    HEADER_LOCATIONS_SIZE,
+    HEADER_LENGTHS_SIZE,
+    HEADER_SPELLING_IDS_SIZE,
+    HEADER_POOL_INDEX_SIZE,
+    HEADER_POOL_SIZE,
+    HEADER_FIELDS
+};
+
+const size_t HEADER_SIZE = sizeof(MAGIC) + 4 * HEADER_FIELDS;
+
+void put_u32(std::string &out, unsigned value)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+unsigned get_u32(const unsigned char *p)
+{
+    return static_cast<unsigned>(p[0]) | (static_cast<unsigned>(p[1]) << 8) |
+           (static_cast<unsigned>(p[2]) << 16) |
+           (static_cast<unsigned>(p[3]) << 24);
+}
+
+void put_varint(std::string &out, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Map a (wrapping) delta to an unsigned value which is small when the delta
+// is small in magnitude, in either direction.
+unsigned zigzag(unsigned delta)
+{
+    return (delta << 1) ^ ((delta & 0x80000000u) ? 0xFFFFFFFFu : 0u);
+}
+
+unsigned unzigzag(unsigned value)
+{
+    return (value >> 1) ^ (0u - (value & 1));
+}
+
+void check_size(size_t size, const char *what)
+{
+    if (size > std::numeric_limits<unsigned>::max())
+        boost::throw_exception(std::length_error(what));
+}
+
+/**
+ * Accumulates the token columns of a stream as they are recorded.
+ */
+class StreamEncoder
+{
+public:
+    StreamEncoder()
+      : m_count(0), m_previous_location(0), m_kinds(), m_flags(),
+        m_locations(), m_lengths(), m_spelling_ids() {}
+
+    size_t size() const {return m_count;}
+
+    /**
+     * Encode the tokens in the batch. Spelling ids are the batch's, so the
+     * same batch (and hence the same spelling table) must be used for each
+     * call, and passed to write().
+     */
+    void append(cmonster::core::TokenBatch const& batch)
+    {
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const unsigned kind = batch.kind(i);
+            if (kind < KIND_ESCAPE)
+            {
+                m_kinds.push_back(static_cast<char>(kind));
+            }
+            else
+            {
+                m_kinds.push_back(static_cast<char>(KIND_ESCAPE));
+                m_kinds.push_back(static_cast<char>(kind & 0xFF));
+                m_kinds.push_back(static_cast<char>(kind >> 8));
+            }
+            m_flags.push_back(static_cast<char>(batch.flags(i)));
+
+            const unsigned location = batch.raw_locations()[i];
+            put_varint(m_locations, zigzag(location - m_previous_location));
+            m_previous_location = location;
+
+            put_varint(m_lengths, batch.length(i));
+            put_varint(m_spelling_ids, batch.spelling_id(i));
+        }
+        m_count += batch.size();
+    }
+
+    void write(std::ostream &out,
+               cmonster::core::TokenBatch const& batch) const
+    {
+        std::string pool_index;
+        std::string pool;
+        pool_index.reserve(4 * (batch.spelling_count() + 1));
+        for (size_t i = 0; i < batch.spelling_count(); ++i)
+        {
+            check_size(pool.size(), "token stream spelling pool is too large");
+            put_u32(pool_index, static_cast<unsigned>(pool.size()));
+            llvm::StringRef spelling = batch.spelling_at(i);
+            pool.append(spelling.data(), spelling.size());
+            pool.push_back('\0');
+        }
+        check_size(pool.size(), "token stream spelling pool is too large");
+        put_u32(pool_index, static_cast<unsigned>(pool.size()));
+        check_size(m_count, "token stream is too large");
+
+        std::string header(MAGIC, sizeof(MAGIC));
+        put_u32(header, VERSION);
+        put_u32(header, static_cast<unsigned>(m_count));
+        put_u32(header, static_cast<unsigned>(batch.spelling_count()));
+        put_u32(header, static_cast<unsigned>(m_kinds.size()));
+        put_u32(header, static_cast<unsigned>(m_flags.size()));
+        put_u32(header, static_cast<unsigned>(m_locations.size()));
+        put_u32(header, static_cast<unsigned>(m_lengths.size()));
+        put_u32(header, static_cast<unsigned>(m_spelling_ids.size()));
+        put_u32(header, static_cast<unsigned>(pool_index.size()));
+        put_u32(header, static_cast<unsigned>(pool.size()));
+
+        out.write(header.data(), header.size());
+        out.write(m_kinds.data(), m_kinds.size());
+        out.write(m_flags.data(), m_flags.size());
+        out.write(m_locations.data(), m_locations.size());
+        out.write(m_lengths.data(), m_lengths.size());
+        out.write(m_spelling_ids.data(), m_spelling_ids.size());
+        out.write(pool_index.data(), pool_index.size());
+        out.write(pool.data(), pool.size());
+    }
+
+private:
+    size_t      m_count;
+    unsigned    m_previous_location;
+    std::string m_kinds;
+    std::string m_flags;
+    std::string m_locations;
+    std::string m_lengths;
+    std::string m_spelling_ids;
+};
+
+/**
+ * A bounds-checked read position within one section of a token stream.
+ */
+class Cursor
+{
+public:
+    Cursor() : m_pos(NULL), m_end(NULL) {}
+    Cursor(const unsigned char *begin, size_t size)
+      : m_pos(begin), m_end(begin + size) {}
+
+    unsigned byte()
+    {
+        if (m_pos == m_end)
+            truncated();
+        return *m_pos++;
+    }
+
+    unsigned varint()
+    {
+        unsigned value = 0;
+        for (unsigned shift = 0; shift < 35; shift += 7)
+        {
+            const unsigned b = byte();
+            value |= (b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return value;
+        }
+        boost::throw_exception(std::runtime_error("invalid token stream"));
+    }
+
+private:
+    static void truncated()
+    {
+        boost::throw_exception(std::runtime_error("truncated token stream"));
+    }
+
+    const unsigned char *m_pos;
+    const unsigned char *m_end;
+};
+
+class ReplayTokenIteratorImpl : public cmonster::core::ReplayTokenIterator
+{
+public:
+    /**
+     * Validate the stream registered as "stream".
+     */
+    ReplayTokenIteratorImpl(clang::Preprocessor &pp, clang::FileID stream)
+      : m_pp(pp), m_kinds(), m_flags(NULL), m_locations(), m_lengths(),
+        m_spelling_ids(), m_pool_index(NULL), m_pool(NULL),
+        m_pool_location(), m_identifiers(), m_size(0), m_spelling_count(0),
+        m_pool_size(0), m_index(0), m_location(0), m_length(0), m_token(pp)
+    {
+        clang::SourceManager &sm = pp.getSourceManager();
+        const llvm::MemoryBuffer *buffer = sm.getBuffer(stream);
+        const unsigned char *data =
+            reinterpret_cast<const unsigned char*>(buffer->getBufferStart());
+        const size_t size = buffer->getBufferSize();
+        if (size < HEADER_SIZE ||
+            !std::equal(MAGIC, MAGIC + sizeof(MAGIC),
+                        buffer->getBufferStart()))
+        {
+            boost::throw_exception(
+                std::runtime_error("not a cmonster token stream"));
+        }
+
+        unsigned header[HEADER_FIELDS];
+        for (unsigned i = 0; i < HEADER_FIELDS; ++i)
+            header[i] = get_u32(data + sizeof(MAGIC) + 4 * i);
+        if (header[HEADER_VERSION] != VERSION)
+        {
+            boost::throw_exception(
+                std::runtime_error("unsupported token stream version"));
+        }
+
+        m_size = header[HEADER_TOKENS];
+        m_spelling_count = header[HEADER_SPELLINGS];
+        m_pool_size = header[HEADER_POOL_SIZE];
+        size_t expected_size = HEADER_SIZE;
+        for (unsigned i = HEADER_KINDS_SIZE; i <= HEADER_POOL_SIZE; ++i)
+            expected_size += header[i];
+        if (expected_size != size ||
+            header[HEADER_FLAGS_SIZE] != m_size ||
+            header[HEADER_POOL_INDEX_SIZE] != 4 * (m_spelling_count + 1))
+        {
+            boost::throw_exception(std::runtime_error("invalid token stream"));
+        }
+
+        const unsigned char *p = data + HEADER_SIZE;
+        m_kinds = Cursor(p, header[HEADER_KINDS_SIZE]);
+        p += header[HEADER_KINDS_SIZE];
+        m_flags = p;
+        p += header[HEADER_FLAGS_SIZE];
+        m_locations = Cursor(p, header[HEADER_LOCATIONS_SIZE]);
+        p += header[HEADER_LOCATIONS_SIZE];
+        m_lengths = Cursor(p, header[HEADER_LENGTHS_SIZE]);
+        p += header[HEADER_LENGTHS_SIZE];
+        m_spelling_ids = Cursor(p, header[HEADER_SPELLING_IDS_SIZE]);
+        p += header[HEADER_SPELLING_IDS_SIZE];
+        m_pool_index = p;
+        p += header[HEADER_POOL_INDEX_SIZE];
+        m_pool = reinterpret_cast<const char*>(p);
+        m_identifiers.resize(m_spelling_count);
+
+        // The spelling pool has source locations within the stream.
+        m_pool_location =
+            sm.getLocForStartOfFile(stream).getLocWithOffset(p - data);
+    }
+
+    bool has_next() const throw() {return m_index < m_size;}
+
+    cmonster::core::Token& next()
+    {
+        unsigned kind = m_kinds.byte();
+        if (kind == KIND_ESCAPE)
+        {
+            kind = m_kinds.byte();
+            kind |= m_kinds.byte() << 8;
+        }
+        if (kind >= clang::tok::NUM_TOKENS)
+            boost::throw_exception(std::runtime_error("invalid token kind"));
+        m_location += unzigzag(m_locations.varint());
+        m_length = m_lengths.varint();
+
+        const unsigned id = m_spelling_ids.varint();
+        if (id >= m_spelling_count)
+            boost::throw_exception(std::runtime_error("invalid spelling id"));
+        const unsigned begin = get_u32(m_pool_index + 4 * id);
+        const unsigned end = get_u32(m_pool_index + 4 * (id + 1));
+        if (begin >= end || end > m_pool_size)
+            boost::throw_exception(std::runtime_error("invalid spelling id"));
+
+        // Spellings in the pool are already clean, so "NeedsCleaning" is
+        // dropped and the token's length is that of its spelling.
+        const unsigned flags =
+            m_flags[m_index] & ~clang::Token::NeedsCleaning;
+        clang::Token &tok = m_token.getClangToken();
+        tok.startToken();
+        tok.setKind(static_cast<clang::tok::TokenKind>(kind));
+        tok.setLocation(m_pool_location.getLocWithOffset(begin));
+        tok.setLength(end - begin - 1);
+        for (unsigned bit = 1; bit <= 0x80; bit <<= 1)
+        {
+            if (flags & bit)
+                tok.setFlag(static_cast<clang::Token::TokenFlags>(bit));
+        }
+        if (tok.isLiteral())
+        {
+            tok.setLiteralData(m_pool + begin);
+        }
+        else if (cmonster::core::impl::has_identifier_info(tok))
+        {
+            clang::IdentifierInfo *&II = m_identifiers[id];
+            if (!II)
+            {
+                II = m_pp.getIdentifierInfo(
+                    llvm::StringRef(m_pool + begin, end - begin - 1));
+            }
+            tok.setIdentifierInfo(II);
+        }
+        ++m_index;
+        return m_token;
+    }
+
+    size_t size() const throw() {return m_size;}
+    unsigned recorded_location() const throw() {return m_location;}
+    unsigned recorded_length() const throw() {return m_length;}
+
+private:
+    clang::Preprocessor                  &m_pp;
+    Cursor                                m_kinds;
+    const unsigned char                  *m_flags;
+    Cursor                                m_locations;
+    Cursor                                m_lengths;
+    Cursor                                m_spelling_ids;
+    const unsigned char                  *m_pool_index;
+    const char                           *m_pool;
+    clang::SourceLocation                 m_pool_location;
+    // Identifiers are resolved once per distinct spelling.
+    std::vector<clang::IdentifierInfo*>   m_identifiers;
+    size_t                                m_size;
+    unsigned                              m_spelling_count;
+    unsigned                              m_pool_size;
+    size_t                                m_index;
+    unsigned                              m_location;
+    unsigned                              m_length;
+    cmonster::core::Token                 m_token;
+};
+
+}
+
+namespace cmonster {
+namespace core {
+
+size_t record_token_stream(TokenIterator &tokens,
+                           clang::Preprocessor &pp,
+                           std::string const& path)
+{
+    // The batch's spelling table persists across clear(), so it becomes the
+    // stream's spelling pool.
+    TokenBatch batch(pp);
+    batch.reserve(RECORD_BATCH_SIZE);
+    StreamEncoder encoder;
+    while (tokens.next_batch(batch, RECORD_BATCH_SIZE) > 0)
+    {
+        encoder.append(batch);
+        batch.clear();
+    }
+
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+    if (!out)
+    {
+        boost::throw_exception(std::runtime_error(
+            "failed to open token stream for writing: " + path));
+    }
+    encoder.write(out, batch);
+    out.close();
+    if (!out)
+    {
+        boost::throw_exception(std::runtime_error(
+            "failed to write token stream: " + path));
+    }
+    return encoder.size();
+}
+
+clang::FileID
+register_token_stream(clang::Preprocessor &pp, std::string const& path)
+{
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    llvm::error_code ec = llvm::MemoryBuffer::getFile(path, buffer);
+    if (ec)
+    {
+        boost::throw_exception(std::runtime_error(
+            "failed to open token stream " + path + ": " + ec.message()));
+    }
+    return pp.getSourceManager().createFileIDForMemBuffer(
+        llvm::MemoryBuffer::getMemBufferCopy(buffer->getBuffer(), path));
+}
+
+ReplayTokenIterator*
+create_replay_iterator(clang::Preprocessor &pp, clang::FileID stream)
+{
+    return new ReplayTokenIteratorImpl(pp, stream);
+}
+
+}}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_IMPL_TOKENIZE_CACHE_HPP
+#define _CMONSTER_CORE_IMPL_TOKENIZE_CACHE_HPP
+
+#include "../bounded_cache.hpp"
+
+#include <clang/Lex/Token.h>
+
+#include <vector>
+
+namespace cmonster {
+namespace core {
+namespace impl {
+
+/**
+ * A bounded cache mapping strings to the tokens lexed from them.
+ *
+ * The cached tokens refer to the preprocessor's scratch buffer, which lives
+ * as long as the preprocessor, so they may be handed out any number of
+ * times.
+ */
+class TokenizeCache : public BoundedCache<std::vector<clang::Token> >
+{
+public:
+    typedef std::vector<clang::Token> Tokens;
+
+    explicit TokenizeCache(size_t capacity)
+      : BoundedCache<Tokens>(capacity) {}
+};
+
+}}}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_INCLUDE_CACHE_HPP
+#define _CMONSTER_CORE_INCLUDE_CACHE_HPP
+
+#include "cache_stats.hpp"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <ctime>
+#include <string>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A cache of the results of an IncludeLocator, both positive (the path an
+ * include resolved to) and negative (the include could not be located).
+ *
+ * Entries are keyed by the include's spelling and the include path
+ * configuration it was looked up with, as built by the preprocessor. A
+ * cache may be shared by any number of preprocessors, on any number of
+ * threads; preprocessors that share a cache must use equivalent include
+ * locators. The cache is unbounded, as there are only so many headers.
+ *
+ * Negative entries expire after a time to live, as a missing header may be
+ * created (e.g. generated) later; positive entries are checked by the
+ * preprocessor on use instead.
+ *
+ * A cache may be saved to and loaded from disk, so includes need only be
+ * located externally once across processes.
+ */
+class IncludeCache
+{
+public:
+    /**
+     * @param negative_ttl The number of seconds for which negative entries
+     *                     are valid.
+     */
+    explicit IncludeCache(unsigned negative_ttl = 3600);
+
+    /**
+     * Look up an include, counting a hit or a miss.
+     *
+     * @param key The key, as built by the preprocessor.
+     * @param located Set to whether the include was located, on a hit.
+     * @param path Set to the located path, on a positive hit.
+     * @return True if the key was found.
+     */
+    bool find(llvm::StringRef key, bool &located, std::string &path);
+
+    /**
+     * Cache the result of locating an include, replacing any existing entry.
+     */
+    void insert(llvm::StringRef key, bool located, llvm::StringRef path);
+
+    /**
+     * Set the number of seconds for which negative entries are valid. Zero
+     * means that negative results are never reused.
+     */
+    void set_negative_ttl(unsigned negative_ttl);
+
+    /**
+     * Remove all entries, retaining the counters.
+     */
+    void clear();
+
+    /**
+     * Merge the entries saved in a file into the cache. Entries already in
+     * the cache take precedence. A missing or malformed file is not an
+     * error.
+     *
+     * @return The number of entries added.
+     */
+    size_t load(std::string const& filename);
+
+    /**
+     * Save the cache to a file, first merging in the entries saved there
+     * (e.g. by another process). The file is written to a temporary file
+     * and renamed into place, so readers never see a partial file.
+     *
+     * @throw std::runtime_error If the file could not be written.
+     */
+    void save(std::string const& filename);
+
+    /**
+     * Check whether any entries have been inserted since the cache was
+     * created or last saved.
+     */
+    bool modified() const;
+
+    CacheStats stats() const;
+
+private:
+    // An empty path is a negative entry; located paths are never empty.
+    struct Entry
+    {
+        Entry() : path(), time(0) {}
+        std::string path;
+        std::time_t time;
+    };
+    typedef llvm::StringMap<Entry> Map;
+
+    bool expired(Entry const& entry, std::time_t now) const;
+    size_t load_locked(std::string const& filename);
+
+    mutable boost::mutex  m_mutex;
+    Map                   m_entries;
+    unsigned              m_negative_ttl;
+    size_t                m_hits;
+    size_t                m_misses;
+    bool                  m_modified;
+};
+
+}}
+
+#endif
@@ -48,6 +48,14 @@ public:
      */
     virtual bool locate(std::string const& filename,
                         std::string &absolute_path) const = 0;
+
+    /**
+     * Check whether the locator may be consulted on another thread while
+     * the thread that installed it waits.
+     *
+     * @see TokenPredicate::is_concurrent_safe
+     */
+    virtual bool is_concurrent_safe() const {return true;}
 };
 
 }}
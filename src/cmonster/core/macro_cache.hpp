@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_MACRO_CACHE_HPP
+#define _CMONSTER_CORE_MACRO_CACHE_HPP
+
+#include "bounded_cache.hpp"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A bounded cache of the expansions of pure function macros.
+ *
+ * Entries are keyed by the macro name, its definition (see
+ * FunctionMacro::definition) and the kinds and spellings of its arguments,
+ * and the expansion is stored as text, so nothing in the cache refers to a
+ * particular preprocessor. A cache may therefore be shared by any number of
+ * preprocessors, on any number of threads; a redefined macro does not see
+ * the expansions of its previous definition. The oldest entry is evicted
+ * when the cache is full.
+ */
+class MacroCache
+{
+public:
+    explicit MacroCache(size_t capacity = 4096);
+
+    /**
+     * Look up an expansion, counting a hit or a miss.
+     *
+     * @param key The key, as built by the preprocessor.
+     * @param expansion Set to the cached expansion on a hit.
+     * @return True if the key was found.
+     */
+    bool find(llvm::StringRef key, std::string &expansion);
+
+    /**
+     * Cache an expansion, evicting the oldest entry if the cache is full.
+     */
+    void insert(llvm::StringRef key, llvm::StringRef expansion);
+
+    /**
+     * Set the maximum number of entries, evicting entries as necessary. A
+     * capacity of zero disables the cache.
+     */
+    void set_capacity(size_t capacity);
+
+    /**
+     * Remove all entries, retaining the counters.
+     */
+    void clear();
+
+    CacheStats stats() const;
+
+private:
+    mutable boost::mutex         m_mutex;
+    BoundedCache<std::string>    m_cache;
+};
+
+}}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_PLUGIN_HPP
+#define _CMONSTER_CORE_PLUGIN_HPP
+
+#include "function_macro.hpp"
+#include "preprocessor.hpp"
+
+#include <string>
+
+/*
+ * Plugins are shared objects that define native function macros and pragma
+ * handlers. They must be built against the same Clang as cmonster, and
+ * likewise without RTTI.
+ */
+
+/**
+ * The version of the plugin interface. This is incremented whenever the
+ * Preprocessor, FunctionMacro or Token classes change incompatibly.
+ */
+#define CMONSTER_PLUGIN_VERSION 1
+
+/**
+ * Define a plugin's entry point, which is called with the preprocessor the
+ * plugin is loaded into. The entry point typically defines function macros
+ * and pragmas with Preprocessor::define and Preprocessor::add_pragma, e.g.
+ *
+ *     CMONSTER_PLUGIN(preprocessor)
+ *     {
+ *         boost::shared_ptr<cmonster::core::FunctionMacro> macro(new Macro);
+ *         preprocessor.define("MACRO", macro);
+ *     }
+ */
+#define CMONSTER_PLUGIN(preprocessor)                                        \
+    extern "C" unsigned int cmonster_plugin_version()                        \
+    {                                                                        \
+        return CMONSTER_PLUGIN_VERSION;                                      \
+    }                                                                        \
+    extern "C" void cmonster_plugin_init(                                    \
+        cmonster::core::Preprocessor &preprocessor)
+
+namespace cmonster {
+namespace core {
+
+/**
+ * Load a plugin from a shared object, and call its entry point (see
+ * CMONSTER_PLUGIN) with the specified preprocessor.
+ *
+ * Plugins are never unloaded, as the objects they register may outlive any
+ * one preprocessor. A plugin may be loaded into any number of
+ * preprocessors.
+ *
+ * @param preprocessor The preprocessor to load the plugin into.
+ * @param path The path of the shared object.
+ * @throw std::runtime_error If the shared object could not be loaded, or it
+ *        is not a plugin for this version of cmonster.
+ */
+void load_plugin(Preprocessor &preprocessor, std::string const& path);
+
+}}
+
+#endif
@@ -31,14 +31,22 @@ SOFTWARE.
 #include <clang/Basic/TokenKinds.h>
 #include <clang/Lex/Preprocessor.h>
 
+#include "arena_stats.hpp"
+#include "cache_stats.hpp"
+#include "token.hpp"
+
 namespace cmonster {
 namespace core {
 
+class Configuration;
 class FunctionMacro;
+class IncludeCache;
 class IncludeLocator;
+class MacroCache;
+class ReplayTokenIterator;
+class TokenBatch;
 class TokenIterator;
 class TokenPredicate;
-class Token;
 
 /**
  * The core configurable preprocessor class.
@@ -49,15 +57,50 @@ public:
     virtual ~Preprocessor() {}
 
     /**
-     * Add an include directory.
+     * Add an include directory. A directory that is already in the search
+     * paths is not added again.
      *
      * @param path The include directory path to add.
      * @param sysinclude True if path is a system include directory.
-     * @return True if the include path was added successfully.
+     * @return True if the include path exists, and is in the search paths.
      */
     virtual bool
     add_include_dir(std::string const& path, bool sysinclude = true) = 0;
 
+    /**
+     * Replace the header search paths in one step. Directories are searched
+     * in the order given: quoted directories for quoted includes only, then
+     * angled and system directories for both. Nonexistent directories are
+     * ignored, and only the first occurrence of a directory is kept, whether
+     * it is named by the same path or another.
+     *
+     * If "index" is true, the names in each directory are indexed, so that
+     * probing a directory for an include it does not contain is a hash
+     * lookup rather than a system call. Headers created in the directories
+     * afterwards are not found.
+     *
+     * @param quoted The directories to search for quoted includes.
+     * @param angled The user directories to search for all includes.
+     * @param system The system directories to search for all includes.
+     * @param index True to index the directories' contents.
+     */
+    virtual void
+    set_include_dirs(std::vector<std::string> const& quoted,
+                     std::vector<std::string> const& angled,
+                     std::vector<std::string> const& system,
+                     bool index = false) = 0;
+
+    /**
+     * Install a configuration's predefined macros and include directories.
+     * The configuration's predefines are appended to the preprocessor's
+     * predefines buffer, so this must be called before preprocessing
+     * begins. Its include directories are added to the header search paths
+     * in one step. Nonexistent and duplicate directories are ignored.
+     *
+     * @param config The configuration to install.
+     */
+    virtual void configure(Configuration const& config) = 0;
+
     /**
      * Define a plain old macro. Equivalent to "#define name value".
      *
@@ -68,17 +111,39 @@ public:
     virtual bool
     define(std::string const& name, std::string const& value="") = 0;
 
+    /**
+     * Define every macro in a buffer of "#define" directives, such as the
+     * output of "gcc -E -dM". The buffer is lexed once, in its entirety.
+     * Lines which are not "#define" directives are ignored. As with define(),
+     * a macro which is already defined differently is left as it is.
+     *
+     * If "atomic" is true, either every macro in the buffer is defined, or
+     * none is: if any directive is invalid, or names a macro which is
+     * already defined differently, nothing is defined.
+     *
+     * @param s The buffer of directives.
+     * @param len The length of the buffer.
+     * @param atomic True to define all of the macros or none of them.
+     * @return The number of macros defined.
+     */
+    virtual size_t
+    load_macro_buffer(const char *s, size_t len, bool atomic = false) = 0;
+
     /**
      * Define a macro that expands by invoking a given callable object.
      *
      * @param name The name of the macro/function that will be replaced in the
      *             output.
      * @param function The function that will be called on expansion.
+     * @param pure True if the function's result depends only on the
+     *             arguments' kinds and spellings, in which case expansions
+     *             are memoized in the macro cache.
      * @return True if the macro was defined successfully.
      */
     virtual bool
     define(std::string const& name,
-           boost::shared_ptr<FunctionMacro> const& function) = 0;
+           boost::shared_ptr<FunctionMacro> const& function,
+           bool pure = false) = 0;
 
     /**
      * Adds a pragma handler for the specified string.
@@ -98,19 +163,126 @@ public:
      * The returned iterator must not outlive the preprocessor. The caller is
      * responsible for deleting the object when it is no longer needed.
      *
+     * If a predicate is specified, only tokens which satisfy it are yielded.
+     * The predicate is evaluated within the lexing loop, so discarded tokens
+     * never leave the preprocessor.
+     *
+     * @param predicate An optional predicate for filtering the output tokens.
      * @return A PreprocessorIterator which will yield output tokens, allocated
      *         with "new".
      */
-    virtual TokenIterator* create_iterator() = 0;
+    virtual TokenIterator* create_iterator(
+        boost::shared_ptr<TokenPredicate> const& predicate =
+            boost::shared_ptr<TokenPredicate>()) = 0;
+
+    /**
+     * Preprocess the input on a separate thread, returning an iterator which
+     * will yield the output tokens as they are produced.
+     *
+     * The lexing thread and the consumer of the iterator are decoupled by a
+     * bounded queue of "capacity" tokens. Each token carries its spelling and
+     * presumed location (see Token::getInfo), resolved on the lexing thread
+     * and owned by the iterator.
+     * If any function macros or pragma handlers have been defined, a
+     * synchronous iterator is returned instead, as those may re-enter the
+     * preprocessor; likewise if the predicate or the include locator is not
+     * safe to call concurrently. The preprocessor must not otherwise be used
+     * while the iterator exists.
+     *
+     * @param predicate An optional predicate for filtering the output tokens.
+     *                  It is evaluated on the lexing thread.
+     * @param capacity The capacity of the queue, in tokens.
+     * @return A TokenIterator allocated with "new".
+     */
+    virtual TokenIterator* create_pipelined_iterator(
+        boost::shared_ptr<TokenPredicate> const& predicate =
+            boost::shared_ptr<TokenPredicate>(),
+        size_t capacity = 4096) = 0;
+
+    /**
+     * Create an iterator which replays the token stream recorded in the file
+     * at "path" (see record_token_stream), without lexing or preprocessing.
+     *
+     * Each stream is registered with the source manager once, however many
+     * times it is replayed, and again only if the file's size or
+     * modification time has changed since.
+     *
+     * @param path The path of a file written by record_token_stream().
+     * @return A ReplayTokenIterator allocated with "new".
+     */
+    virtual ReplayTokenIterator*
+    create_replay_iterator(std::string const& path) = 0;
 
     /**
      * Tokenize a string.
      *
+     * The tokens for recently tokenized strings are cached, keyed by the
+     * string's content, so tokenizing the same string repeatedly (e.g. the
+     * result of a function macro) only lexes it once.
+     *
      * @param s The string to tokenize.
      * @param len The length of the string to tokenize.
+     * @param result The vector to which the resultant tokens are appended.
      */
-    virtual std::vector<cmonster::core::Token>
-    tokenize(const char *s, size_t len) = 0;
+    virtual void
+    tokenize(const char *s, size_t len,
+             std::vector<cmonster::core::Token> &result) = 0;
+
+    /**
+     * Tokenize a string into a columnar token batch.
+     *
+     * @param s The string to tokenize.
+     * @param len The length of the string to tokenize.
+     * @param result The batch to which the resultant tokens are appended.
+     */
+    virtual void
+    tokenize(const char *s, size_t len, TokenBatch &result) = 0;
+
+    /**
+     * Set the maximum number of distinct strings whose tokens are cached by
+     * tokenize(). A capacity of zero disables the cache.
+     */
+    virtual void set_tokenize_cache_capacity(size_t capacity) = 0;
+
+    /**
+     * Get the hit/miss counters and occupancy of the tokenize() cache.
+     */
+    virtual CacheStats tokenize_cache_stats() const = 0;
+
+    /**
+     * Set the cache used to memoize the expansions of pure function macros.
+     * Each preprocessor starts with a cache of its own; setting a common
+     * cache shares expansions between preprocessors. A NULL cache disables
+     * memoization.
+     */
+    virtual void
+    set_macro_cache(boost::shared_ptr<MacroCache> const& cache) = 0;
+
+    /**
+     * Get the cache used to memoize the expansions of pure function macros.
+     */
+    virtual boost::shared_ptr<MacroCache> macro_cache() const = 0;
+
+    /**
+     * Set the cache of include locator results. Each preprocessor starts
+     * with a cache of its own; setting a common cache, which may be saved to
+     * disk, shares results between preprocessors. A NULL cache disables
+     * caching.
+     */
+    virtual void
+    set_include_cache(boost::shared_ptr<IncludeCache> const& cache) = 0;
+
+    /**
+     * Get the cache of include locator results.
+     */
+    virtual boost::shared_ptr<IncludeCache> include_cache() const = 0;
+
+    /**
+     * Get the usage of the arena from which the token streams of function
+     * macro results are allocated. The arena is reset whenever the
+     * preprocessor exits a file.
+     */
+    virtual ArenaStats token_arena_stats() const = 0;
 
     /**
      * Create a token from the given "kind" and value.
@@ -119,7 +291,7 @@ public:
      * @param value TODO
      * @param value_len TODO
      */
-    virtual Token*
+    virtual Token
     create_token(clang::tok::TokenKind kind,
                  const char *value = NULL, size_t value_len = 0) = 0;
 
@@ -134,7 +306,23 @@ public:
     /**
      * Lex the next token in the stream.
      */
-    virtual Token* next(bool expand = true) = 0;
+    virtual Token next(bool expand = true) = 0;
+
+    /**
+     * Lex unexpanded tokens up to and including an identifier token with
+     * the specified name, and return the source text they were lexed from.
+     *
+     * The text runs from the first token up to the terminator, verbatim
+     * but for comments, which are replaced with whitespace (keeping line
+     * breaks). Any characters preceding the first token on its line are
+     * replaced with whitespace, so that indentation is preserved. If the
+     * tokens do not come from a single file buffer (e.g. they come from a
+     * macro expansion), they are formatted as if by "format".
+     *
+     * @param terminator The name of the identifier terminating the text.
+     * @throw std::runtime_error If the end of input is reached first.
+     */
+    virtual std::string read_until(std::string const& terminator) = 0;
 
     /**
      * Format a sequence of tokens.
@@ -145,15 +333,43 @@ public:
 
     /**
      * Set the preprocessor's "include locator", for locating includes
-     * externally.
+     * externally. Unless a cache was set with set_include_cache, this also
+     * gives the preprocessor a new include cache of its own.
      */
     virtual void
     set_include_locator(boost::shared_ptr<IncludeLocator> const& locator) = 0;
 
+    /**
+     * Set when the include locator is consulted, relative to header search.
+     *
+     * Includes starting with one of "first_prefixes" (e.g. "generated/")
+     * are given to the locator first: header search's probes of the search
+     * directories for them are answered "missing" without a system call, so
+     * only a quoted include's own directory is searched before the locator.
+     * Other includes are given to the locator after header search fails to
+     * find them, if "fallback" is true, and are otherwise left unresolved.
+     *
+     * The locator should locate prefixed includes outside the search
+     * directories, as their paths within them are taken to be missing.
+     * By default, there are no prefixes and the locator is the fallback.
+     *
+     * @param first_prefixes Include prefixes to consult the locator first for.
+     * @param fallback True to consult the locator for other includes that
+     *                 header search does not find.
+     */
+    virtual void
+    set_include_locator_priority(
+        std::vector<std::string> const& first_prefixes, bool fallback) = 0;
+
     /**
      * Get the underlying Clang preprocessor.
      */
     virtual const clang::Preprocessor& getClangPreprocessor() const = 0;
+
+    /**
+     * Get the underlying Clang preprocessor.
+     */
+    virtual clang::Preprocessor& getClangPreprocessor() = 0;
 };
 
 }}
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_SEARCH_PATH_INCLUDE_LOCATOR_HPP
+#define _CMONSTER_CORE_SEARCH_PATH_INCLUDE_LOCATOR_HPP
+
+#include "include_locator.hpp"
+
+#include <llvm/ADT/StringSet.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * An IncludeLocator that searches a list of directories, such as a
+ * compiler's include search list, for both angled and quoted includes.
+ *
+ * The names in each directory are read once, on first use, into an index,
+ * so an include is only stat()ed in directories that contain its first
+ * path component. Includes that are in none of the directories therefore
+ * cost a hash lookup per directory.
+ */
+class SearchPathIncludeLocator : public IncludeLocator
+{
+public:
+    explicit SearchPathIncludeLocator(std::vector<std::string> const& dirs);
+
+    bool locate(std::string const& filename,
+                std::string &absolute_path) const;
+
+    /**
+     * Discard the directory indices, e.g. if headers have since been
+     * generated. The directories are indexed again on next use.
+     */
+    void refresh();
+
+    std::vector<std::string> directories() const;
+
+private:
+    struct Directory
+    {
+        explicit Directory(std::string const& path)
+          : path(path), indexed(false), names() {}
+
+        std::string        path;
+        bool               indexed;
+        llvm::StringSet<>  names;
+    };
+
+    static void index(Directory &dir);
+
+    mutable boost::mutex            m_mutex;
+    mutable std::vector<Directory>  m_dirs;
+};
+
+}}
+
+#endif
@@ -24,53 +24,92 @@ SOFTWARE.
 #define _CMONSTER_CORE_TOKEN_HPP
 
 #include <clang/Lex/Preprocessor.h>
-
-#include <boost/shared_ptr.hpp>
+#include <llvm/ADT/StringRef.h>
 
 #include <ostream>
 
 namespace cmonster {
 namespace core {
 
-class TokenImpl;
+/**
+ * A token's spelling and presumed location, resolved when the token was
+ * produced. Tokens produced on another thread carry one, so that they can be
+ * inspected without consulting the source manager that thread is modifying.
+ */
+struct TokenInfo
+{
+    llvm::StringRef  spelling;
+    const char      *filename; // NULL if the location is invalid.
+    unsigned         line;
+    unsigned         column;
+    bool             in_main_file;
+};
 
+/**
+ * A preprocessor token. Tokens are small values (a Clang token, a pointer
+ * to the preprocessor that owns its spelling and an optional pointer to its
+ * resolved info), so they may be copied freely; copying a Token never
+ * allocates.
+ */
 class Token
 {
 public:
     Token();
     Token(clang::Preprocessor &pp);
     Token(clang::Preprocessor &pp, clang::Token const& token);
+    Token(clang::Preprocessor &pp, clang::Token const& token,
+          TokenInfo const* info);
     Token(clang::Preprocessor &pp,
           clang::tok::TokenKind kind,
           const char *value = NULL, size_t value_len = 0);
 
-    Token(Token const& rhs);
-    Token& operator=(Token const& rhs);
-
     /**
      * Get the underlying Clang token.
      */
-    clang::Token& getClangToken();
+    clang::Token& getClangToken() {return m_token;}
 
     /**
      * Get the underlying Clang token.
      */
-    const clang::Token& getClangToken() const;
+    const clang::Token& getClangToken() const {return m_token;}
 
     /**
-     * Set the underlying Clang token.
+     * Set the underlying Clang token, discarding any resolved token info.
      */
-    void setClangToken(clang::Token const&);
+    void setClangToken(clang::Token const& token)
+    {
+        m_token = token;
+        m_info = NULL;
+    }
+
+    /**
+     * Get the token's resolved spelling and location, if any. The info is
+     * owned by the iterator that produced the token, and is freed with it.
+     */
+    TokenInfo const* getInfo() const {return m_info;}
+
+    /**
+     * Get the preprocessor that the token belongs to. This may be NULL for a
+     * default-constructed token.
+     */
+    clang::Preprocessor* getPreprocessor() const {return m_preprocessor;}
 
     /**
      * Get the token name (stringified "kind").
      */
-    const char* getName() const;
+    const char* getName() const {return m_token.getName();}
+
+    /**
+     * Exchange the contents of this token with another.
+     */
+    void swap(Token &rhs);
 
 private:
     friend std::ostream& operator<<(std::ostream&, Token const& token);
 
-    boost::shared_ptr<TokenImpl> m_impl;
+    clang::Preprocessor *m_preprocessor;
+    clang::Token         m_token;
+    TokenInfo const     *m_info;
 };
 
 /**
@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_TOKEN_BATCH_HPP
+#define _CMONSTER_CORE_TOKEN_BATCH_HPP
+
+#include "token.hpp"
+
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * A columnar ("struct of arrays") container of tokens, for moving large
+ * numbers of tokens around without a per-token object.
+ *
+ * Each column is a contiguous array indexed by token position. Spellings are
+ * interned into a table owned by the batch, so each distinct spelling is
+ * stored once no matter how many times it occurs. The spelling table is
+ * retained across calls to clear(), so a batch that is refilled repeatedly
+ * (e.g. by an iterator) does not re-intern common identifiers.
+ *
+ * Batches are not copyable, as the spellings refer to the batch's own
+ * spelling table.
+ */
+class TokenBatch : boost::noncopyable
+{
+public:
+    TokenBatch(clang::Preprocessor &pp);
+
+    /**
+     * Append a Clang token to the batch.
+     */
+    void push_back(clang::Token const& token);
+
+    /**
+     * Append a cmonster token to the batch. The token's resolved spelling is
+     * used, if it has one.
+     */
+    void push_back(Token const& token);
+
+    /**
+     * Remove all tokens from the batch, retaining the spelling table.
+     */
+    void clear();
+
+    /**
+     * Remove all tokens and spellings from the batch.
+     */
+    void reset();
+
+    /**
+     * Reserve storage for "n" tokens in each column.
+     */
+    void reserve(size_t n);
+
+    size_t size() const {return m_kinds.size();}
+    bool empty() const {return m_kinds.empty();}
+
+    clang::tok::TokenKind kind(size_t i) const
+    {
+        return static_cast<clang::tok::TokenKind>(m_kinds[i]);
+    }
+
+    unsigned flags(size_t i) const {return m_flags[i];}
+
+    clang::SourceLocation location(size_t i) const
+    {
+        return clang::SourceLocation::getFromRawEncoding(m_locations[i]);
+    }
+
+    unsigned length(size_t i) const {return m_lengths[i];}
+
+    /**
+     * Get the index of the i'th token's spelling in the spelling table.
+     */
+    unsigned spelling_id(size_t i) const {return m_spelling_ids[i];}
+
+    /**
+     * Get the spelling of the i'th token.
+     */
+    llvm::StringRef spelling(size_t i) const
+    {
+        return m_spellings[m_spelling_ids[i]];
+    }
+
+    /**
+     * Get the number of distinct spellings in the spelling table.
+     */
+    size_t spelling_count() const {return m_spellings.size();}
+
+    /**
+     * Get a spelling from the spelling table by its index.
+     */
+    llvm::StringRef spelling_at(unsigned id) const {return m_spellings[id];}
+
+    /**
+     * Reconstitute the i'th token as a cmonster Token.
+     */
+    Token token(size_t i) const;
+
+    /**
+     * Raw column access.
+     */
+    const unsigned short* kinds() const {return data(m_kinds);}
+    const unsigned char* flags() const {return data(m_flags);}
+    const unsigned* raw_locations() const {return data(m_locations);}
+    const unsigned* lengths() const {return data(m_lengths);}
+    const unsigned* spelling_ids() const {return data(m_spelling_ids);}
+
+    /**
+     * Get the preprocessor the batch's tokens belong to.
+     */
+    clang::Preprocessor& getPreprocessor() const {return *m_preprocessor;}
+
+private:
+    void append(clang::Token const& token, llvm::StringRef spelling);
+    unsigned intern(llvm::StringRef spelling);
+
+    template <typename T>
+    static const T* data(std::vector<T> const& v)
+    {
+        return v.empty() ? NULL : &v[0];
+    }
+
+    clang::Preprocessor          *m_preprocessor;
+    std::vector<unsigned short>   m_kinds;
+    std::vector<unsigned char>    m_flags;
+    std::vector<unsigned>         m_locations;
+    std::vector<unsigned>         m_lengths;
+    std::vector<unsigned>         m_spelling_ids;
+    llvm::StringMap<unsigned>     m_spelling_table;
+    std::vector<llvm::StringRef>  m_spellings;
+    llvm::SmallString<64>         m_buffer;
+};
+
+}}
+
+#endif
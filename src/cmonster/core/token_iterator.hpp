@@ -25,9 +25,13 @@ SOFTWARE.
 
 #include "token.hpp"
 
+#include <vector>
+
 namespace cmonster {
 namespace core {
 
+class TokenBatch;
+
 /**
  * Iterator class, as returned by Preprocessor::preprocess().
  */
@@ -45,6 +49,30 @@ public:
      * Get the next token, subsequently incrementing the iterator.
      */
     virtual Token& next() = 0;
+
+    /**
+     * Get up to "n" tokens, appending them to "tokens". Fewer than "n" tokens
+     * are returned only when the end of the token stream is reached.
+     *
+     * The default implementation calls next() repeatedly; implementations
+     * should override this to avoid the per-token overhead.
+     *
+     * @return The number of tokens appended.
+     */
+    virtual size_t next_batch(std::vector<Token> &tokens, size_t n);
+
+    /**
+     * Get up to "n" tokens, appending them to a columnar token batch.
+     *
+     * @see next_batch(std::vector<Token>&, size_t)
+     */
+    virtual size_t next_batch(TokenBatch &batch, size_t n);
+
+    /**
+     * Check whether tokens are produced concurrently with the caller, i.e.
+     * whether next() and next_batch() may block waiting on another thread.
+     */
+    virtual bool is_concurrent() const throw();
 };
 
 }}
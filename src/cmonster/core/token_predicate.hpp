@@ -25,6 +25,15 @@ SOFTWARE.
 
 #include "token.hpp"
 
+#include <clang/Basic/SourceManager.h>
+#include <clang/Basic/TokenKinds.h>
+#include <clang/Lex/Preprocessor.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
 namespace cmonster {
 namespace core {
 
@@ -37,8 +46,53 @@ public:
     virtual ~TokenPredicate();
 
     virtual bool operator()(Token const& token) const = 0;
+
+    /**
+     * Check whether the predicate may be evaluated on another thread while
+     * the thread that created it waits. Predicates that call back into an
+     * interpreter whose lock the waiting thread may hold return false, so
+     * they are never evaluated on a pipelined iterator's lexing thread.
+     */
+    virtual bool is_concurrent_safe() const;
 };
 
+/**
+ * Create a predicate that matches tokens whose kind is one of "kinds".
+ */
+boost::shared_ptr<TokenPredicate>
+create_kind_predicate(std::vector<clang::tok::TokenKind> const& kinds);
+
+/**
+ * Create a predicate that matches identifier (and keyword) tokens whose name
+ * is one of "names". Names are resolved against the preprocessor's identifier
+ * table up front, so matching is a pointer comparison.
+ */
+boost::shared_ptr<TokenPredicate>
+create_identifier_predicate(clang::Preprocessor &pp,
+                            std::vector<std::string> const& names);
+
+/**
+ * Create a predicate that matches tokens expanded in the main file.
+ */
+boost::shared_ptr<TokenPredicate>
+create_main_file_predicate(clang::SourceManager const& sm);
+
+/**
+ * Create a predicate that matches tokens expanded in any of the specified
+ * files. Files which do not exist are ignored.
+ */
+boost::shared_ptr<TokenPredicate>
+create_file_set_predicate(clang::SourceManager &sm,
+                          std::vector<std::string> const& filenames);
+
+/**
+ * Create a predicate that matches tokens matched by all of "predicates". The
+ * predicates are evaluated in order, so the cheapest should come first.
+ */
+boost::shared_ptr<TokenPredicate>
+create_conjunction(
+    std::vector<boost::shared_ptr<TokenPredicate> > const& predicates);
+
 }}
 
 #endif
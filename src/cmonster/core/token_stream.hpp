@@ -0,0 +1,115 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_CORE_TOKEN_STREAM_HPP
+#define _CMONSTER_CORE_TOKEN_STREAM_HPP
+
+#include "token_iterator.hpp"
+
+#include <clang/Lex/Preprocessor.h>
+
+#include <string>
+
+namespace cmonster {
+namespace core {
+
+/**
+ * An iterator which replays a token stream previously written by
+ * record_token_stream().
+ *
+ * Replayed tokens belong to the preprocessor given to
+ * create_replay_iterator(), and their locations refer to the recorded
+ * spelling pool rather than the original source files. The locations and
+ * lengths the tokens had when they were recorded are available through
+ * recorded_location() and recorded_length().
+ */
+class ReplayTokenIterator : public TokenIterator
+{
+public:
+    /**
+     * Get the number of tokens in the recorded stream.
+     */
+    virtual size_t size() const throw() = 0;
+
+    /**
+     * Get the raw encoding of the recorded location of the token last
+     * returned by next(). Recorded locations are only meaningful relative to
+     * one another, as they were allocated by the recording preprocessor.
+     */
+    virtual unsigned recorded_location() const throw() = 0;
+
+    /**
+     * Get the recorded length of the token last returned by next(), i.e. its
+     * length in the original source, which may differ from the length of
+     * its spelling.
+     */
+    virtual unsigned recorded_length() const throw() = 0;
+};
+
+/**
+ * Record the remaining tokens from "tokens" to the file at "path".
+ *
+ * The file contains one byte per token kind, one byte of flags per token,
+ * delta-encoded locations, lengths, and a pool of distinct spellings which
+ * tokens refer to by index.
+ *
+ * @param tokens The iterator to drain.
+ * @param pp The preprocessor that "tokens" belong to.
+ * @param path The path of the file to write.
+ * @return The number of tokens recorded.
+ */
+size_t record_token_stream(TokenIterator &tokens,
+                           clang::Preprocessor &pp,
+                           std::string const& path);
+
+/**
+ * Register the token stream recorded in the file at "path" with a
+ * preprocessor's source manager.
+ *
+ * The file is read into a buffer, and ownership of the buffer is passed to
+ * the source manager so that replayed tokens may outlive any iterator. The
+ * buffer is a copy, rather than a mapping of the file, so that rewriting the
+ * file can't change tokens that have already been replayed. As the source
+ * manager keeps the buffer for its lifetime, a stream should be registered
+ * once, and replayed any number of times.
+ *
+ * @param pp The preprocessor that replayed tokens will belong to.
+ * @param path The path of a file written by record_token_stream().
+ * @return The stream's file ID.
+ */
+clang::FileID
+register_token_stream(clang::Preprocessor &pp, std::string const& path);
+
+/**
+ * Create an iterator which replays a registered token stream, without
+ * lexing or preprocessing.
+ *
+ * @param pp The preprocessor the stream is registered with.
+ * @param stream The file ID returned by register_token_stream().
+ * @return A ReplayTokenIterator allocated with "new".
+ */
+ReplayTokenIterator*
+create_replay_iterator(clang::Preprocessor &pp, clang::FileID stream);
+
+}}
+
+#endif
@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// XXX Py_LIMITED_API is disabled, see "Configuration_dealloc".
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+//#define Py_LIMITED_API
+
+#include <Python.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "configuration.hpp"
+#include "exception.hpp"
+#include "scoped_pyobject.hpp"
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *ConfigurationType = NULL;
+PyDoc_STRVAR(Configuration_doc,
+"Configuration objects hold predefined macros and include directories,\n"
+"which can be installed into any number of preprocessors with\n"
+"Preprocessor.configure().");
+
+struct Configuration
+{
+    PyObject_HEAD
+    cmonster::core::Configuration *configuration;
+};
+
+static void Configuration_dealloc(Configuration* self)
+{
+    if (self->configuration)
+        delete self->configuration;
+
+    // The type may be subclassed, so free the object with the type's own
+    // tp_free, which the limited API doesn't expose. Instances hold a
+    // reference to their heap type; before Python 3.8, a subclass's
+    // subtype_dealloc releases it instead.
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject*)self);
+#if PY_VERSION_HEX < 0x03080000
+    if (type == ConfigurationType)
+#endif
+        Py_DECREF(type);
+}
+
+// The core configuration is created here rather than in "init", so that it
+// exists even if a subclass doesn't call the base class's __init__.
+static PyObject*
+Configuration_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    ScopedPyObject self(PyType_GenericAlloc(type, 0));
+    if (!self)
+        return NULL;
+    try
+    {
+        ((Configuration*)self.get())->configuration =
+            new cmonster::core::Configuration;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+    return self.release();
+}
+
+static PyObject* Configuration_define(Configuration *self, PyObject *args)
+{
+    const char *name;
+    const char *value = "";
+    if (!PyArg_ParseTuple(args, "s|z:define", &name, &value))
+        return NULL;
+    try
+    {
+        self->configuration->define(name, value ? value : "");
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Configuration_load_macro_buffer(Configuration *self, PyObject *args)
+{
+    const char *s;
+    Py_ssize_t len;
+    if (!PyArg_ParseTuple(args, "s#:load_macro_buffer", &s, &len))
+        return NULL;
+    try
+    {
+        self->configuration->add_predefines(s, static_cast<size_t>(len));
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Configuration_add_include_dir(Configuration *self, PyObject *args)
+{
+    const char *path;
+    PyObject *sysinclude = Py_True;
+    if (!PyArg_ParseTuple(args, "s|O:add_include_dir", &path, &sysinclude))
+        return NULL;
+    const int is_system = PyObject_IsTrue(sysinclude);
+    if (is_system == -1)
+        return NULL;
+    try
+    {
+        self->configuration->add_include_dir(path, is_system != 0);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+// Convert a vector of strings to a tuple of str.
+static PyObject* to_tuple(std::vector<std::string> const& strings)
+{
+    ScopedPyObject tuple(PyTuple_New(strings.size()));
+    if (!tuple)
+        return NULL;
+    for (size_t i = 0; i < strings.size(); ++i)
+    {
+        PyObject *s = PyUnicode_FromStringAndSize(
+            strings[i].data(), strings[i].size());
+        if (!s)
+            return NULL;
+        PyTuple_SetItem(tuple, i, s);
+    }
+    return tuple.release();
+}
+
+static PyObject*
+Configuration_get_predefines(Configuration *self, void *closure)
+{
+    std::string const& predefines = self->configuration->predefines();
+    return PyUnicode_FromStringAndSize(predefines.data(), predefines.size());
+}
+
+static PyObject*
+Configuration_get_user_include_dirs(Configuration *self, void *closure)
+{
+    return to_tuple(self->configuration->user_include_dirs());
+}
+
+static PyObject*
+Configuration_get_system_include_dirs(Configuration *self, void *closure)
+{
+    return to_tuple(self->configuration->system_include_dirs());
+}
+
+static PyMethodDef Configuration_methods[] =
+{
+    {(char*)"define",
+     (PyCFunction)&Configuration_define, METH_VARARGS},
+    {(char*)"load_macro_buffer",
+     (PyCFunction)&Configuration_load_macro_buffer, METH_VARARGS},
+    {(char*)"add_include_dir",
+     (PyCFunction)&Configuration_add_include_dir, METH_VARARGS},
+    {NULL}
+};
+
+static PyGetSetDef Configuration_getset[] =
+{
+    {(char*)"predefines", (getter)Configuration_get_predefines, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {(char*)"user_include_dirs", (getter)Configuration_get_user_include_dirs,
+     NULL, NULL /* docs */, NULL /* closure */},
+    {(char*)"system_include_dirs",
+     (getter)Configuration_get_system_include_dirs, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
+static PyType_Slot ConfigurationTypeSlots[] =
+{
+    {Py_tp_dealloc, (void*)Configuration_dealloc},
+    {Py_tp_getset,  (void*)Configuration_getset},
+    {Py_tp_methods, (void*)Configuration_methods},
+    {Py_tp_doc,     (void*)Configuration_doc},
+    {Py_tp_alloc,   (void*)PyType_GenericAlloc},
+    {Py_tp_new,     (void*)Configuration_new},
+    {0, NULL}
+};
+
+static PyType_Spec ConfigurationTypeSpec =
+{
+    "cmonster._cmonster.Configuration",
+    sizeof(Configuration),
+    0,
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    ConfigurationTypeSlots
+};
+
+cmonster::core::Configuration& get_configuration(Configuration *wrapper)
+{
+    if (!wrapper)
+        throw std::invalid_argument("wrapper == NULL");
+    return *wrapper->configuration;
+}
+
+PyTypeObject* init_configuration_type()
+{
+    ConfigurationType =
+        (PyTypeObject*)PyType_FromSpec(&ConfigurationTypeSpec);
+    if (!ConfigurationType)
+        return NULL;
+    if (PyType_Ready(ConfigurationType) < 0)
+        return NULL;
+    return ConfigurationType;
+}
+
+PyTypeObject* get_configuration_type()
+{
+    return ConfigurationType;
+}
+
+}}
@@ -37,6 +37,20 @@ void set_python_exception()
     if (!PyErr_Occurred())
     {
         boost::exception_ptr const& e = boost::current_exception();
+        try
+        {
+            if (e)
+                boost::rethrow_exception(e);
+        }
+        catch (python_exception const& pe)
+        {
+            pe.restore();
+            if (PyErr_Occurred())
+                return;
+        }
+        catch (...)
+        {
+        }
         if (e)
         {
             std::string what = boost::to_string(e);
@@ -29,9 +29,11 @@ SOFTWARE.
 #include <exception>
 #include <string>
 
+#include "gil.hpp"
 #include "scoped_pyobject.hpp"
 
 #include <boost/exception/all.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace cmonster {
 namespace python {
@@ -45,7 +47,11 @@ struct python_exception : public std::exception
      * Default constructor. This should be called when a Python exception has
      * occurred.
      */
-    inline python_exception() {assert(PyErr_Occurred());}
+    inline python_exception()
+    {
+        assert(PyErr_Occurred());
+        fetch_what();
+    }
 
     /**
      * This constructor may be called to set a Python exception.
@@ -57,6 +63,7 @@ struct python_exception : public std::exception
             PyErr_SetString(type, message);
         else
             PyErr_SetNone(type);
+        fetch_what();
     }
 
     /**
@@ -65,27 +72,31 @@ struct python_exception : public std::exception
     inline ~python_exception() throw() {}
 
     /**
-     * Convert the current Python exception to a string.
+     * Set the Python exception that this was constructed from as the current
+     * Python exception. The exception is held by this object, so it may be
+     * set on a thread other than the one on which it was raised.
+     */
+    inline void restore() const
+    {
+        if (m_error)
+        {
+            Py_XINCREF(m_error->type);
+            Py_XINCREF(m_error->value);
+            Py_XINCREF(m_error->traceback);
+            PyErr_Restore(m_error->type, m_error->value, m_error->traceback);
+        }
+    }
+
+    /**
+     * Get the string form of the Python exception.
+     *
+     * The string is computed when the exception is constructed, as what()
+     * may be called by native code that does not hold the GIL.
      *
      * XXX should this clear the current exception too?
      */
     inline const char *what() const throw()
     {
-        if (m_what.empty() && PyErr_Occurred())
-        {
-            PyObject *exc, *val, *tb;
-            PyErr_Fetch(&exc, &val, &tb);
-            PyErr_NormalizeException(&exc, &val, &tb);
-            ScopedPyObject str(PyObject_Str(val));
-            if (str)
-            {
-                ScopedPyObject utf8_value(PyUnicode_AsUTF8String(str));
-                const char *value;
-                if (utf8_value && (value = PyBytes_AsString(utf8_value)))
-                    m_what = value;
-            }
-            PyErr_Restore(exc, val, tb);
-        }
         return m_what.c_str();
     }
 
@@ -132,12 +143,65 @@ struct python_exception : public std::exception
     }
 
 private:
-    mutable std::string m_what;
+    /**
+     * A Python exception's type, value and traceback. The references may be
+     * released by a thread not holding the GIL.
+     */
+    struct error
+    {
+        error(PyObject *type_, PyObject *value_, PyObject *traceback_)
+          : type(type_), value(value_), traceback(traceback_)
+        {
+            Py_XINCREF(type);
+            Py_XINCREF(value);
+            Py_XINCREF(traceback);
+        }
+
+        ~error()
+        {
+            ScopedGILAcquire gil;
+            Py_XDECREF(type);
+            Py_XDECREF(value);
+            Py_XDECREF(traceback);
+        }
+
+        PyObject *type;
+        PyObject *value;
+        PyObject *traceback;
+    };
+
+    /**
+     * Convert the current Python exception to a string and keep a reference
+     * to it, leaving the exception set.
+     */
+    inline void fetch_what()
+    {
+        PyObject *exc, *val, *tb;
+        PyErr_Fetch(&exc, &val, &tb);
+        PyErr_NormalizeException(&exc, &val, &tb);
+        m_error.reset(new error(exc, val, tb));
+        if (val)
+        {
+            ScopedPyObject str(PyObject_Str(val));
+            if (str)
+            {
+                ScopedPyObject utf8_value(PyUnicode_AsUTF8String(str));
+                const char *value;
+                if (utf8_value && (value = PyBytes_AsString(utf8_value)))
+                    m_what = value;
+            }
+        }
+        PyErr_Restore(exc, val, tb);
+    }
+
+    std::string                m_what;
+    boost::shared_ptr<error>   m_error;
 };
 
 /**
  * This function will set a Python exception, using boost::current_exception if
- * available. If a Python exception is already set, then nothing is done.
+ * available. If a Python exception is already set, then nothing is done. A
+ * python_exception raised on another thread is restored as it was raised.
  */
 void set_python_exception();
 
@@ -28,6 +28,8 @@ SOFTWARE.
 
 #include "exception.hpp"
 #include "function_macro.hpp"
+#include "gil.hpp"
+#include "macro_context.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
 #include "source_location.hpp"
@@ -35,47 +37,75 @@ SOFTWARE.
 
 #include <stdexcept>
 
-namespace {
-    struct ScopedPyObject {
-        ScopedPyObject(PyObject *ref) : m_ref(ref) {}
-        ~ScopedPyObject() {Py_XDECREF(m_ref);}
-        operator PyObject* () {return m_ref;}
-        PyObject *m_ref;
-    };
-}
-
 namespace cmonster {
 namespace python {
 
 FunctionMacro::FunctionMacro(Preprocessor *preprocessor, PyObject *callable)
-  : m_preprocessor(preprocessor), m_callable(callable)
+  : m_preprocessor(preprocessor), m_callable(callable),
+    m_use_context(false), m_definition(), m_context(NULL)
 {
     if (!preprocessor)
         throw std::invalid_argument("preprocessor == NULL");
     if (!callable)
         throw std::invalid_argument("callable == NULL");
+
+    // The calling convention is fixed when the macro is defined.
+    ScopedPyObject marker(
+        PyObject_GetAttrString(callable, "__cmonster_context__"));
+    if (marker)
+    {
+        const int use_context = PyObject_IsTrue(marker);
+        if (use_context == -1)
+            throw python_exception();
+        m_use_context = use_context != 0;
+    }
+    else
+    {
+        PyErr_Clear();
+    }
+
+    ScopedPyObject definition(
+        PyObject_GetAttrString(callable, "__cmonster_definition__"));
+    if (definition)
+    {
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(definition));
+        char *u8_chars;
+        Py_ssize_t u8_size;
+        if (!utf8 || PyBytes_AsStringAndSize(utf8, &u8_chars, &u8_size) == -1)
+            throw python_exception();
+        m_definition.assign(u8_chars, u8_size);
+    }
+    else
+    {
+        PyErr_Clear();
+    }
+
     Py_INCREF((PyObject*)m_preprocessor);
     Py_INCREF(m_callable);
 }
 
 FunctionMacro::~FunctionMacro()
 {
+    ScopedGILAcquire gil;
+    Py_XDECREF((PyObject*)m_context);
     Py_DECREF(m_callable);
     Py_DECREF((PyObject*)m_preprocessor);
 }
 
-std::vector<cmonster::core::Token>
-FunctionMacro::operator()(
+PyObject*
+FunctionMacro::call(
     clang::SourceLocation const& expansion_location,
     std::vector<cmonster::core::Token> const& arguments) const
 {
     // Create the arguments tuple.
     ScopedPyObject args_tuple = PyTuple_New(arguments.size());
     if (!args_tuple)
-        throw std::runtime_error("Failed to create argument tuple");
+        throw python_exception();
     for (Py_ssize_t i = 0; i < static_cast<Py_ssize_t>(arguments.size()); ++i)
     {
         Token *token = create_token(m_preprocessor, arguments[i]);
+        if (!token)
+            throw python_exception();
         PyTuple_SetItem(args_tuple, i, reinterpret_cast<PyObject*>(token));
     }
 
@@ -83,36 +113,80 @@ FunctionMacro::operator()(
     //
     // XXX How do we create a closure via the C API? It would be better if we
     // could bind a function to the preprocessor it was created with, when we
-    // define the function.
+    // define the function. Macros that use the context calling convention
+    // get both from the context instead.
     PyObject *globals = PyEval_GetGlobals();
     if (globals)
     {
-        PyObject *key = PyUnicode_FromString("preprocessor");
-        if (!key)
+        if (PyDict_SetItemString(
+                globals, "preprocessor", (PyObject*)m_preprocessor) == -1)
             throw python_exception();
-        Py_INCREF((PyObject*)m_preprocessor);
-        PyDict_SetItem(globals, key, (PyObject*)m_preprocessor);
 
         cmonster::core::Preprocessor &pp = get_preprocessor(m_preprocessor);
-        SourceLocation *location = create_source_location(
-            expansion_location, pp.getClangPreprocessor().getSourceManager());
+        ScopedPyObject location((PyObject*)create_source_location(
+            expansion_location, pp.getClangPreprocessor().getSourceManager()));
         if (!location)
             throw python_exception();
-        key = PyUnicode_FromString("location");
-        if (!key)
+        if (PyDict_SetItemString(globals, "location", location) == -1)
+            throw python_exception();
+    }
+
+    return PyObject_Call(m_callable, args_tuple, NULL);
+}
+
+PyObject*
+FunctionMacro::call_with_context(
+    clang::SourceLocation const& expansion_location,
+    std::vector<cmonster::core::Token> const& arguments) const
+{
+    // Reuse the cached context, unless it escaped a previous call or is in
+    // use by an enclosing expansion of this same macro.
+    MacroContext *context_ = m_context;
+    if (context_ && !is_macro_context_bound(context_) &&
+        !is_macro_context_shared(context_))
+    {
+        Py_INCREF((PyObject*)context_);
+    }
+    else
+    {
+        context_ = create_macro_context(m_preprocessor);
+        if (!context_)
             throw python_exception();
-        PyDict_SetItem(globals, key, (PyObject*)location);
+        if (!is_macro_context_bound(m_context))
+        {
+            Py_XDECREF((PyObject*)m_context);
+            Py_INCREF((PyObject*)context_);
+            m_context = context_;
+        }
     }
+    ScopedPyObject context((PyObject*)context_);
+
+    bind_macro_context(context_, expansion_location, arguments);
+    PyObject *result = PyObject_CallFunctionObjArgs(
+        m_callable, context.get(), NULL);
+    unbind_macro_context(context_);
+    return result;
+}
+
+void
+FunctionMacro::operator()(
+    clang::SourceLocation const& expansion_location,
+    std::vector<cmonster::core::Token> const& arguments,
+    std::vector<cmonster::core::Token> &result) const
+{
+    // The preprocessor may be running without the GIL.
+    ScopedGILAcquire gil;
 
     // Call the function.
-    ScopedPyObject py_result = PyObject_Call(m_callable, args_tuple, NULL);
+    ScopedPyObject py_result(m_use_context ?
+        call_with_context(expansion_location, arguments) :
+        call(expansion_location, arguments));
     if (!py_result)
         throw python_exception();
 
     // Transform the result.
-    std::vector<cmonster::core::Token> result;
     if (py_result == Py_None)
-        return result;
+        return;
 
     // Is it a string? If so, tokenize it.
     if (PyUnicode_Check(py_result))
@@ -130,8 +204,8 @@ FunctionMacro::operator()(
             {
                 cmonster::core::Preprocessor &pp =
                     get_preprocessor(m_preprocessor);
-                result = pp.tokenize(u8_chars, u8_size);
-                return result;
+                pp.tokenize(u8_chars, u8_size, result);
+                return;
             }
         }
         else
@@ -154,6 +228,7 @@ FunctionMacro::operator()(
     }
     else
     {
+        result.reserve(result.size() + seqlen);
         for (Py_ssize_t i = 0; i < seqlen; ++i)
         {
             ScopedPyObject token_ = PySequence_GetItem(py_result, i);
@@ -170,7 +245,6 @@ FunctionMacro::operator()(
             }
         }
     }
-    return result;
 }
 
 }}
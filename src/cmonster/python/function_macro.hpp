@@ -25,12 +25,23 @@ SOFTWARE.
 
 #include "../core/function_macro.hpp"
 
+#include <string>
+
 namespace cmonster {
 namespace python {
 
 class Preprocessor;
+struct MacroContext;
 
 /**
+ * A function macro implemented by a Python callable.
+ *
+ * By default the callable is passed the argument tokens positionally, and
+ * "preprocessor" and "location" are set in the calling frame's globals. If
+ * the callable has a true "__cmonster_context__" attribute, it is instead
+ * passed a single, reusable MacroContext object. A "__cmonster_definition__"
+ * string attribute identifies the callable's definition (see
+ * cmonster::core::FunctionMacro::definition).
  */
 class FunctionMacro : public cmonster::core::FunctionMacro
 {
@@ -38,13 +49,24 @@ public:
     FunctionMacro(Preprocessor *pp, PyObject *callable);
     ~FunctionMacro();
 
-    std::vector<cmonster::core::Token>
-    operator()(clang::SourceLocation const& expansion_location,
-               std::vector<cmonster::core::Token> const& args) const;
+    void operator()(clang::SourceLocation const& expansion_location,
+                    std::vector<cmonster::core::Token> const& args,
+                    std::vector<cmonster::core::Token> &result) const;
+
+    std::string definition() const {return m_definition;}
 
 private:
-    Preprocessor *m_preprocessor;
-    PyObject     *m_callable;
+    PyObject* call(clang::SourceLocation const& expansion_location,
+                   std::vector<cmonster::core::Token> const& args) const;
+    PyObject* call_with_context(
+        clang::SourceLocation const& expansion_location,
+        std::vector<cmonster::core::Token> const& args) const;
+
+    Preprocessor         *m_preprocessor;
+    PyObject             *m_callable;
+    bool                  m_use_context;
+    std::string           m_definition;
+    mutable MacroContext *m_context;
 };
 
 }}
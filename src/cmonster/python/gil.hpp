@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_GIL_HPP
+#define _CMONSTER_PYTHON_GIL_HPP
+
+#include <Python.h>
+
+namespace cmonster {
+namespace python {
+
+/**
+ * Releases the GIL for the lifetime of the object. Use this around long
+ * running native code that does not touch Python objects.
+ */
+struct ScopedGILRelease
+{
+    ScopedGILRelease() throw() : m_state(PyEval_SaveThread()) {}
+    ~ScopedGILRelease() throw() {PyEval_RestoreThread(m_state);}
+
+private:
+    ScopedGILRelease(ScopedGILRelease const&);
+    ScopedGILRelease& operator=(ScopedGILRelease const&);
+
+    PyThreadState *m_state;
+};
+
+/**
+ * Acquires the GIL for the lifetime of the object. Every callback into Python
+ * from native code must hold one of these, as the caller may have released
+ * the GIL with a ScopedGILRelease.
+ */
+struct ScopedGILAcquire
+{
+    ScopedGILAcquire() throw() : m_state(PyGILState_Ensure()) {}
+    ~ScopedGILAcquire() throw() {PyGILState_Release(m_state);}
+
+private:
+    ScopedGILAcquire(ScopedGILAcquire const&);
+    ScopedGILAcquire& operator=(ScopedGILAcquire const&);
+
+    PyGILState_STATE m_state;
+};
+
+}}
+
+#endif
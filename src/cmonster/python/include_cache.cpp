@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "include_cache.hpp"
+#include "shared_object.hpp"
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *IncludeCacheType = NULL;
+PyDoc_STRVAR(IncludeCache_doc,
+"IncludeCache(negative_ttl=3600) holds the results of include locators,\n"
+"positive and negative, keyed by the include and the include path\n"
+"configuration. It is unbounded. A cache may be shared by any number of\n"
+"preprocessors with Preprocessor.set_include_cache(), and saved to and\n"
+"loaded from disk.\n"
+"\n"
+"Negative results expire after negative_ttl seconds, so that headers\n"
+"created later are found.");
+
+struct IncludeCache : SharedObject<cmonster::core::IncludeCache> {};
+
+static int
+IncludeCache_init(IncludeCache *self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"negative_ttl", NULL};
+    unsigned int negative_ttl = 3600;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|I:IncludeCache",
+                                     (char**)keywords, &negative_ttl))
+        return -1;
+    try
+    {
+        boost::shared_ptr<cmonster::core::IncludeCache> cache(
+            new cmonster::core::IncludeCache(negative_ttl));
+        set_shared_object(self, cache);
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+IncludeCache*
+create_include_cache(
+    boost::shared_ptr<cmonster::core::IncludeCache> const& cache)
+{
+    try
+    {
+        return create_shared_object<IncludeCache>(IncludeCacheType, cache);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+boost::shared_ptr<cmonster::core::IncludeCache> const&
+get_include_cache(IncludeCache *wrapper)
+{
+    return get_shared_object(wrapper, "IncludeCache");
+}
+
+static PyObject* IncludeCache_info(IncludeCache *self, PyObject *args)
+{
+    try
+    {
+        cmonster::core::CacheStats stats = get_include_cache(self)->stats();
+        return Py_BuildValue("{s:n,s:n,s:n}",
+                             "hits", (Py_ssize_t)stats.hits,
+                             "misses", (Py_ssize_t)stats.misses,
+                             "size", (Py_ssize_t)stats.size);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_clear(IncludeCache *self, PyObject *args)
+{
+    try
+    {
+        get_include_cache(self)->clear();
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_load(IncludeCache *self, PyObject *args)
+{
+    const char *filename;
+    if (!PyArg_ParseTuple(args, "s:load", &filename))
+        return NULL;
+    try
+    {
+        return PyLong_FromSize_t(get_include_cache(self)->load(filename));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_save(IncludeCache *self, PyObject *args)
+{
+    const char *filename;
+    if (!PyArg_ParseTuple(args, "s:save", &filename))
+        return NULL;
+    try
+    {
+        get_include_cache(self)->save(filename);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* IncludeCache_modified(IncludeCache *self, PyObject *args)
+{
+    try
+    {
+        return PyBool_FromLong(get_include_cache(self)->modified());
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyMethodDef IncludeCache_methods[] =
+{
+    {(char*)"info", (PyCFunction)&IncludeCache_info, METH_NOARGS},
+    {(char*)"clear", (PyCFunction)&IncludeCache_clear, METH_NOARGS},
+    {(char*)"load", (PyCFunction)&IncludeCache_load, METH_VARARGS},
+    {(char*)"save", (PyCFunction)&IncludeCache_save, METH_VARARGS},
+    {(char*)"modified", (PyCFunction)&IncludeCache_modified, METH_NOARGS},
+    {NULL}
+};
+
+static PyType_Slot IncludeCacheTypeSlots[] =
+{
+    {Py_tp_dealloc, (void*)&dealloc_shared_object<IncludeCache>},
+    {Py_tp_methods, (void*)IncludeCache_methods},
+    {Py_tp_doc,     (void*)IncludeCache_doc},
+    {Py_tp_init,    (void*)IncludeCache_init},
+    {Py_tp_alloc,   (void*)PyType_GenericAlloc},
+    {Py_tp_new,     (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec IncludeCacheTypeSpec =
+{
+    "cmonster._cmonster.IncludeCache",
+    sizeof(IncludeCache),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    IncludeCacheTypeSlots
+};
+
+PyTypeObject* init_include_cache_type()
+{
+    IncludeCacheType = (PyTypeObject*)PyType_FromSpec(&IncludeCacheTypeSpec);
+    if (!IncludeCacheType)
+        return NULL;
+    if (PyType_Ready(IncludeCacheType) < 0)
+        return NULL;
+    return IncludeCacheType;
+}
+
+PyTypeObject* get_include_cache_type()
+{
+    return IncludeCacheType;
+}
+
+}}
@@ -36,6 +36,11 @@ public:
 
     bool locate(std::string const& include, std::string &abs_path) const;
 
+    /**
+     * @see TokenPredicate::is_concurrent_safe
+     */
+    bool is_concurrent_safe() const {return false;}
+
 private:
     PyObject *m_callable;
 };
@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+
+#include "exception.hpp"
+#include "macro_cache.hpp"
+#include "shared_object.hpp"
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *MacroCacheType = NULL;
+PyDoc_STRVAR(MacroCache_doc,
+"MacroCache(capacity=4096) memoizes the expansions of pure function\n"
+"macros, keyed by the macro's definition and arguments. Once capacity\n"
+"entries are held, the oldest is evicted for each new one; a capacity of\n"
+"zero disables the cache. A cache may be shared by any number of\n"
+"preprocessors with Preprocessor.set_macro_cache().");
+
+struct MacroCache : SharedObject<cmonster::core::MacroCache> {};
+
+static int MacroCache_init(MacroCache *self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"capacity", NULL};
+    Py_ssize_t capacity = 4096;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n:MacroCache",
+                                     (char**)keywords, &capacity))
+        return -1;
+    if (capacity < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return -1;
+    }
+    try
+    {
+        boost::shared_ptr<cmonster::core::MacroCache> cache(
+            new cmonster::core::MacroCache(static_cast<size_t>(capacity)));
+        set_shared_object(self, cache);
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+MacroCache*
+create_macro_cache(boost::shared_ptr<cmonster::core::MacroCache> const& cache)
+{
+    try
+    {
+        return create_shared_object<MacroCache>(MacroCacheType, cache);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+boost::shared_ptr<cmonster::core::MacroCache> const&
+get_macro_cache(MacroCache *wrapper)
+{
+    return get_shared_object(wrapper, "MacroCache");
+}
+
+static PyObject* MacroCache_info(MacroCache *self, PyObject *args)
+{
+    try
+    {
+        cmonster::core::CacheStats stats = get_macro_cache(self)->stats();
+        return Py_BuildValue("{s:n,s:n,s:n,s:n}",
+                             "hits", (Py_ssize_t)stats.hits,
+                             "misses", (Py_ssize_t)stats.misses,
+                             "size", (Py_ssize_t)stats.size,
+                             "capacity", (Py_ssize_t)stats.capacity);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* MacroCache_set_capacity(MacroCache *self, PyObject *args)
+{
+    Py_ssize_t capacity;
+    if (!PyArg_ParseTuple(args, "n:set_capacity", &capacity))
+        return NULL;
+    if (capacity < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return NULL;
+    }
+    try
+    {
+        get_macro_cache(self)->set_capacity(static_cast<size_t>(capacity));
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* MacroCache_clear(MacroCache *self, PyObject *args)
+{
+    try
+    {
+        get_macro_cache(self)->clear();
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyMethodDef MacroCache_methods[] =
+{
+    {(char*)"info", (PyCFunction)&MacroCache_info, METH_NOARGS},
+    {(char*)"set_capacity",
+     (PyCFunction)&MacroCache_set_capacity, METH_VARARGS},
+    {(char*)"clear", (PyCFunction)&MacroCache_clear, METH_NOARGS},
+    {NULL}
+};
+
+static PyType_Slot MacroCacheTypeSlots[] =
+{
+    {Py_tp_dealloc, (void*)&dealloc_shared_object<MacroCache>},
+    {Py_tp_methods, (void*)MacroCache_methods},
+    {Py_tp_doc,     (void*)MacroCache_doc},
+    {Py_tp_init,    (void*)MacroCache_init},
+    {Py_tp_alloc,   (void*)PyType_GenericAlloc},
+    {Py_tp_new,     (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec MacroCacheTypeSpec =
+{
+    "cmonster._cmonster.MacroCache",
+    sizeof(MacroCache),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    MacroCacheTypeSlots
+};
+
+PyTypeObject* init_macro_cache_type()
+{
+    MacroCacheType = (PyTypeObject*)PyType_FromSpec(&MacroCacheTypeSpec);
+    if (!MacroCacheType)
+        return NULL;
+    if (PyType_Ready(MacroCacheType) < 0)
+        return NULL;
+    return MacroCacheType;
+}
+
+PyTypeObject* get_macro_cache_type()
+{
+    return MacroCacheType;
+}
+
+}}
@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_MACRO_CACHE_HPP
+#define _CMONSTER_PYTHON_MACRO_CACHE_HPP
+
+#include "../core/macro_cache.hpp"
+
+#include <boost/shared_ptr.hpp>
+
+namespace cmonster {
+namespace python {
+
+// Python object structure to wrap a shared cmonster::core::MacroCache.
+struct MacroCache;
+
+/**
+ * Create a new MacroCache wrapping an existing core cache.
+ */
+MacroCache*
+create_macro_cache(boost::shared_ptr<cmonster::core::MacroCache> const&);
+
+/**
+ * Get the core cache from the Python wrapper object.
+ */
+boost::shared_ptr<cmonster::core::MacroCache> const&
+get_macro_cache(MacroCache *wrapper);
+
+/**
+ * Initialise the MacroCache Python type object.
+ */
+PyTypeObject* init_macro_cache_type();
+
+/**
+ * Get the MacroCache Python type object.
+ */
+PyTypeObject* get_macro_cache_type();
+
+}}
+
+#endif
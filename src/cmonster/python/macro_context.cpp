@@ -0,0 +1,360 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// XXX Py_LIMITED_API is disabled for now, see "init_macro_context_type".
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+//#define Py_LIMITED_API
+
+#include <Python.h>
+#include <stdexcept>
+
+#include "exception.hpp"
+#include "macro_context.hpp"
+#include "preprocessor.hpp"
+#include "scoped_pyobject.hpp"
+#include "source_location.hpp"
+#include "token.hpp"
+
+#include <llvm/ADT/SmallString.h>
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *MacroContextType = NULL;
+static PyTypeObject *TokenViewType = NULL;
+
+PyDoc_STRVAR(MacroContext_doc,
+"MacroContext objects are passed to function macros that use the context\n"
+"calling convention. The expansion location is only computed if the\n"
+"\"location\" attribute is accessed, and the arguments are exposed as a\n"
+"lazy sequence of tokens. A context is only valid during the call.");
+
+PyDoc_STRVAR(TokenView_doc,
+"A lazy, read-only sequence of macro (or pragma) argument tokens, borrowed\n"
+"from the preprocessor. Token objects are created on access; spelling(i)\n"
+"and token_id(i) return an argument's spelling and kind without creating a\n"
+"Token at all.");
+
+struct TokenView
+{
+    PyObject_HEAD
+    Preprocessor *preprocessor;
+    std::vector<cmonster::core::Token> const *tokens;
+};
+
+struct MacroContext
+{
+    PyObject_HEAD
+    Preprocessor *preprocessor;
+    TokenView *args;
+    clang::SourceLocation location;
+    PyObject *location_object;
+    bool bound;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TokenView
+
+static void TokenView_dealloc(TokenView *self)
+{
+    Py_XDECREF((PyObject*)self->preprocessor);
+    PyObject_Del((PyObject*)self);
+}
+
+static bool check_bound(TokenView *self)
+{
+    if (self->tokens)
+        return true;
+    PyErr_SetString(PyExc_RuntimeError,
+        "macro arguments accessed outside of the macro call");
+    return false;
+}
+
+static Py_ssize_t TokenView_length(TokenView *self)
+{
+    if (!check_bound(self))
+        return -1;
+    return static_cast<Py_ssize_t>(self->tokens->size());
+}
+
+static PyObject* TokenView_item(TokenView *self, Py_ssize_t i)
+{
+    if (!check_bound(self))
+        return NULL;
+    if (i < 0 || i >= static_cast<Py_ssize_t>(self->tokens->size()))
+    {
+        PyErr_SetString(PyExc_IndexError, "argument index out of range");
+        return NULL;
+    }
+    return (PyObject*)create_token(self->preprocessor, (*self->tokens)[i]);
+}
+
+/**
+ * Parse an index argument, which may be negative, returning NULL and setting
+ * an exception if it is out of range.
+ */
+static cmonster::core::Token const*
+get_indexed_token(TokenView *self, PyObject *args, const char *format)
+{
+    Py_ssize_t i;
+    if (!PyArg_ParseTuple(args, format, &i))
+        return NULL;
+    if (!check_bound(self))
+        return NULL;
+    const Py_ssize_t size = static_cast<Py_ssize_t>(self->tokens->size());
+    if (i < 0)
+        i += size;
+    if (i < 0 || i >= size)
+    {
+        PyErr_SetString(PyExc_IndexError, "argument index out of range");
+        return NULL;
+    }
+    return &(*self->tokens)[i];
+}
+
+static PyObject* TokenView_spelling(TokenView *self, PyObject *args)
+{
+    cmonster::core::Token const *token =
+        get_indexed_token(self, args, "n:spelling");
+    if (!token)
+        return NULL;
+    try
+    {
+        clang::Preprocessor &pp =
+            get_preprocessor(self->preprocessor).getClangPreprocessor();
+        llvm::SmallString<64> buffer;
+        llvm::StringRef spelling = pp.getSpelling(
+            token->getClangToken(), buffer);
+        return PyUnicode_FromStringAndSize(spelling.data(), spelling.size());
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* TokenView_token_id(TokenView *self, PyObject *args)
+{
+    cmonster::core::Token const *token =
+        get_indexed_token(self, args, "n:token_id");
+    if (!token)
+        return NULL;
+    return PyLong_FromLong(
+        static_cast<long>(token->getClangToken().getKind()));
+}
+
+static PyMethodDef TokenView_methods[] =
+{
+    {(char*)"spelling", (PyCFunction)&TokenView_spelling, METH_VARARGS},
+    {(char*)"token_id", (PyCFunction)&TokenView_token_id, METH_VARARGS},
+    {NULL}
+};
+
+static PyType_Slot TokenViewTypeSlots[] =
+{
+    {Py_tp_dealloc,  (void*)TokenView_dealloc},
+    {Py_tp_methods,  (void*)TokenView_methods},
+    {Py_tp_doc,      (void*)TokenView_doc},
+
+    // See note below in "init_macro_context_type".
+    {Py_sq_length,   (void*)TokenView_length},
+    {Py_sq_item,     (void*)TokenView_item},
+    {0, NULL}
+};
+
+static PyType_Spec TokenViewTypeSpec =
+{
+    "cmonster._cmonster.TokenView",
+    sizeof(TokenView),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    TokenViewTypeSlots
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// MacroContext
+
+static void MacroContext_dealloc(MacroContext *self)
+{
+    Py_XDECREF(self->location_object);
+    Py_XDECREF((PyObject*)self->args);
+    Py_XDECREF((PyObject*)self->preprocessor);
+    PyObject_Del((PyObject*)self);
+}
+
+MacroContext* create_macro_context(Preprocessor *pp)
+{
+    // Allocate the objects directly; neither type may be created from Python.
+    ScopedPyObject args(PyType_GenericAlloc(TokenViewType, 0));
+    if (!args)
+        return NULL;
+    MacroContext *context =
+        (MacroContext*)PyType_GenericAlloc(MacroContextType, 0);
+    if (!context)
+        return NULL;
+
+    Py_INCREF((PyObject*)pp);
+    ((TokenView*)args.get())->preprocessor = pp;
+    ((TokenView*)args.get())->tokens = NULL;
+
+    Py_INCREF((PyObject*)pp);
+    context->preprocessor = pp;
+    context->args = (TokenView*)args.release();
+    context->location = clang::SourceLocation();
+    context->location_object = NULL;
+    context->bound = false;
+    return context;
+}
+
+void bind_macro_context(
+    MacroContext *context,
+    clang::SourceLocation const& expansion_location,
+    std::vector<cmonster::core::Token> const& arguments)
+{
+    if (!context)
+        throw std::invalid_argument("context == NULL");
+    context->location = expansion_location;
+    context->args->tokens = &arguments;
+    context->bound = true;
+}
+
+void unbind_macro_context(MacroContext *context)
+{
+    if (!context)
+        throw std::invalid_argument("context == NULL");
+    context->args->tokens = NULL;
+    context->bound = false;
+    Py_CLEAR(context->location_object);
+}
+
+bool is_macro_context_bound(MacroContext *context)
+{
+    return context && context->bound;
+}
+
+bool is_macro_context_shared(MacroContext *context)
+{
+    return Py_REFCNT((PyObject*)context) > 1 ||
+           Py_REFCNT((PyObject*)context->args) > 1;
+}
+
+static PyObject* MacroContext_get_preprocessor(MacroContext *self, void *)
+{
+    Py_INCREF((PyObject*)self->preprocessor);
+    return (PyObject*)self->preprocessor;
+}
+
+static PyObject* MacroContext_get_args(MacroContext *self, void *)
+{
+    Py_INCREF((PyObject*)self->args);
+    return (PyObject*)self->args;
+}
+
+// The location is only wrapped on first access, and is then cached until
+// the context is unbound.
+static PyObject* MacroContext_get_location(MacroContext *self, void *)
+{
+    if (!self->bound)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+            "macro context accessed outside of the macro call");
+        return NULL;
+    }
+    if (!self->location_object)
+    {
+        try
+        {
+            clang::Preprocessor &pp =
+                get_preprocessor(self->preprocessor).getClangPreprocessor();
+            self->location_object = (PyObject*)create_source_location(
+                self->location, pp.getSourceManager());
+            if (!self->location_object)
+                return NULL;
+        }
+        catch (...)
+        {
+            set_python_exception();
+            return NULL;
+        }
+    }
+    Py_INCREF(self->location_object);
+    return self->location_object;
+}
+
+static PyGetSetDef MacroContext_getset[] =
+{
+    {(char*)"preprocessor", (getter)MacroContext_get_preprocessor, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {(char*)"location", (getter)MacroContext_get_location, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {(char*)"args", (getter)MacroContext_get_args, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
+static PyType_Slot MacroContextTypeSlots[] =
+{
+    {Py_tp_dealloc, (void*)MacroContext_dealloc},
+    {Py_tp_getset,  (void*)MacroContext_getset},
+    {Py_tp_doc,     (void*)MacroContext_doc},
+    {0, NULL}
+};
+
+static PyType_Spec MacroContextTypeSpec =
+{
+    "cmonster._cmonster.MacroContext",
+    sizeof(MacroContext),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    MacroContextTypeSlots
+};
+
+PyTypeObject* init_macro_context_type()
+{
+    TokenViewType = (PyTypeObject*)PyType_FromSpec(&TokenViewTypeSpec);
+    if (!TokenViewType)
+        return NULL;
+
+    // FIXME (CPython Issue 13115)
+    // As for Token, the limited Python API doesn't set 'tp_as_sequence'
+    // correctly, so we'd miss out on len() and indexing.
+    TokenViewType->tp_as_sequence =
+        &((PyHeapTypeObject*)TokenViewType)->as_sequence;
+
+    if (PyType_Ready(TokenViewType) < 0)
+        return NULL;
+    MacroContextType = (PyTypeObject*)PyType_FromSpec(&MacroContextTypeSpec);
+    if (!MacroContextType)
+        return NULL;
+    if (PyType_Ready(MacroContextType) < 0)
+        return NULL;
+    return MacroContextType;
+}
+
+PyTypeObject* get_macro_context_type()
+{
+    return MacroContextType;
+}
+
+}}
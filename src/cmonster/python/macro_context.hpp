@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_MACRO_CONTEXT_HPP
+#define _CMONSTER_PYTHON_MACRO_CONTEXT_HPP
+
+#include "../core/token.hpp"
+
+#include <vector>
+
+namespace cmonster {
+namespace python {
+
+struct Preprocessor;
+
+/**
+ * Python object passed to function macros that use the context calling
+ * convention. A context is bound to one expansion at a time, and may be
+ * rebound for the next expansion once the macro returns.
+ */
+struct MacroContext;
+
+/**
+ * Create a new, unbound MacroContext.
+ */
+MacroContext* create_macro_context(Preprocessor *pp);
+
+/**
+ * Bind a context to a macro expansion. The location and arguments must
+ * outlive the binding.
+ */
+void bind_macro_context(
+    MacroContext *context,
+    clang::SourceLocation const& expansion_location,
+    std::vector<cmonster::core::Token> const& arguments);
+
+/**
+ * Unbind a context, releasing its cached location. Any argument view that
+ * escaped the call becomes invalid.
+ */
+void unbind_macro_context(MacroContext *context);
+
+/**
+ * Check whether a context is currently bound to an expansion.
+ */
+bool is_macro_context_bound(MacroContext *context);
+
+/**
+ * Check whether a context (or its argument view) is referenced by anything
+ * other than its owner, in which case it must not be reused.
+ */
+bool is_macro_context_shared(MacroContext *context);
+
+/**
+ * Initialise the MacroContext and TokenView Python type objects.
+ */
+PyTypeObject* init_macro_context_type();
+
+/**
+ * Get the MacroContext Python type object.
+ */
+PyTypeObject* get_macro_context_type();
+
+}}
+
+#endif
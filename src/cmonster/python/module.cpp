@@ -28,10 +28,15 @@ SOFTWARE.
 
 #include <iostream>
 
+#include "configuration.hpp"
+#include "include_cache.hpp"
+#include "macro_cache.hpp"
+#include "macro_context.hpp"
 #include "parser.hpp"
 #include "parse_result.hpp"
 #include "preprocessor.hpp"
 #include "rewriter.hpp"
+#include "search_path_include_locator.hpp"
 #include "source_location.hpp"
 #include "token_iterator.hpp"
 #include "token.hpp"
@@ -55,6 +60,32 @@ extern "C" {
 PyMODINIT_FUNC
 PyInit__cmonster(void)
 {
+#if PY_VERSION_HEX < 0x03070000
+    // Make sure the GIL exists, as we release it during preprocessing and
+    // parsing.
+    PyEval_InitThreads();
+#endif
+
+    PyObject *ConfigurationType =
+        (PyObject*)cmonster::python::init_configuration_type();
+    if (!ConfigurationType)
+        return NULL;
+
+    PyObject *IncludeCacheType =
+        (PyObject*)cmonster::python::init_include_cache_type();
+    if (!IncludeCacheType)
+        return NULL;
+
+    PyObject *MacroCacheType =
+        (PyObject*)cmonster::python::init_macro_cache_type();
+    if (!MacroCacheType)
+        return NULL;
+
+    PyObject *SearchPathIncludeLocatorType = (PyObject*)
+        cmonster::python::init_search_path_include_locator_type();
+    if (!SearchPathIncludeLocatorType)
+        return NULL;
+
     PyObject *ParserType = (PyObject*)cmonster::python::init_parser_type();
     if (!ParserType)
         return NULL;
@@ -81,6 +112,8 @@ PyInit__cmonster(void)
         return NULL;
     if (!cmonster::python::init_token_iterator_type())
         return NULL;
+    if (!cmonster::python::init_macro_context_type())
+        return NULL;
 
     // Initialise module.
     PyObject *module = PyModule_Create(&cmonstermodule);
@@ -88,15 +121,24 @@ PyInit__cmonster(void)
         return NULL;
 
     // Add types.
+    Py_INCREF(ConfigurationType);
+    Py_INCREF(IncludeCacheType);
+    Py_INCREF(MacroCacheType);
     Py_INCREF(ParserType);
     Py_INCREF(ParseResultType);
     Py_INCREF(TokenType);
     Py_INCREF(RewriterType);
+    Py_INCREF(SearchPathIncludeLocatorType);
     Py_INCREF(SourceLocationType);
+    PyModule_AddObject(module, "Configuration", ConfigurationType);
+    PyModule_AddObject(module, "IncludeCache", IncludeCacheType);
+    PyModule_AddObject(module, "MacroCache", MacroCacheType);
     PyModule_AddObject(module, "Parser", ParserType);
     PyModule_AddObject(module, "ParseResult", ParseResultType);
     PyModule_AddObject(module, "Token", TokenType);
     PyModule_AddObject(module, "Rewriter", RewriterType);
+    PyModule_AddObject(module, "SearchPathIncludeLocator",
+                       SearchPathIncludeLocatorType);
     PyModule_AddObject(module, "SourceLocation", SourceLocationType);
 
     // Add constants (token kinds).
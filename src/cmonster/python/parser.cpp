@@ -25,11 +25,13 @@ SOFTWARE.
 #define Py_LIMITED_API
 
 #include <Python.h>
+#include <boost/scoped_ptr.hpp>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
 
 #include "exception.hpp"
+#include "gil.hpp"
 #include "parser.hpp"
 #include "parse_result.hpp"
 #include "preprocessor.hpp"
@@ -45,6 +47,15 @@ struct Parser
 {
     PyObject_HEAD
     cmonster::core::Parser *parser;
+
+    // The thread that has claimed the parser, and how many times; see
+    // claim_parser. Protected by the GIL.
+    unsigned long owner;
+    unsigned long claims;
+
+    // True while a pipelined token iterator's lexing thread is using the
+    // parser; see claim_parser_for_pipeline. Protected by the GIL.
+    bool pipelined;
 };
 
 static void Parser_dealloc(Parser* self)
@@ -81,10 +92,20 @@ Parser_init(Parser *self, PyObject *args, PyObject *kwds)
 
 static PyObject* Parser_parse(Parser *self, PyObject *args)
 {
+    ScopedParserClaim claim(self);
+    if (!claim.claimed())
+        return NULL;
     try
     {
-        cmonster::core::ParseResult result = self->parser->parse();
-        return (PyObject*)create_parse_result(self, result);
+        // Release the GIL while parsing. Python macros, pragma handlers and
+        // include locators reacquire it when they're called.
+        boost::scoped_ptr<cmonster::core::ParseResult> result;
+        {
+            ScopedGILRelease nogil;
+            result.reset(new cmonster::core::ParseResult(
+                self->parser->parse()));
+        }
+        return (PyObject*)create_parse_result(self, *result);
     }
     catch (...)
     {
@@ -142,6 +163,47 @@ cmonster::core::Parser& get_parser(Parser *wrapper)
     return *wrapper->parser;
 }
 
+bool claim_parser(Parser *wrapper)
+{
+    const unsigned long thread = PyThread_get_thread_ident();
+    if (wrapper->pipelined)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Parser is in use by a pipelined token iterator");
+        return false;
+    }
+    if (wrapper->claims > 0 && wrapper->owner != thread)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Parser is in use by another thread");
+        return false;
+    }
+    wrapper->owner = thread;
+    ++wrapper->claims;
+    return true;
+}
+
+void release_parser(Parser *wrapper)
+{
+    --wrapper->claims;
+}
+
+bool claim_parser_for_pipeline(Parser *wrapper)
+{
+    if (wrapper->pipelined || wrapper->claims > 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Parser is in use");
+        return false;
+    }
+    wrapper->pipelined = true;
+    return true;
+}
+
+void release_parser_for_pipeline(Parser *wrapper)
+{
+    wrapper->pipelined = false;
+}
+
 PyTypeObject* init_parser_type()
 {
     ParserType = (PyTypeObject*)PyType_FromSpec(&ParserTypeSpec);
@@ -36,6 +36,58 @@ struct Parser;
  */
 cmonster::core::Parser& get_parser(Parser *wrapper);
 
+/**
+ * Claim a parser, and with it its preprocessor, for the current thread, for
+ * an operation that releases the GIL. Clang's state is not thread-safe, so
+ * no other thread may use the parser until it is released; the claiming
+ * thread may claim it again, e.g. from a Python macro. The GIL must be held.
+ *
+ * @return False, with RuntimeError set, if another thread holds a claim.
+ */
+bool claim_parser(Parser *wrapper);
+
+/**
+ * Release a claim made with claim_parser. The GIL must be held.
+ */
+void release_parser(Parser *wrapper);
+
+/**
+ * Claim a parser for a pipelined token iterator, whose lexing thread uses
+ * the parser's preprocessor until the claim is released. Until then, every
+ * other claim fails, including the current thread's. The GIL must be held.
+ *
+ * @return False, with RuntimeError set, if the parser is already claimed.
+ */
+bool claim_parser_for_pipeline(Parser *wrapper);
+
+/**
+ * Release a claim made with claim_parser_for_pipeline. The GIL must be held.
+ */
+void release_parser_for_pipeline(Parser *wrapper);
+
+/**
+ * Claims a parser for the lifetime of the object, if it can be claimed.
+ * Create one before releasing the GIL, so the claim outlives the release.
+ */
+class ScopedParserClaim
+{
+public:
+    explicit ScopedParserClaim(Parser *wrapper)
+      : m_wrapper(claim_parser(wrapper) ? wrapper : NULL) {}
+    ~ScopedParserClaim() {if (m_wrapper) release_parser(m_wrapper);}
+
+    /**
+     * Check whether the claim succeeded. If not, a Python exception is set.
+     */
+    bool claimed() const {return m_wrapper != NULL;}
+
+private:
+    ScopedParserClaim(ScopedParserClaim const&);
+    ScopedParserClaim& operator=(ScopedParserClaim const&);
+
+    Parser *m_wrapper;
+};
+
 /**
  * Initialise the Parser Python type object.
  */
@@ -26,21 +26,35 @@ SOFTWARE.
 
 #include <Python.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "configuration.hpp"
 #include "exception.hpp"
 #include "function_macro.hpp"
+#include "gil.hpp"
+#include "include_cache.hpp"
 #include "include_locator.hpp"
+#include "macro_cache.hpp"
 #include "parser.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
+#include "search_path_include_locator.hpp"
 #include "token_iterator.hpp"
 #include "token_predicate.hpp"
 #include "token.hpp"
+#include "../core/include_cache.hpp"
+#include "../core/macro_cache.hpp"
+#include "../core/plugin.hpp"
+#include "../core/token_iterator.hpp"
+#include "../core/token_stream.hpp"
 
 namespace cmonster {
 namespace python {
@@ -77,6 +91,179 @@ static PyObject* Preprocessor_iter(Preprocessor *pp)
     }
 }
 
+static PyObject* Preprocessor_iter_batches(Preprocessor *pp, PyObject *args)
+{
+    Py_ssize_t batch_size = 1024;
+    if (!PyArg_ParseTuple(args, "|n:iter_batches", &batch_size))
+        return NULL;
+    if (batch_size <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "batch size must be positive");
+        return NULL;
+    }
+
+    try
+    {
+        return (PyObject*)create_iterator(pp, batch_size);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+// Convert an iterable of strings to a vector of UTF-8 strings.
+static bool
+to_string_vector(PyObject *iterable, std::vector<std::string> &result)
+{
+    ScopedPyObject iter(PyObject_GetIter(iterable));
+    if (!iter)
+        return false;
+    for (;;)
+    {
+        ScopedPyObject item(PyIter_Next(iter));
+        if (!item)
+            return !PyErr_Occurred();
+        if (!PyUnicode_Check(item))
+        {
+            PyErr_SetString(PyExc_TypeError, "expected sequence of strings");
+            return false;
+        }
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(item));
+        char *chars;
+        Py_ssize_t size;
+        if (!utf8 || PyBytes_AsStringAndSize(utf8, &chars, &size) == -1)
+            return false;
+        result.push_back(std::string(chars, size));
+    }
+}
+
+// Convert an iterable of token kinds to a vector of clang::tok::TokenKind.
+static bool
+to_kind_vector(PyObject *iterable, std::vector<clang::tok::TokenKind> &result)
+{
+    ScopedPyObject iter(PyObject_GetIter(iterable));
+    if (!iter)
+        return false;
+    for (;;)
+    {
+        ScopedPyObject item(PyIter_Next(iter));
+        if (!item)
+            return !PyErr_Occurred();
+        long kind = PyLong_AsLong(item);
+        if (kind == -1 && PyErr_Occurred())
+            return false;
+        if (kind < 0 || kind >= clang::tok::NUM_TOKENS)
+        {
+            PyErr_SetString(PyExc_ValueError, "token kind is out of range");
+            return false;
+        }
+        result.push_back(static_cast<clang::tok::TokenKind>(kind));
+    }
+}
+
+static PyObject*
+Preprocessor_iter_filtered(Preprocessor *self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {
+        "kinds", "identifiers", "main_file", "files", "predicate",
+        "batch_size", "pipelined", NULL
+    };
+    PyObject *kinds = NULL;
+    PyObject *identifiers = NULL;
+    PyObject *main_file = NULL;
+    PyObject *files = NULL;
+    PyObject *predicate = NULL;
+    Py_ssize_t batch_size = 0;
+    PyObject *pipelined = NULL;
+    if (!PyArg_ParseTupleAndKeywords(
+             args, kwds, "|OOOOOnO:iter_filtered", (char**)keywords,
+             &kinds, &identifiers, &main_file, &files, &predicate,
+             &batch_size, &pipelined))
+        return NULL;
+    if (batch_size < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "batch size must not be negative");
+        return NULL;
+    }
+    if (predicate && predicate != Py_None && !PyCallable_Check(predicate))
+    {
+        PyErr_SetString(PyExc_TypeError, "expected callable for predicate");
+        return NULL;
+    }
+    const int main_file_only = main_file ? PyObject_IsTrue(main_file) : 0;
+    const int pipelined_ = pipelined ? PyObject_IsTrue(pipelined) : 0;
+    if (main_file_only == -1 || pipelined_ == -1)
+        return NULL;
+
+    // The claim is released before the iterator is created, as a pipelined
+    // iterator must have the parser to itself.
+    boost::shared_ptr<cmonster::core::TokenPredicate> filter;
+    {
+        ScopedParserClaim claim(self->parser);
+        if (!claim.claimed())
+            return NULL;
+        try
+        {
+            // Native predicates come first, cheapest first, so that the
+            // Python predicate is only called for tokens that pass all of
+            // them.
+            clang::Preprocessor &pp =
+                self->preprocessor->getClangPreprocessor();
+            std::vector<boost::shared_ptr<cmonster::core::TokenPredicate> >
+                predicates;
+            if (kinds && kinds != Py_None)
+            {
+                std::vector<clang::tok::TokenKind> kind_vector;
+                if (!to_kind_vector(kinds, kind_vector))
+                    return NULL;
+                predicates.push_back(
+                    cmonster::core::create_kind_predicate(kind_vector));
+            }
+            if (identifiers && identifiers != Py_None)
+            {
+                std::vector<std::string> names;
+                if (!to_string_vector(identifiers, names))
+                    return NULL;
+                predicates.push_back(
+                    cmonster::core::create_identifier_predicate(pp, names));
+            }
+            if (main_file_only)
+            {
+                predicates.push_back(
+                    cmonster::core::create_main_file_predicate(
+                        pp.getSourceManager()));
+            }
+            if (files && files != Py_None)
+            {
+                std::vector<std::string> filenames;
+                if (!to_string_vector(files, filenames))
+                    return NULL;
+                predicates.push_back(
+                    cmonster::core::create_file_set_predicate(
+                        pp.getSourceManager(), filenames));
+            }
+            if (predicate && predicate != Py_None)
+            {
+                predicates.push_back(
+                    boost::shared_ptr<cmonster::core::TokenPredicate>(
+                        new cmonster::python::TokenPredicate(
+                            self, predicate)));
+            }
+            if (!predicates.empty())
+                filter = cmonster::core::create_conjunction(predicates);
+        }
+        catch (...)
+        {
+            set_python_exception();
+            return NULL;
+        }
+    }
+    return (PyObject*)create_iterator(self, batch_size, filter,
+                                      pipelined_ == 1);
+}
+
 static void Preprocessor_dealloc(Preprocessor* self)
 {
     Py_XDECREF(self->parser);
@@ -108,11 +295,16 @@ Preprocessor_add_include_dir(Preprocessor* self, PyObject *args)
     PyObject *sysinclude = Py_True;
     if (!PyArg_ParseTuple(args, "s|O:add_include_dir", &path, &sysinclude))
         return NULL;
+    const int is_system = PyObject_IsTrue(sysinclude);
+    if (is_system == -1)
+        return NULL;
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
-        self->preprocessor->add_include_dir(
-            path, PyObject_IsTrue(sysinclude));
+        self->preprocessor->add_include_dir(path, is_system != 0);
         Py_INCREF(Py_None);
         return Py_None;
     }
@@ -123,13 +315,106 @@ Preprocessor_add_include_dir(Preprocessor* self, PyObject *args)
     return NULL;
 }
 
-static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
+static PyObject*
+Preprocessor_set_include_dirs(Preprocessor* self, PyObject *args,
+                              PyObject *kwds)
+{
+    static const char *keywords[] = {
+        "quoted", "angled", "system", "index", NULL};
+    PyObject *quoted_ = NULL, *angled_ = NULL, *system_ = NULL;
+    PyObject *index = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOO:set_include_dirs",
+                                     (char**)keywords, &quoted_, &angled_,
+                                     &system_, &index))
+        return NULL;
+
+    std::vector<std::string> quoted, angled, system;
+    if ((quoted_ && !to_string_vector(quoted_, quoted)) ||
+        (angled_ && !to_string_vector(angled_, angled)) ||
+        (system_ && !to_string_vector(system_, system)))
+    {
+        return NULL;
+    }
+    const int index_ = PyObject_IsTrue(index);
+    if (index_ == -1)
+        return NULL;
+
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        self->preprocessor->set_include_dirs(
+            quoted, angled, system, index_ != 0);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_configure(Preprocessor* self, PyObject *args)
 {
+    PyObject *config;
+    if (!PyArg_ParseTuple(args, "O:configure", &config))
+        return NULL;
+    if (!PyObject_TypeCheck(config, get_configuration_type()))
+    {
+        PyErr_SetString(PyExc_TypeError, "expected Configuration");
+        return NULL;
+    }
+
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        self->preprocessor->configure(
+            get_configuration((Configuration*)config));
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+// A function macro is pure if "pure" is true, or if the callable has a true
+// "__cmonster_pure__" attribute.
+static int is_pure_macro(PyObject *callable, PyObject *pure)
+{
+    if (pure)
+        return PyObject_IsTrue(pure);
+    ScopedPyObject marker(
+        PyObject_GetAttrString(callable, "__cmonster_pure__"));
+    if (!marker)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+    return PyObject_IsTrue(marker);
+}
+
+static PyObject*
+Preprocessor_define(Preprocessor* self, PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"macro", "value", "pure", NULL};
     PyObject *macro;
     PyObject *value = NULL;
-    if (!PyArg_ParseTuple(args, "O|O:define", &macro, &value))
+    PyObject *pure = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:define",
+                                     (char**)keywords, &macro, &value, &pure))
         return NULL;
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
         // First check if it's a string. If so, convert it to UTF-8 and define
@@ -162,10 +447,14 @@ static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
                     }
                     else if (PyCallable_Check(value)) // define(name, callable)
                     {
+                        const int is_pure = is_pure_macro(value, pure);
+                        if (is_pure == -1)
+                            return NULL;
                         boost::shared_ptr<cmonster::core::FunctionMacro>
                             function(new cmonster::python::FunctionMacro(
                                 self, value));
-                        self->preprocessor->define(macro_name, function);
+                        self->preprocessor->define(
+                            macro_name, function, is_pure != 0);
                     }
                     else
                     {
@@ -188,10 +477,13 @@ static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
         else if (PyCallable_Check(macro)) // define(callable)
         {
             // TODO ensure "value" was not specified.
+            const int is_pure = is_pure_macro(macro, pure);
+            if (is_pure == -1)
+                return NULL;
             const char *name = PyEval_GetFuncName(macro);
             boost::shared_ptr<cmonster::core::FunctionMacro>
                 function(new cmonster::python::FunctionMacro(self, macro));
-            self->preprocessor->define(name, function);
+            self->preprocessor->define(name, function, is_pure != 0);
         }
         else
         {
@@ -209,6 +501,122 @@ static PyObject* Preprocessor_define(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
+static PyObject*
+Preprocessor_load_macro_buffer(Preprocessor* self, PyObject *args,
+                               PyObject *kwds)
+{
+    static const char *keywords[] = {"buffer", "atomic", NULL};
+    const char *s;
+    Py_ssize_t len;
+    PyObject *atomic = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s#|O:load_macro_buffer",
+                                     (char**)keywords, &s, &len, &atomic))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        const int atomic_ = PyObject_IsTrue(atomic);
+        if (atomic_ == -1)
+            return NULL;
+        return PyLong_FromSize_t(self->preprocessor->load_macro_buffer(
+            s, static_cast<size_t>(len), atomic_ == 1));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+// Append "#define name value" to "buffer", for a (name, value) pair.
+static bool append_define(std::string &buffer, PyObject *item)
+{
+    PyObject *name, *value = Py_None;
+    if (PyUnicode_Check(item))
+    {
+        name = item;
+    }
+    else if (!PyArg_ParseTuple(item, "O|O:define_many", &name, &value))
+    {
+        return false;
+    }
+    if (!PyUnicode_Check(name) ||
+        (value != Py_None && !PyUnicode_Check(value)))
+    {
+        PyErr_SetString(PyExc_TypeError,
+                        "expected string names and string or None values");
+        return false;
+    }
+
+    char *chars;
+    Py_ssize_t size;
+    ScopedPyObject utf8_name(PyUnicode_AsUTF8String(name));
+    if (!utf8_name || PyBytes_AsStringAndSize(utf8_name, &chars, &size) == -1)
+        return false;
+    buffer.append("#define ");
+    buffer.append(chars, size);
+    if (value != Py_None)
+    {
+        ScopedPyObject utf8_value(PyUnicode_AsUTF8String(value));
+        if (!utf8_value ||
+            PyBytes_AsStringAndSize(utf8_value, &chars, &size) == -1)
+            return false;
+        // Newlines would end the directive early.
+        const size_t start = buffer.size() + 1;
+        buffer.push_back(' ');
+        buffer.append(chars, size);
+        std::replace(buffer.begin() + start, buffer.end(), '\n', ' ');
+    }
+    buffer.push_back('\n');
+    return true;
+}
+
+static PyObject* Preprocessor_define_many(Preprocessor* self, PyObject *args)
+{
+    PyObject *macros;
+    if (!PyArg_ParseTuple(args, "O:define_many", &macros))
+        return NULL;
+
+    // Accept a mapping of names to values, or an iterable of names and
+    // (name, value) pairs.
+    ScopedPyObject items(PyDict_Check(macros) ? PyDict_Items(macros) : NULL);
+    if (PyDict_Check(macros) && !items)
+        return NULL;
+    ScopedPyObject iter(PyObject_GetIter(items ? items.get() : macros));
+    if (!iter)
+        return NULL;
+
+    std::string buffer;
+    for (;;)
+    {
+        ScopedPyObject item(PyIter_Next(iter));
+        if (!item)
+        {
+            if (PyErr_Occurred())
+                return NULL;
+            break;
+        }
+        if (!append_define(buffer, item))
+            return NULL;
+    }
+
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        return PyLong_FromSize_t(self->preprocessor->load_macro_buffer(
+            buffer.data(), buffer.size()));
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
 static PyObject* Preprocessor_add_pragma(Preprocessor* self, PyObject *args)
 {
     const char *name = NULL;
@@ -216,6 +624,9 @@ static PyObject* Preprocessor_add_pragma(Preprocessor* self, PyObject *args)
     if (!PyArg_ParseTuple(args, "sO:add_pragma", &name, &handler))
         return NULL;
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
         if (PyCallable_Check(handler))
@@ -239,6 +650,28 @@ static PyObject* Preprocessor_add_pragma(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
+static PyObject*
+Preprocessor_load_plugin(Preprocessor *self, PyObject *args)
+{
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s:load_plugin", &path))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        cmonster::core::load_plugin(*self->preprocessor, path);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
 static PyObject* Preprocessor_tokenize(Preprocessor* self, PyObject *args)
 {
     const char *s = NULL;
@@ -246,10 +679,13 @@ static PyObject* Preprocessor_tokenize(Preprocessor* self, PyObject *args)
     if (!PyArg_ParseTuple(args, "s#:tokenize", &s, &len))
         return NULL;
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
-        std::vector<cmonster::core::Token> result =
-            self->preprocessor->tokenize(s, len);
+        std::vector<cmonster::core::Token> result;
+        self->preprocessor->tokenize(s, len, result);
 
         ScopedPyObject tuple(PyTuple_New(result.size()));
         if (!tuple)
@@ -273,11 +709,152 @@ static PyObject* Preprocessor_tokenize(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
+static PyObject*
+Preprocessor_set_tokenize_cache_capacity(Preprocessor* self, PyObject *args)
+{
+    Py_ssize_t capacity;
+    if (!PyArg_ParseTuple(args, "n:set_tokenize_cache_capacity", &capacity))
+        return NULL;
+    if (capacity < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return NULL;
+    }
+    self->preprocessor->set_tokenize_cache_capacity(
+        static_cast<size_t>(capacity));
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject*
+Preprocessor_tokenize_cache_info(Preprocessor* self, PyObject *args)
+{
+    cmonster::core::CacheStats stats =
+        self->preprocessor->tokenize_cache_stats();
+    return Py_BuildValue("{s:n,s:n,s:n,s:n}",
+                         "hits", (Py_ssize_t)stats.hits,
+                         "misses", (Py_ssize_t)stats.misses,
+                         "size", (Py_ssize_t)stats.size,
+                         "capacity", (Py_ssize_t)stats.capacity);
+}
+
+static PyObject*
+Preprocessor_set_macro_cache(Preprocessor* self, PyObject *args)
+{
+    PyObject *cache;
+    if (!PyArg_ParseTuple(args, "O:set_macro_cache", &cache))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        if (cache == Py_None)
+        {
+            self->preprocessor->set_macro_cache(
+                boost::shared_ptr<cmonster::core::MacroCache>());
+        }
+        else if (PyObject_TypeCheck(cache, get_macro_cache_type()))
+        {
+            self->preprocessor->set_macro_cache(
+                get_macro_cache((MacroCache*)cache));
+        }
+        else
+        {
+            PyErr_SetString(PyExc_TypeError, "expected MacroCache or None");
+            return NULL;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* Preprocessor_get_macro_cache(Preprocessor* self, PyObject *)
+{
+    boost::shared_ptr<cmonster::core::MacroCache> cache =
+        self->preprocessor->macro_cache();
+    if (!cache)
+    {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    return (PyObject*)create_macro_cache(cache);
+}
+
+static PyObject*
+Preprocessor_set_include_cache(Preprocessor* self, PyObject *args)
+{
+    PyObject *cache;
+    if (!PyArg_ParseTuple(args, "O:set_include_cache", &cache))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        if (cache == Py_None)
+        {
+            self->preprocessor->set_include_cache(
+                boost::shared_ptr<cmonster::core::IncludeCache>());
+        }
+        else if (PyObject_TypeCheck(cache, get_include_cache_type()))
+        {
+            self->preprocessor->set_include_cache(
+                get_include_cache((IncludeCache*)cache));
+        }
+        else
+        {
+            PyErr_SetString(PyExc_TypeError,
+                            "expected IncludeCache or None");
+            return NULL;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_get_include_cache(Preprocessor* self, PyObject *)
+{
+    boost::shared_ptr<cmonster::core::IncludeCache> cache =
+        self->preprocessor->include_cache();
+    if (!cache)
+    {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    return (PyObject*)create_include_cache(cache);
+}
+
+static PyObject*
+Preprocessor_token_arena_info(Preprocessor* self, PyObject *args)
+{
+    cmonster::core::ArenaStats stats =
+        self->preprocessor->token_arena_stats();
+    return Py_BuildValue("{s:n,s:n,s:n}",
+                         "bytes_in_use", (Py_ssize_t)stats.bytes_in_use,
+                         "bytes_allocated", (Py_ssize_t)stats.bytes_allocated,
+                         "resets", (Py_ssize_t)stats.resets);
+}
+
 static PyObject* Preprocessor_preprocess(Preprocessor* self, PyObject *args)
 {
     PyObject *f = NULL;
     if (!PyArg_ParseTuple(args, "|O:preprocess", &f))
         return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
         boost::shared_ptr<FILE> file;
@@ -307,6 +884,10 @@ static PyObject* Preprocessor_preprocess(Preprocessor* self, PyObject *args)
             if (!pylong || (fd = PyLong_AsLong(pylong)) == -1)
                 return NULL;
         }
+
+        // Release the GIL while preprocessing. Python macros, pragma
+        // handlers and include locators reacquire it when they're called.
+        ScopedGILRelease nogil;
         self->preprocessor->preprocess(fd);
     }
     catch (...)
@@ -318,25 +899,99 @@ static PyObject* Preprocessor_preprocess(Preprocessor* self, PyObject *args)
     return Py_None;
 }
 
+static PyObject* Preprocessor_record(Preprocessor* self, PyObject *args)
+{
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s:record", &path))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        size_t count;
+        {
+            ScopedGILRelease nogil;
+            std::auto_ptr<cmonster::core::TokenIterator> iter(
+                self->preprocessor->create_iterator());
+            count = cmonster::core::record_token_stream(
+                *iter, self->preprocessor->getClangPreprocessor(), path);
+        }
+        return PyLong_FromSize_t(count);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject* Preprocessor_replay(Preprocessor* self, PyObject *args)
+{
+    const char *path;
+    Py_ssize_t batch_size = 0;
+    if (!PyArg_ParseTuple(args, "s|n:replay", &path, &batch_size))
+        return NULL;
+    if (batch_size < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "batch size must not be negative");
+        return NULL;
+    }
+    cmonster::core::TokenIterator *iter;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        iter = self->preprocessor->create_replay_iterator(path);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+    return (PyObject*)create_iterator(self, iter, batch_size);
+}
+
 static PyObject* Preprocessor_next(Preprocessor* self, PyObject *args)
 {
     PyObject *expand = Py_True;
     if (!PyArg_ParseTuple(args, "|O:next", &expand))
         return NULL;
+    const int expand_ = PyObject_IsTrue(expand);
+    if (expand_ == -1)
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
-        std::auto_ptr<cmonster::core::Token> token(
-            self->preprocessor->next(PyObject_IsTrue(expand)));
-        if (token.get())
-        {
-            return (PyObject*)create_token(self, *token);
-        }
-        else
-        {
-            PyErr_SetString(PyExc_RuntimeError,
-                "Internal error: Preprocessor returned NULL");
-            return NULL;
-        }
+        cmonster::core::Token token =
+            self->preprocessor->next(expand_ != 0);
+        return (PyObject*)create_token(self, token);
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+Preprocessor_read_until(Preprocessor *self, PyObject *args)
+{
+    const char *terminator;
+    Py_ssize_t terminator_len;
+    if (!PyArg_ParseTuple(args, "s#:read_until", &terminator, &terminator_len))
+        return NULL;
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        std::string text = self->preprocessor->read_until(
+            std::string(terminator, terminator_len));
+        return PyUnicode_FromStringAndSize(text.data(), text.size());
     }
     catch (...)
     {
@@ -355,6 +1010,9 @@ PyObject* Preprocessor_format_tokens(Preprocessor *self, PyObject *args)
     if (!iter)
         return NULL;
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
         // Iterate through the tokens, accumulating in a vector.
@@ -403,10 +1061,23 @@ PyObject* Preprocessor_set_include_locator(Preprocessor *self, PyObject *args)
         return NULL;
     }
 
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
     try
     {
-        boost::shared_ptr<cmonster::core::IncludeLocator> locator(
-            new cmonster::python::IncludeLocator(locator_));
+        // Native locators are used directly, without calling into Python.
+        boost::shared_ptr<cmonster::core::IncludeLocator> locator;
+        if (PyObject_TypeCheck(locator_,
+                               get_search_path_include_locator_type()))
+        {
+            locator = get_search_path_include_locator(
+                (SearchPathIncludeLocator*)locator_);
+        }
+        else
+        {
+            locator.reset(new cmonster::python::IncludeLocator(locator_));
+        }
         self->preprocessor->set_include_locator(locator);
         Py_INCREF(Py_None);
         return Py_None;
@@ -418,24 +1089,98 @@ PyObject* Preprocessor_set_include_locator(Preprocessor *self, PyObject *args)
     }
 }
 
+static PyObject*
+Preprocessor_set_include_locator_priority(Preprocessor *self, PyObject *args,
+                                          PyObject *kwds)
+{
+    static const char *keywords[] = {"first", "fallback", NULL};
+    PyObject *first_ = NULL, *fallback = Py_True;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds,
+                                     "|OO:set_include_locator_priority",
+                                     (char**)keywords, &first_, &fallback))
+        return NULL;
+
+    std::vector<std::string> first;
+    if (first_ && !to_string_vector(first_, first))
+        return NULL;
+    const int fallback_ = PyObject_IsTrue(fallback);
+    if (fallback_ == -1)
+        return NULL;
+
+    ScopedParserClaim claim(self->parser);
+    if (!claim.claimed())
+        return NULL;
+    try
+    {
+        self->preprocessor->set_include_locator_priority(
+            first, fallback_ != 0);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
 static PyMethodDef Preprocessor_methods[] =
 {
     {(char*)"add_include_dir",
      (PyCFunction)&Preprocessor_add_include_dir, METH_VARARGS},
+    {(char*)"set_include_dirs",
+     (PyCFunction)&Preprocessor_set_include_dirs,
+     METH_VARARGS|METH_KEYWORDS},
+    {(char*)"configure",
+     (PyCFunction)&Preprocessor_configure, METH_VARARGS},
     {(char*)"define",
-     (PyCFunction)&Preprocessor_define, METH_VARARGS},
+     (PyCFunction)&Preprocessor_define, METH_VARARGS|METH_KEYWORDS},
+    {(char*)"define_many",
+     (PyCFunction)&Preprocessor_define_many, METH_VARARGS},
+    {(char*)"load_macro_buffer",
+     (PyCFunction)&Preprocessor_load_macro_buffer,
+     METH_VARARGS|METH_KEYWORDS},
     {(char*)"add_pragma",
      (PyCFunction)&Preprocessor_add_pragma, METH_VARARGS},
     {(char*)"tokenize",
      (PyCFunction)&Preprocessor_tokenize, METH_VARARGS},
+    {(char*)"load_plugin",
+     (PyCFunction)&Preprocessor_load_plugin, METH_VARARGS},
+    {(char*)"set_tokenize_cache_capacity",
+     (PyCFunction)&Preprocessor_set_tokenize_cache_capacity, METH_VARARGS},
+    {(char*)"tokenize_cache_info",
+     (PyCFunction)&Preprocessor_tokenize_cache_info, METH_NOARGS},
+    {(char*)"set_macro_cache",
+     (PyCFunction)&Preprocessor_set_macro_cache, METH_VARARGS},
+    {(char*)"get_macro_cache",
+     (PyCFunction)&Preprocessor_get_macro_cache, METH_NOARGS},
+    {(char*)"set_include_cache",
+     (PyCFunction)&Preprocessor_set_include_cache, METH_VARARGS},
+    {(char*)"get_include_cache",
+     (PyCFunction)&Preprocessor_get_include_cache, METH_NOARGS},
+    {(char*)"token_arena_info",
+     (PyCFunction)&Preprocessor_token_arena_info, METH_NOARGS},
     {(char*)"preprocess",
      (PyCFunction)&Preprocessor_preprocess, METH_VARARGS},
+    {(char*)"record",
+     (PyCFunction)&Preprocessor_record, METH_VARARGS},
+    {(char*)"replay",
+     (PyCFunction)&Preprocessor_replay, METH_VARARGS},
     {(char*)"next",
      (PyCFunction)&Preprocessor_next, METH_VARARGS},
+    {(char*)"read_until",
+     (PyCFunction)&Preprocessor_read_until, METH_VARARGS},
+    {(char*)"iter_batches",
+     (PyCFunction)&Preprocessor_iter_batches, METH_VARARGS},
+    {(char*)"iter_filtered",
+     (PyCFunction)&Preprocessor_iter_filtered, METH_VARARGS|METH_KEYWORDS},
     {(char*)"format_tokens",
      (PyCFunction)&Preprocessor_format_tokens, METH_VARARGS},
     {(char*)"set_include_locator",
      (PyCFunction)&Preprocessor_set_include_locator, METH_VARARGS},
+    {(char*)"set_include_locator_priority",
+     (PyCFunction)&Preprocessor_set_include_locator_priority,
+     METH_VARARGS|METH_KEYWORDS},
     {NULL}
 };
 
@@ -467,6 +1212,11 @@ cmonster::core::Preprocessor& get_preprocessor(Preprocessor *wrapper)
     return *wrapper->preprocessor;
 }
 
+Parser* get_preprocessor_parser(Preprocessor *wrapper)
+{
+    return wrapper->parser;
+}
+
 PyTypeObject* init_preprocessor_type()
 {
     PreprocessorType = (PyTypeObject*)PyType_FromSpec(&PreprocessorTypeSpec);
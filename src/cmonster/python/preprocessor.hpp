@@ -44,6 +44,11 @@ Preprocessor* create_preprocessor(Parser *parser);
  */
 cmonster::core::Preprocessor& get_preprocessor(Preprocessor *wrapper);
 
+/**
+ * Get the Parser object to which the Preprocessor object is bound.
+ */
+Parser* get_preprocessor_parser(Preprocessor *wrapper);
+
 /**
  * Initialise the Preprocessor Python type object.
  */
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Define this to ensure only the limited API is used, so we can ensure forward
+ * binary compatibility. */
+#define Py_LIMITED_API
+
+#include <Python.h>
+#include <string>
+#include <vector>
+
+#include "exception.hpp"
+#include "scoped_pyobject.hpp"
+#include "search_path_include_locator.hpp"
+#include "shared_object.hpp"
+
+namespace cmonster {
+namespace python {
+
+static PyTypeObject *SearchPathIncludeLocatorType = NULL;
+PyDoc_STRVAR(SearchPathIncludeLocator_doc,
+"SearchPathIncludeLocator(dirs) is a native include locator that searches\n"
+"a list of directories, such as a compiler's include search list. The\n"
+"names in each directory are indexed on first use, so includes that are\n"
+"not found cost no file system access. Pass it to\n"
+"Preprocessor.set_include_locator(); it may also be called with an include\n"
+"to locate it directly.");
+
+struct SearchPathIncludeLocator
+  : SharedObject<cmonster::core::SearchPathIncludeLocator> {};
+
+static int
+SearchPathIncludeLocator_init(SearchPathIncludeLocator *self,
+                              PyObject *args, PyObject *kwds)
+{
+    static const char *keywords[] = {"dirs", NULL};
+    PyObject *dirs_;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O:SearchPathIncludeLocator",
+                                     (char**)keywords, &dirs_))
+        return -1;
+
+    ScopedPyObject iter(PyObject_GetIter(dirs_));
+    if (!iter)
+        return -1;
+    std::vector<std::string> dirs;
+    for (;;)
+    {
+        ScopedPyObject item(PyIter_Next(iter));
+        if (!item)
+        {
+            if (PyErr_Occurred())
+                return -1;
+            break;
+        }
+        ScopedPyObject utf8(PyUnicode_AsUTF8String(item));
+        char *dir;
+        Py_ssize_t size;
+        if (!utf8 || PyBytes_AsStringAndSize(utf8, &dir, &size) == -1)
+            return -1;
+        dirs.push_back(std::string(dir, size));
+    }
+
+    try
+    {
+        boost::shared_ptr<cmonster::core::SearchPathIncludeLocator> locator(
+            new cmonster::core::SearchPathIncludeLocator(dirs));
+        set_shared_object(self, locator);
+        return 0;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return -1;
+    }
+}
+
+boost::shared_ptr<cmonster::core::SearchPathIncludeLocator> const&
+get_search_path_include_locator(SearchPathIncludeLocator *wrapper)
+{
+    return get_shared_object(wrapper, "SearchPathIncludeLocator");
+}
+
+static PyObject*
+SearchPathIncludeLocator_call(SearchPathIncludeLocator *self,
+                              PyObject *args, PyObject *kwds)
+{
+    const char *include;
+    Py_ssize_t include_len;
+    if (!PyArg_ParseTuple(args, "s#:SearchPathIncludeLocator",
+                          &include, &include_len))
+        return NULL;
+    try
+    {
+        std::string path;
+        if (get_search_path_include_locator(self)->locate(
+                std::string(include, include_len), path))
+        {
+            return PyUnicode_FromStringAndSize(path.data(), path.size());
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+SearchPathIncludeLocator_refresh(SearchPathIncludeLocator *self, PyObject *)
+{
+    try
+    {
+        get_search_path_include_locator(self)->refresh();
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyObject*
+SearchPathIncludeLocator_directories(SearchPathIncludeLocator *self,
+                                     PyObject *)
+{
+    try
+    {
+        std::vector<std::string> dirs =
+            get_search_path_include_locator(self)->directories();
+        ScopedPyObject list(PyList_New(dirs.size()));
+        if (!list)
+            return NULL;
+        for (size_t i = 0; i < dirs.size(); ++i)
+        {
+            PyObject *dir =
+                PyUnicode_FromStringAndSize(dirs[i].data(), dirs[i].size());
+            if (!dir)
+                return NULL;
+            PyList_SetItem(list, i, dir);
+        }
+        return list.release();
+    }
+    catch (...)
+    {
+        set_python_exception();
+        return NULL;
+    }
+}
+
+static PyMethodDef SearchPathIncludeLocator_methods[] =
+{
+    {(char*)"refresh",
+     (PyCFunction)&SearchPathIncludeLocator_refresh, METH_NOARGS},
+    {(char*)"directories",
+     (PyCFunction)&SearchPathIncludeLocator_directories, METH_NOARGS},
+    {NULL}
+};
+
+static PyType_Slot SearchPathIncludeLocatorTypeSlots[] =
+{
+    {Py_tp_dealloc,
+     (void*)&dealloc_shared_object<SearchPathIncludeLocator>},
+    {Py_tp_methods, (void*)SearchPathIncludeLocator_methods},
+    {Py_tp_doc,     (void*)SearchPathIncludeLocator_doc},
+    {Py_tp_init,    (void*)SearchPathIncludeLocator_init},
+    {Py_tp_call,    (void*)SearchPathIncludeLocator_call},
+    {Py_tp_alloc,   (void*)PyType_GenericAlloc},
+    {Py_tp_new,     (void*)PyType_GenericNew},
+    {0, NULL}
+};
+
+static PyType_Spec SearchPathIncludeLocatorTypeSpec =
+{
+    "cmonster._cmonster.SearchPathIncludeLocator",
+    sizeof(SearchPathIncludeLocator),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    SearchPathIncludeLocatorTypeSlots
+};
+
+PyTypeObject* init_search_path_include_locator_type()
+{
+    SearchPathIncludeLocatorType =
+        (PyTypeObject*)PyType_FromSpec(&SearchPathIncludeLocatorTypeSpec);
+    if (!SearchPathIncludeLocatorType)
+        return NULL;
+    if (PyType_Ready(SearchPathIncludeLocatorType) < 0)
+        return NULL;
+    return SearchPathIncludeLocatorType;
+}
+
+PyTypeObject* get_search_path_include_locator_type()
+{
+    return SearchPathIncludeLocatorType;
+}
+
+}}
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _CMONSTER_PYTHON_SHARED_OBJECT_HPP
+#define _CMONSTER_PYTHON_SHARED_OBJECT_HPP
+
+#include <Python.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace cmonster {
+namespace python {
+
+/**
+ * Python object structure to wrap a core object that may be shared with
+ * preprocessors. Wrapper types derive from this, adding no members, and use
+ * the functions below for their object lifetime.
+ */
+template <typename T>
+struct SharedObject
+{
+    PyObject_HEAD
+    boost::shared_ptr<T> *object;
+};
+
+/**
+ * tp_dealloc for SharedObject types.
+ */
+template <typename Wrapper>
+void dealloc_shared_object(Wrapper *self)
+{
+    delete self->object;
+    PyObject_Del((PyObject*)self);
+}
+
+/**
+ * Set (or, when __init__ is called again, replace) the wrapped object.
+ */
+template <typename T>
+void set_shared_object(SharedObject<T> *self, boost::shared_ptr<T> const& obj)
+{
+    if (self->object)
+        *self->object = obj;
+    else
+        self->object = new boost::shared_ptr<T>(obj);
+}
+
+/**
+ * Create a new wrapper of the given type around an existing core object.
+ * The object is allocated directly, rather than creating a new core object
+ * in __init__ only to replace it.
+ */
+template <typename Wrapper, typename T>
+Wrapper*
+create_shared_object(PyTypeObject *type, boost::shared_ptr<T> const& obj)
+{
+    PyObject *self = PyType_GenericAlloc(type, 0);
+    if (!self)
+        return NULL;
+    try
+    {
+        set_shared_object<T>((Wrapper*)self, obj);
+    }
+    catch (...)
+    {
+        Py_DECREF(self);
+        throw;
+    }
+    return (Wrapper*)self;
+}
+
+/**
+ * Get the wrapped core object, throwing if the wrapper is uninitialised.
+ */
+template <typename T>
+boost::shared_ptr<T> const&
+get_shared_object(SharedObject<T> *wrapper, const char *type_name)
+{
+    if (!wrapper || !wrapper->object)
+        throw std::invalid_argument(
+            std::string("uninitialised ") + type_name);
+    return *wrapper->object;
+}
+
+}}
+
+#endif
+
@@ -50,6 +50,13 @@ struct SourceLocation
     PyObject_HEAD
     clang::SourceManager *source_manager;
     clang::SourceLocation source_location;
+
+    // Set if the presumed location was resolved up front.
+    bool                  presumed;
+    const char           *presumed_filename;
+    unsigned              presumed_line;
+    unsigned              presumed_column;
+    bool                  presumed_in_main_file;
 };
 
 static void SourceLocation_dealloc(SourceLocation* self)
@@ -78,6 +85,23 @@ create_source_location(
     return loc_;
 }
 
+SourceLocation*
+create_source_location(
+    clang::SourceLocation const& loc, clang::SourceManager &sm,
+    cmonster::core::TokenInfo const& info)
+{
+    SourceLocation *loc_ = create_source_location(loc, sm);
+    if (loc_ && info.filename)
+    {
+        loc_->presumed = true;
+        loc_->presumed_filename = info.filename;
+        loc_->presumed_line = info.line;
+        loc_->presumed_column = info.column;
+        loc_->presumed_in_main_file = info.in_main_file;
+    }
+    return loc_;
+}
+
 static int
 SourceLocation_init(SourceLocation *self, PyObject *args, PyObject *kwds)
 {
@@ -118,6 +142,8 @@ SourceLocation_init(SourceLocation *self, PyObject *args, PyObject *kwds)
 static PyObject*
 SourceLocation_get_filename(SourceLocation *self, void *closure)
 {
+    if (self->presumed)
+        return PyUnicode_FromString(self->presumed_filename);
     clang::PresumedLoc ploc =
         self->source_manager->getPresumedLoc(self->source_location);
     return PyUnicode_FromString(ploc.getFilename());
@@ -126,6 +152,8 @@ SourceLocation_get_filename(SourceLocation *self, void *closure)
 static PyObject*
 SourceLocation_get_in_main_file(SourceLocation *self, void *closure)
 {
+    if (self->presumed)
+        return PyBool_FromLong(self->presumed_in_main_file);
     if (self->source_manager->isFromMainFile(self->source_location))
         Py_RETURN_TRUE;
     Py_RETURN_FALSE;
@@ -134,6 +162,8 @@ SourceLocation_get_in_main_file(SourceLocation *self, void *closure)
 static PyObject*
 SourceLocation_get_line(SourceLocation *self, void *closure)
 {
+    if (self->presumed)
+        return PyLong_FromLong(self->presumed_line);
     const long line = self->source_manager->getPresumedLineNumber(
                           self->source_location);
     return PyLong_FromLong(line);
@@ -142,6 +172,8 @@ SourceLocation_get_line(SourceLocation *self, void *closure)
 static PyObject*
 SourceLocation_get_column(SourceLocation *self, void *closure)
 {
+    if (self->presumed)
+        return PyLong_FromLong(self->presumed_column);
     const long column = self->source_manager->getPresumedColumnNumber(
                             self->source_location);
     return PyLong_FromLong(column);
@@ -26,6 +26,8 @@ SOFTWARE.
 #include <clang/Basic/SourceManager.h>
 #include <clang/Basic/SourceLocation.h>
 
+#include "../core/token.hpp"
+
 namespace cmonster {
 namespace python {
 
@@ -38,6 +40,15 @@ SourceLocation*
 create_source_location(
     clang::SourceLocation const& loc, clang::SourceManager &sm);
 
+/**
+ * Create a new SourceLocation whose filename, line, column and main file
+ * status are those resolved in "info", rather than looked up in "sm".
+ */
+SourceLocation*
+create_source_location(
+    clang::SourceLocation const& loc, clang::SourceManager &sm,
+    cmonster::core::TokenInfo const& info);
+
 /**
  * Initialise the SourceLocation Python type object.
  */
@@ -29,6 +29,7 @@ SOFTWARE.
 #include <stdexcept>
 #include <string>
 
+#include "exception.hpp"
 #include "preprocessor.hpp"
 #include "scoped_pyobject.hpp"
 #include "source_location.hpp"
@@ -42,27 +43,37 @@ namespace python {
 static PyTypeObject *TokenType = NULL;
 PyDoc_STRVAR(Token_doc, "Token objects");
 
+// The core token is held by value; it is a small, trivially copyable object,
+// so no separate allocation is required.
 struct Token
 {
     PyObject_HEAD
     Preprocessor *preprocessor;
-    cmonster::core::Token *token;
+    cmonster::core::Token token;
+    PyObject *owner;
 };
 
 static void Token_dealloc(Token* self)
 {
+    Py_XDECREF(self->owner);
     Py_XDECREF(self->preprocessor);
-    if (self->token)
-        delete self->token;
     PyObject_Del((PyObject*)self);
 }
 
-Token* create_token(Preprocessor *pp, cmonster::core::Token const& value)
+Token* create_token(Preprocessor *pp, cmonster::core::Token const& value,
+                    PyObject *owner)
 {
-    ScopedPyObject args = Py_BuildValue("(O)", pp);
-    Token *token = (Token*)PyObject_CallObject((PyObject*)TokenType, args);
+    // Allocate the object directly, rather than calling the type object.
+    // Going through Token_init would create a token only to overwrite it.
+    Token *token = (Token*)PyType_GenericAlloc(TokenType, 0);
     if (token)
-        *token->token = value;
+    {
+        Py_INCREF(pp);
+        token->preprocessor = pp;
+        token->token = value;
+        Py_XINCREF(owner);
+        token->owner = owner;
+    }
     return token;
 }
 
@@ -98,39 +109,34 @@ static int Token_init(Token *self, PyObject *args, PyObject *kwargs)
 
     // Convert the "value" object to a plain old C string, and create the
     // Token object.
-    if (value)
+    try
     {
-        PyObject *strobj = PyObject_Str(value);
-        if (strobj)
+        if (value)
+        {
+            ScopedPyObject strobj(PyObject_Str(value));
+            if (!strobj)
+                return -1;
+            ScopedPyObject utf8(PyUnicode_AsUTF8String(strobj));
+            if (!utf8)
+                return -1;
+            char *u8_chars;
+            Py_ssize_t u8_size;
+            if (PyBytes_AsStringAndSize(utf8, &u8_chars, &u8_size) == -1)
+                return -1;
+            self->token = get_preprocessor(pp).create_token(
+                static_cast<clang::tok::TokenKind>(token_kind),
+                u8_chars, u8_size);
+        }
+        else
         {
-            PyObject *utf8 = PyUnicode_AsUTF8String(strobj);
-            if (utf8)
-            {
-                char *u8_chars;
-                Py_ssize_t u8_size;
-                if (PyBytes_AsStringAndSize(utf8, &u8_chars, &u8_size) == -1)
-                {
-                    Py_DECREF(utf8);
-                    return -1;
-                }
-                else
-                {
-                    self->token = get_preprocessor(pp).create_token(
-                        static_cast<clang::tok::TokenKind>(token_kind),
-                        u8_chars, u8_size);
-                    Py_DECREF(utf8);
-                }
-            }
-            Py_DECREF(strobj);
+            self->token = get_preprocessor(pp).create_token(
+                static_cast<clang::tok::TokenKind>(token_kind));
         }
     }
-
-    // If a value was extracted, then self->token should be set. If not, let's
-    // set it now with an empty value.
-    if (!self->token)
+    catch (...)
     {
-        self->token = get_preprocessor(pp).create_token(
-            static_cast<clang::tok::TokenKind>(token_kind));
+        set_python_exception();
+        return -1;
     }
 
     return 0;
@@ -139,7 +145,7 @@ static int Token_init(Token *self, PyObject *args, PyObject *kwargs)
 static PyObject* Token_str(Token *self)
 {
     std::ostringstream ss;
-    ss << *self->token;
+    ss << self->token;
     std::string s = ss.str();
     return PyUnicode_FromStringAndSize(s.c_str(), s.size());
 }
@@ -147,8 +153,8 @@ static PyObject* Token_str(Token *self)
 static PyObject* Token_repr(Token *self)
 {
     std::ostringstream ss;
-    ss << "Token(tok_" << self->token->getName() << ", '"
-       << *self->token << "')";
+    ss << "Token(tok_" << self->token.getName() << ", '"
+       << self->token << "')";
     std::string s = ss.str();
     return PyUnicode_FromStringAndSize(s.c_str(), s.size());
 
@@ -166,7 +172,7 @@ static PyObject* Token_repr(Token *self)
 
 static PyObject* Token_get_token_id(Token *self, void *closure)
 {
-    clang::tok::TokenKind kind = self->token->getClangToken().getKind();
+    clang::tok::TokenKind kind = self->token.getClangToken().getKind();
     return PyLong_FromLong(static_cast<long>(kind));
 }
 
@@ -181,7 +187,7 @@ Token_set_token_id(Token *self, PyObject *value, void *closure)
         PyErr_SetString(PyExc_ValueError, "token kind is out of range");
         return NULL;
     }
-    self->token->getClangToken().setKind(
+    self->token.getClangToken().setKind(
         static_cast<clang::tok::TokenKind>(id));
     Py_INCREF(Py_None);
     return Py_None;
@@ -191,13 +197,19 @@ static PyObject* Token_get_location(Token *self, void *closure)
 {
     clang::Preprocessor const& pp =
         get_preprocessor(self->preprocessor).getClangPreprocessor();
+    if (self->token.getInfo())
+    {
+        return (PyObject*)create_source_location(
+            self->token.getClangToken().getLocation(), pp.getSourceManager(),
+            *self->token.getInfo());
+    }
     return (PyObject*)create_source_location(
-        self->token->getClangToken().getLocation(), pp.getSourceManager());
+        self->token.getClangToken().getLocation(), pp.getSourceManager());
 }
 
 static Py_ssize_t Token_length(Token *self)
 {
-    clang::Token const& token = self->token->getClangToken();
+    clang::Token const& token = self->token.getClangToken();
     return token.getLength();
 }
 
@@ -259,7 +271,7 @@ cmonster::core::Token& get_token(Token *wrapper)
 {
     if (!wrapper) // XXX undefined behaviour?
         throw std::invalid_argument("wrapper == NULL");
-    return *wrapper->token;
+    return wrapper->token;
 }
 
 }}
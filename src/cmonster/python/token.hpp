@@ -35,9 +35,12 @@ struct Preprocessor;
 struct Token;
 
 /**
- * Create a new heap-allocated Token.
+ * Create a new heap-allocated Token. If the token's info (see
+ * cmonster::core::Token::getInfo) is owned by another object, "owner" is
+ * that object, and the Token holds a reference to it.
  */
-Token* create_token(Preprocessor *pp, cmonster::core::Token const& token);
+Token* create_token(Preprocessor *pp, cmonster::core::Token const& token,
+                    PyObject *owner = NULL);
 
 /**
  * Get the core token value from the Python wrapper object.
@@ -27,8 +27,13 @@ SOFTWARE.
 #include <Python.h>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "exception.hpp"
+#include "gil.hpp"
+#include "parser.hpp"
+#include "scoped_pyobject.hpp"
 #include "token_iterator.hpp"
 #include "token.hpp"
 #include "preprocessor.hpp"
@@ -45,12 +50,58 @@ struct TokenIterator
     PyObject_HEAD
     Preprocessor *preprocessor;
     cmonster::core::TokenIterator *iterator;
+    Py_ssize_t batch_size;
+    std::vector<cmonster::core::Token> *batch;
+
+    // The parser claimed for the lexing thread of a pipelined iterator, until
+    // the iterator is exhausted; see claim_parser_for_pipeline.
+    Parser *pipeline;
 };
 
+// Release the core iterator once it has been exhausted. A pipelined iterator
+// owns the info of the tokens it produced, so it is kept until they're gone;
+// only its lexing thread's claim on the parser is released.
+static void TokenIterator_finish(TokenIterator *self)
+{
+    if (self->iterator->is_concurrent())
+    {
+        if (self->pipeline)
+            release_parser_for_pipeline(self->pipeline);
+        self->pipeline = NULL;
+    }
+    else
+    {
+        delete self->iterator;
+        self->iterator = NULL;
+    }
+}
+
+// The Python object that owns the info of the iterator's tokens, if any.
+static PyObject* TokenIterator_token_owner(TokenIterator *self)
+{
+    return self->iterator->is_concurrent() ? (PyObject*)self : NULL;
+}
+
 static void TokenIterator_dealloc(TokenIterator* self)
 {
     if (self->iterator)
-        delete self->iterator;
+    {
+        if (self->iterator->is_concurrent())
+        {
+            // Destroying the iterator joins the lexing thread, which may be
+            // waiting for the GIL.
+            ScopedGILRelease nogil;
+            delete self->iterator;
+        }
+        else
+        {
+            delete self->iterator;
+        }
+    }
+    if (self->pipeline)
+        release_parser_for_pipeline(self->pipeline);
+    if (self->batch)
+        delete self->batch;
     Py_XDECREF(self->preprocessor);
     PyObject_Del((PyObject*)self);
 }
@@ -61,21 +112,94 @@ static PyObject* TokenIterator_iter(TokenIterator *iter)
     return (PyObject*)iter;
 }
 
+// Get the next batch of tokens as a tuple.
+static PyObject* TokenIterator_iternext_batch(TokenIterator *self)
+{
+    if (self->iterator)
+    {
+        try
+        {
+            std::vector<cmonster::core::Token> &batch = *self->batch;
+            batch.clear();
+            size_t count;
+            if (self->iterator->is_concurrent())
+            {
+                // Don't hold the GIL while waiting on the lexing thread; it
+                // may need it to call back into Python.
+                ScopedGILRelease nogil;
+                count = self->iterator->next_batch(
+                    batch, static_cast<size_t>(self->batch_size));
+            }
+            else
+            {
+                ScopedParserClaim claim(
+                    get_preprocessor_parser(self->preprocessor));
+                if (!claim.claimed())
+                    return NULL;
+                count = self->iterator->next_batch(
+                    batch, static_cast<size_t>(self->batch_size));
+            }
+            if (count > 0)
+            {
+                ScopedPyObject tuple(PyTuple_New(count));
+                if (!tuple)
+                    return NULL;
+                PyObject *owner = TokenIterator_token_owner(self);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    Token *token = create_token(
+                        self->preprocessor, batch[i], owner);
+                    if (!token)
+                        return NULL;
+                    PyTuple_SetItem(tuple, i, (PyObject*)token);
+                }
+                return tuple.release();
+            }
+            else
+            {
+                TokenIterator_finish(self);
+            }
+        }
+        catch (...)
+        {
+            set_python_exception();
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
 static PyObject* TokenIterator_iternext(TokenIterator *self)
 {
+    if (self->batch_size > 0)
+        return TokenIterator_iternext_batch(self);
+
     if (self->iterator)
     {
         try
         {
             if (self->iterator->has_next())
             {
+                if (self->iterator->is_concurrent())
+                {
+                    cmonster::core::Token token;
+                    {
+                        ScopedGILRelease nogil;
+                        token = self->iterator->next();
+                    }
+                    return (PyObject*)create_token(
+                        self->preprocessor, token, (PyObject*)self);
+                }
+                ScopedParserClaim claim(
+                    get_preprocessor_parser(self->preprocessor));
+                if (!claim.claimed())
+                    return NULL;
                 cmonster::core::Token &token = self->iterator->next();
                 return (PyObject*)create_token(self->preprocessor, token);
             }
             else
             {
-                delete self->iterator;
-                self->iterator = NULL;
+                TokenIterator_finish(self);
             }
         }
         catch (...)
@@ -87,11 +211,25 @@ static PyObject* TokenIterator_iternext(TokenIterator *self)
     return NULL;
 }
 
+// Whether the tokens are produced on a separate thread.
+static PyObject* TokenIterator_get_concurrent(TokenIterator *self, void*)
+{
+    return PyBool_FromLong(self->iterator && self->iterator->is_concurrent());
+}
+
+static PyGetSetDef TokenIterator_getset[] =
+{
+    {(char*)"concurrent", (getter)TokenIterator_get_concurrent, NULL,
+     NULL /* docs */, NULL /* closure */},
+    {NULL}
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static PyType_Slot TokenIteratorTypeSlots[] =
 {
     {Py_tp_dealloc,  (void*)TokenIterator_dealloc},
+    {Py_tp_getset,   (void*)TokenIterator_getset},
     {Py_tp_doc,      (void*)TokenIterator_doc},
     {Py_tp_iter,     (void*)TokenIterator_iter},
     {Py_tp_iternext, (void*)TokenIterator_iternext},
@@ -111,25 +249,91 @@ static PyType_Spec TokenIteratorTypeSpec =
 
 ///////////////////////////////////////////////////////////////////////////////
 
-TokenIterator* create_iterator(Preprocessor *preprocessor)
+TokenIterator*
+create_iterator(Preprocessor *preprocessor, Py_ssize_t batch_size,
+                boost::shared_ptr<cmonster::core::TokenPredicate> const&
+                    predicate,
+                bool pipelined)
 {
+    // The lexing thread of a pipelined iterator has the parser to itself
+    // until the iterator is exhausted.
+    Parser *parser = get_preprocessor_parser(preprocessor);
+    if (pipelined && !claim_parser_for_pipeline(parser))
+        return NULL;
+
+    cmonster::core::TokenIterator *iterator;
+    try
+    {
+        cmonster::core::Preprocessor &pp = get_preprocessor(preprocessor);
+        if (pipelined)
+        {
+            // Construction waits for the first token from the lexing thread.
+            ScopedGILRelease nogil;
+            iterator = pp.create_pipelined_iterator(predicate);
+        }
+        else
+        {
+            ScopedParserClaim claim(parser);
+            if (!claim.claimed())
+                return NULL;
+            iterator = pp.create_iterator(predicate);
+        }
+    }
+    catch (...)
+    {
+        if (pipelined)
+            release_parser_for_pipeline(parser);
+        set_python_exception();
+        return NULL;
+    }
+
+    // The preprocessor may have fallen back to a synchronous iterator.
+    if (pipelined && !iterator->is_concurrent())
+    {
+        release_parser_for_pipeline(parser);
+        pipelined = false;
+    }
+    TokenIterator *iter = create_iterator(preprocessor, iterator, batch_size);
+    if (!iter)
+    {
+        if (pipelined)
+            release_parser_for_pipeline(parser);
+        return NULL;
+    }
+    if (pipelined)
+        iter->pipeline = parser;
+    return iter;
+}
+
+TokenIterator*
+create_iterator(Preprocessor *preprocessor,
+                cmonster::core::TokenIterator *iterator,
+                Py_ssize_t batch_size)
+{
+    std::auto_ptr<cmonster::core::TokenIterator> owned(iterator);
     TokenIterator *iter = (TokenIterator*)PyObject_CallObject(
         (PyObject*)TokenIteratorType, NULL);
-    if (iter)
+    if (!iter)
+        return NULL;
+
+    Py_INCREF(preprocessor);
+    iter->preprocessor = preprocessor;
+    iter->iterator = owned.release();
+    if (batch_size > 0)
     {
         try
         {
-            iter->iterator = get_preprocessor(preprocessor).create_iterator();
+            iter->batch_size = batch_size;
+            iter->batch = new std::vector<cmonster::core::Token>;
+            iter->batch->reserve(batch_size);
         }
         catch (...)
         {
-            PyObject_Del(iter);
+            Py_DECREF(iter);
             set_python_exception();
             return NULL;
         }
     }
-    Py_INCREF(preprocessor);
-    iter->preprocessor = preprocessor;
     return iter;
 }
 
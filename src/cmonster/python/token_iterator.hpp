@@ -23,6 +23,11 @@ SOFTWARE.
 #ifndef _CMONSTER_PYTHON_TOKEN_ITERATOR_HPP
 #define _CMONSTER_PYTHON_TOKEN_ITERATOR_HPP
 
+#include "../core/token_iterator.hpp"
+#include "../core/token_predicate.hpp"
+
+#include <boost/shared_ptr.hpp>
+
 namespace cmonster {
 namespace python {
 
@@ -33,8 +38,28 @@ struct TokenIterator;
 /**
  * Create a new heap-allocated TokenIterator from the specified preprocessor
  * object.
+ *
+ * If batch_size is non-zero, the iterator will yield tuples of up to
+ * batch_size tokens, rather than individual tokens. If a predicate is
+ * specified, only tokens satisfying it will be yielded. If pipelined is true,
+ * the tokens will be produced on a separate thread where possible.
+ */
+TokenIterator*
+create_iterator(Preprocessor *preprocessor, Py_ssize_t batch_size = 0,
+                boost::shared_ptr<cmonster::core::TokenPredicate> const&
+                    predicate =
+                        boost::shared_ptr<cmonster::core::TokenPredicate>(),
+                bool pipelined = false);
+
+/**
+ * Create a new heap-allocated TokenIterator wrapping an existing core
+ * iterator, which must yield tokens belonging to the specified preprocessor.
+ * The TokenIterator takes ownership of "iterator", even on failure.
  */
-TokenIterator* create_iterator(Preprocessor *preprocessor);
+TokenIterator*
+create_iterator(Preprocessor *preprocessor,
+                cmonster::core::TokenIterator *iterator,
+                Py_ssize_t batch_size = 0);
 
 /**
  * Initialise the TokenIterator Python type object.
@@ -27,6 +27,7 @@ SOFTWARE.
 #include <Python.h>
 
 #include "exception.hpp"
+#include "gil.hpp"
 #include "scoped_pyobject.hpp"
 #include "token_predicate.hpp"
 #include "token.hpp"
@@ -55,9 +56,14 @@ TokenPredicate::~TokenPredicate()
 
 bool TokenPredicate::operator()(cmonster::core::Token const& token) const
 {
+    // The preprocessor may be running without the GIL.
+    ScopedGILAcquire gil;
+
     // Create the arguments tuple.
-    ScopedPyObject args_tuple =
-        Py_BuildValue("(O)", create_token(m_preprocessor, token));
+    PyObject *py_token = (PyObject*)create_token(m_preprocessor, token);
+    if (!py_token)
+        throw python_exception();
+    ScopedPyObject args_tuple = Py_BuildValue("(N)", py_token);
     if (!args_tuple)
         throw python_exception();
 
@@ -65,7 +71,10 @@ bool TokenPredicate::operator()(cmonster::core::Token const& token) const
     ScopedPyObject result = PyObject_Call(m_callable, args_tuple, NULL);
     if (!result)
         throw python_exception();
-    return PyObject_IsTrue(result);
+    const int truth = PyObject_IsTrue(result);
+    if (truth == -1)
+        throw python_exception();
+    return truth != 0;
 }
 
 }}
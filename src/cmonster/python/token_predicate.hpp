@@ -40,6 +40,11 @@ public:
 
     bool operator()(cmonster::core::Token const& token) const;
 
+    /**
+     * Calling into Python needs the GIL, which the consumer may hold.
+     */
+    bool is_concurrent_safe() const {return false;}
+
 private:
     Preprocessor *m_preprocessor;
     PyObject *m_callable;
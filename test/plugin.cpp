@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// A plugin for test_define.py, which builds it and loads it.
+
+#include "cmonster/core/plugin.hpp"
+
+namespace {
+
+// Expands to its arguments, twice.
+class Twice : public cmonster::core::FunctionMacro
+{
+public:
+    void operator()(clang::SourceLocation const& location,
+                    std::vector<cmonster::core::Token> const& args,
+                    std::vector<cmonster::core::Token> &result) const
+    {
+        result.insert(result.end(), args.begin(), args.end());
+        result.insert(result.end(), args.begin(), args.end());
+    }
+};
+
+}
+
+CMONSTER_PLUGIN(preprocessor)
+{
+    boost::shared_ptr<cmonster::core::FunctionMacro> twice(new Twice);
+    preprocessor.define("TWICE", twice);
+}
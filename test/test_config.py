@@ -0,0 +1,136 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+import cmonster
+from cmonster import config
+from cmonster.config import gcc
+import os
+import shutil
+import stat
+import tempfile
+import unittest
+
+class TestGccProfile(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.old_cache_dir = os.environ.get("CMONSTER_CACHE_DIR")
+        os.environ["CMONSTER_CACHE_DIR"] = os.path.join(self.tmpdir, "cache")
+
+        # A fake compiler, which counts how many times it has been run.
+        self.compiler = os.path.join(self.tmpdir, "fake-gcc")
+        self.counter = os.path.join(self.tmpdir, "count")
+        with open(self.compiler, "w") as f:
+            f.write("#!/bin/sh\n"
+                    "echo x >> %s\n"
+                    "echo '#define FAKE 1'\n"
+                    "echo 'gcc version 1.0 (fake)' >&2\n"
+                    "echo '#include <...> search starts here:' >&2\n"
+                    "echo ' /fake/include' >&2\n"
+                    "echo 'End of search list.' >&2\n" % self.counter)
+        os.chmod(self.compiler, stat.S_IRWXU)
+
+
+    def tearDown(self):
+        if self.old_cache_dir is None:
+            del os.environ["CMONSTER_CACHE_DIR"]
+        else:
+            os.environ["CMONSTER_CACHE_DIR"] = self.old_cache_dir
+        shutil.rmtree(self.tmpdir)
+
+
+    def runs(self):
+        if not os.path.exists(self.counter):
+            return 0
+        with open(self.counter) as f:
+            return len(f.readlines())
+
+
+    def test_profile_is_lazy(self):
+        gcc.Profile(self.compiler, "c")
+        self.assertEqual(0, self.runs())
+
+
+    def test_profile_is_cached(self):
+        profile = gcc.Profile(self.compiler, "c")
+        self.assertEqual("#define FAKE 1\n", profile.predefines)
+        self.assertEqual(["/fake/include"], profile.include_dirs)
+        self.assertEqual("gcc version 1.0 (fake)", profile.version)
+        self.assertEqual(1, self.runs())
+
+        profile = gcc.Profile(self.compiler, "c")
+        self.assertEqual("#define FAKE 1\n", profile.predefines)
+        self.assertEqual("gcc version 1.0 (fake)", profile.version)
+        self.assertEqual(1, self.runs())
+
+        # A different language is a different profile.
+        gcc.Profile(self.compiler, "c++").predefines
+        self.assertEqual(2, self.runs())
+
+
+    def test_profile_key(self):
+        # Computing the key doesn't run the compiler; changing the compiler
+        # changes the key.
+        key = gcc.Profile(self.compiler, "c").key
+        self.assertEqual(key, gcc.Profile(self.compiler, "c").key)
+        self.assertEqual(0, self.runs())
+        with open(self.compiler, "a") as f:
+            f.write("# changed\n")
+        self.assertNotEqual(key, gcc.Profile(self.compiler, "c").key)
+        self.assertEqual(0, self.runs())
+
+
+class TestConfiguration(unittest.TestCase):
+    def test_install(self):
+        conf = config.Configuration()
+        conf.define("A", "1")
+        conf.load_macro_buffer("#define B(x) x x\n")
+        conf.add_include_dir("/usr/include")
+        self.assertEqual(("/usr/include",), conf.system_include_dirs)
+        for data, expected in (("A", ["1"]), ("B(2)", ["2", "2"])):
+            parser = cmonster.Parser("test.c", data=data, configuration=conf)
+            toks = [str(tok) for tok in parser.preprocessor]
+            self.assertEqual(expected, toks)
+
+
+    def test_existing_macros_are_kept(self):
+        # A configuration doesn't redefine Clang's builtin macros, or those
+        # defined on the preprocessor after it was installed.
+        conf = config.Configuration()
+        conf.define("A", "1")
+        conf.define("__STDC__", "2")
+        parser = cmonster.Parser(
+            "test.c", data="A __STDC__", configuration=conf)
+        self.assertEqual(["1", "1"], [str(t) for t in parser.preprocessor])
+        parser = cmonster.Parser(
+            "test.c", data="A __STDC__", configuration=conf)
+        parser.preprocessor.define("A", "3")
+        self.assertEqual(["3", "1"], [str(t) for t in parser.preprocessor])
+
+
+    def test_default_configuration_is_shared(self):
+        self.assertIs(config.default_configuration(),
+                      config.default_configuration())
+
+
+if __name__ == "__main__":
+    unittest.main()
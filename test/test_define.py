@@ -21,10 +21,34 @@
 # FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 # OTHER DEALINGS IN THE SOFTWARE.
 
+from cmonster._cmonster import tok_identifier, tok_numeric_constant
 import cmonster
+import distutils.ccompiler
+import distutils.sysconfig
 import os
+import subprocess
+import tempfile
 import unittest
 
+
+def build_plugin(output_dir):
+    "Build the test plugin, plugin.cpp, returning the shared object's path."
+    here = os.path.dirname(os.path.abspath(__file__))
+    llvm_includedir = subprocess.check_output(
+        ["llvm-config", "--includedir"]).decode().strip()
+    compiler = distutils.ccompiler.new_compiler()
+    distutils.sysconfig.customize_compiler(compiler)
+    objects = compiler.compile(
+        [os.path.join(here, "plugin.cpp")],
+        output_dir=output_dir,
+        macros=[("__STDC_LIMIT_MACROS", 1), ("__STDC_CONSTANT_MACROS", 1)],
+        include_dirs=[os.path.join(here, os.pardir, "src"), llvm_includedir],
+        extra_preargs=["-fno-rtti"])
+    compiler.link_shared_object(
+        objects, "plugin.so", output_dir=output_dir, target_lang="c++")
+    return os.path.join(output_dir, "plugin.so")
+
+
 class TestDefine(unittest.TestCase):
     def test_define_object(self):
         pp = cmonster.Preprocessor("test.c", data="ABC")
@@ -62,6 +86,176 @@ class TestDefine(unittest.TestCase):
         self.assertEqual("123", str(toks[0]))
 
 
+    def test_define_python_function_arguments(self):
+        def ABC(*args):
+            return "".join(reversed("".join(map(str, args))))
+        pp = cmonster.Preprocessor("test.c", data="ABC x ABC(DEF) ABC((1))")
+        pp.define("DEF", "321")
+        pp.define(ABC)
+        toks = [str(tok) for tok in pp]
+        # The name alone is not expanded, and the arguments are expanded
+        # before the function is called.
+        self.assertEqual(["ABC", "x", "123", ")", "1", "("], toks)
+
+
+    def test_define_python_function_as_argument(self):
+        def PYMAC(*args):
+            return "[%s]" % "".join(map(str, args))
+        pp = cmonster.Preprocessor("test.c", data="""\
+#define APPLY(f, x) f(x)
+#define CALL(f) f
+APPLY(PYMAC, 1) CALL(PYMAC)(2)""")
+        pp.define(PYMAC)
+        toks = [str(tok) for tok in pp]
+        # A name that isn't followed by an argument list is left alone, so
+        # it may still be expanded once it is.
+        self.assertEqual(["[", "1", "]", "[", "2", "]"], toks)
+
+
+    def test_read_until(self):
+        captured = []
+        def BEGIN(*args):
+            captured.append(pp.read_until("END"))
+            return "x"
+        pp = cmonster.Preprocessor(
+            "test.c", data="BEGIN()  a /* b */\n\tc END d")
+        pp.define(BEGIN)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["x", "d"], toks)
+        # The text preceding the first token is replaced with whitespace, as
+        # are comments.
+        self.assertEqual(["         a        \n\tc "], captured)
+
+
+    def test_token_arena(self):
+        def ABC(arg):
+            return "1 2 3"
+        pp = cmonster.Preprocessor("test.c", data="ABC(x)")
+        pp.define(ABC)
+        toks = iter(pp)
+        self.assertEqual("1", str(next(toks)))
+        self.assertGreater(pp.token_arena_info()["bytes_in_use"], 0)
+
+        # The arena is reset at the end of the main file.
+        self.assertEqual(["2", "3"], [str(tok) for tok in toks])
+        info = pp.token_arena_info()
+        self.assertEqual(0, info["bytes_in_use"])
+        self.assertEqual(1, info["resets"])
+
+
+    def test_define_context_function(self):
+        contexts = []
+        @cmonster.context_macro
+        def ABC(context):
+            contexts.append(context)
+            self.assertEqual(2, len(context.args))
+            self.assertEqual(str(context.args[1]), context.args.spelling(-1))
+            self.assertEqual(1, context.location.line)
+            return [context.args[1], context.args[0]]
+        # Arguments are passed as a flat list of tokens.
+        pp = cmonster.Preprocessor("test.c", data="ABC(a b) ABC(c d)")
+        pp.define(ABC)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["b", "a", "d", "c"], toks)
+
+        # Arguments are not valid outside of the call.
+        self.assertRaises(RuntimeError, len, contexts[0].args)
+        self.assertRaises(RuntimeError, getattr, contexts[1], "location")
+
+
+    def test_pragma_context(self):
+        seen = []
+        @cmonster.context_macro
+        def handler(context):
+            args = context.args
+            seen.extend((args.token_id(i), args.spelling(i))
+                        for i in range(len(args)))
+            return "y"
+        pp = cmonster.Preprocessor("test.c", data="#pragma gen a 1\nx")
+        pp.add_pragma("gen", handler)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["y", "x"], toks)
+        self.assertEqual([(tok_identifier, "a"), (tok_numeric_constant, "1")],
+                         seen)
+
+
+    def test_define_pure_function(self):
+        calls = []
+        @cmonster.pure_macro
+        def ABC(arg):
+            calls.append(str(arg))
+            return "".join(reversed(str(arg)))
+
+        cache = cmonster.MacroCache(capacity=16)
+        inputs = [("ABC(321) ABC(321) ABC(654)", ["123", "123", "456"]),
+                  ("ABC(321)", ["123"])]
+        for data, expected in inputs:
+            pp = cmonster.Preprocessor("test.c", data=data)
+            pp.set_macro_cache(cache)
+            pp.define(ABC)
+            self.assertEqual(expected, [str(tok) for tok in pp])
+
+        # The second preprocessor shares the first one's expansions.
+        self.assertEqual(["321", "654"], calls)
+        info = cache.info()
+        self.assertEqual(2, info["hits"])
+        self.assertEqual(2, info["misses"])
+        self.assertEqual(2, info["size"])
+        self.assertEqual(16, info["capacity"])
+
+        # A redefined macro doesn't see the old definition's expansions.
+        for suffix in ("1", "2"):
+            @cmonster.pure_macro
+            def ABC(arg):
+                return str(arg) + suffix
+            pp = cmonster.Preprocessor("test.c", data="ABC(x)")
+            pp.set_macro_cache(cache)
+            pp.define(ABC)
+            self.assertEqual(["x" + suffix], [str(tok) for tok in pp])
+
+
+    def test_load_plugin_invalid(self):
+        pp = cmonster.Preprocessor("test.c", data="")
+        with self.assertRaises(RuntimeError):
+            pp.load_plugin("/nonexistent/cmonster-plugin.so")
+
+
+    def test_load_plugin(self):
+        with tempfile.TemporaryDirectory() as d:
+            plugin = build_plugin(d)
+            pp = cmonster.Preprocessor("test.c", data="TWICE(abc)")
+            pp.load_plugin(plugin)
+            self.assertEqual(["abc", "abc"], [str(t) for t in pp])
+
+
+    def test_load_macro_buffer(self):
+        pp = cmonster.Preprocessor("test.c", data="A B(1, 2) C D(3)")
+        count = pp.load_macro_buffer(
+            "#define A 1\n"
+            "#define B(x, y) x + y\n"
+            "#undef C\n"
+            "#define C\n"
+            "#define D(...) __VA_ARGS__\n")
+        self.assertEqual(4, count)
+        toks = [str(tok) for tok in pp]
+        self.assertEqual(["1", "1", "+", "2", "3"], toks)
+
+
+    def test_load_macro_buffer_atomic(self):
+        pp = cmonster.Preprocessor("test.c", data="A B")
+        pp.define("B", "2")
+        buffer = "#define A 1\n#define B 3\n"
+        self.assertEqual(0, pp.load_macro_buffer(buffer, atomic=True))
+        self.assertEqual(["A", "2"], [str(tok) for tok in pp])
+
+
+    def test_define_many(self):
+        pp = cmonster.Preprocessor("test.c", data="A B(1) C")
+        count = pp.define_many([("A", "1"), ("B(x)", "x x"), "C"])
+        self.assertEqual(3, count)
+        self.assertEqual(["1", "1", "1"], [str(tok) for tok in pp])
+
+
 if __name__ == "__main__":
     unittest.main()
 
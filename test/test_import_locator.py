@@ -66,6 +66,163 @@ class TestIncludeLocator(unittest.TestCase):
             self.assertEqual("abc", str(tokens[0]))
 
 
+    def test_include_cache(self):
+        with tempfile.TemporaryDirectory() as d:
+            header = os.path.join(d, "located.h")
+            with open(header, "w") as f:
+                f.write("abc\n")
+            calls = []
+            def locator(include):
+                calls.append(include)
+                return header if include == "<located.h>" else None
+
+            # Both positive and negative results are cached.
+            cache = cmonster.IncludeCache()
+            for data in ["#include <located.h>"] * 2:
+                pp = cmonster.Preprocessor("test.c", data=data)
+                pp.set_include_locator(locator)
+                pp.set_include_cache(cache)
+                self.assertEqual(["abc"], [str(t) for t in pp])
+            # A cache set before the locator is kept.
+            for data in ["#include <missing.h>"] * 2:
+                pp = cmonster.Preprocessor("test.c", data=data)
+                pp.set_include_cache(cache)
+                pp.set_include_locator(locator)
+                with self.assertRaises(Exception):
+                    tokens = [t for t in pp]
+            self.assertEqual(["<located.h>", "<missing.h>"], calls)
+
+            # A saved cache may be loaded by another process.
+            path = os.path.join(d, "includes.bin")
+            cache.save(path)
+            loaded = cmonster.IncludeCache()
+            self.assertEqual(2, loaded.load(path))
+            self.assertEqual(2, loaded.info()["size"])
+
+            # Expired negative results are located again.
+            del calls[:]
+            cache = cmonster.IncludeCache(negative_ttl=0)
+            for data in ["#include <missing.h>"] * 2:
+                pp = cmonster.Preprocessor("test.c", data=data)
+                pp.set_include_locator(locator)
+                pp.set_include_cache(cache)
+                with self.assertRaises(Exception):
+                    tokens = [t for t in pp]
+            self.assertEqual(["<missing.h>"] * 2, calls)
+
+
+    def test_search_path_locator(self):
+        with tempfile.TemporaryDirectory() as d:
+            os.mkdir(os.path.join(d, "sub"))
+            for name in ("a.h", "sub/b.h"):
+                with open(os.path.join(d, name), "w") as f:
+                    f.write("abc\n")
+            locator = cmonster.SearchPathIncludeLocator(["/nonexistent", d])
+            self.assertEqual(os.path.join(d, "a.h"), locator("<a.h>"))
+            self.assertEqual(os.path.join(d, "sub/b.h"), locator('"sub/b.h"'))
+            self.assertIsNone(locator("<sub/c.h>"))
+
+            # Directories are indexed once, until refreshed.
+            with open(os.path.join(d, "c.h"), "w") as f:
+                f.write("abc\n")
+            self.assertIsNone(locator("<c.h>"))
+            locator.refresh()
+            self.assertEqual(os.path.join(d, "c.h"), locator("<c.h>"))
+
+            pp = cmonster.Preprocessor("test.c", data="#include <a.h>")
+            pp.set_include_locator(locator)
+            self.assertEqual(["abc"], [str(t) for t in pp])
+
+
+    def test_set_include_dirs(self):
+        with tempfile.TemporaryDirectory() as d1:
+            with tempfile.TemporaryDirectory() as d2:
+                for d, name, value in ((d1, "a.h", "one"), (d2, "a.h", "two"),
+                                       (d2, "b.h", "three")):
+                    with open(os.path.join(d, name), "w") as f:
+                        f.write(value + "\n")
+
+                # The first occurrence of a directory wins, however it is
+                # spelled.
+                for index in (False, True):
+                    pp = cmonster.Preprocessor(
+                        "test.c", data="#include <a.h>\n#include <b.h>")
+                    pp.set_include_dirs(angled=[d2 + "/", "/nonexistent"],
+                                        system=[d1, d2], index=index)
+                    self.assertEqual(["two", "three"], [str(t) for t in pp])
+
+
+    def test_include_locator_priority(self):
+        with tempfile.TemporaryDirectory() as d1:
+            with tempfile.TemporaryDirectory() as d2:
+                os.mkdir(os.path.join(d1, "gen"))
+                for d, name, value in ((d1, "gen/a.h", "searched"),
+                                       (d2, "a.h", "located")):
+                    with open(os.path.join(d, name), "w") as f:
+                        f.write(value + "\n")
+                calls = []
+                def locator(include):
+                    calls.append(include)
+                    if include == "<gen/a.h>":
+                        return os.path.join(d2, "a.h")
+
+                # Includes with a "first" prefix go straight to the locator.
+                pp = cmonster.Preprocessor("test.c", data="#include <gen/a.h>")
+                pp.set_include_dirs(angled=[d1])
+                pp.set_include_locator(locator)
+                pp.set_include_locator_priority(first=["gen/"])
+                self.assertEqual(["located"], [str(t) for t in pp])
+
+                # Without a fallback, the locator isn't consulted for others.
+                pp = cmonster.Preprocessor("test.c", data="#include <b.h>")
+                pp.set_include_dirs(angled=[d1])
+                pp.set_include_locator(locator)
+                pp.set_include_locator_priority(first=["gen/"], fallback=False)
+                with self.assertRaises(Exception):
+                    tokens = [t for t in pp]
+                self.assertEqual(["<gen/a.h>"], calls)
+
+
+    def test_include_locator_priority_nested(self):
+        with tempfile.TemporaryDirectory() as d:
+            gen = os.path.join(d, "gen")
+            os.mkdir(gen)
+            for name, value in (("a.h", "nested"), ("b.h", "located")):
+                with open(os.path.join(gen, name), "w") as f:
+                    f.write(value + "\n")
+            calls = []
+            def locator(include):
+                calls.append(include)
+                if include == "<gen/b.h>":
+                    return os.path.join(gen, "b.h")
+
+            # "a.h" is found in the nested search directory, although its
+            # path within the outer one starts with a "first" prefix.
+            pp = cmonster.Preprocessor("test.c", data="#include <a.h>")
+            pp.set_include_dirs(angled=[d, gen], index=True)
+            pp.set_include_locator(locator)
+            pp.set_include_locator_priority(first=["gen/"])
+            self.assertEqual(["nested"], [str(t) for t in pp])
+            self.assertEqual([], calls)
+
+            # The locator may return the path that header search skipped.
+            pp = cmonster.Preprocessor("test.c", data="#include <gen/b.h>")
+            pp.set_include_dirs(angled=[d], index=True)
+            pp.set_include_locator(locator)
+            pp.set_include_locator_priority(first=["gen/"])
+            self.assertEqual(["located"], [str(t) for t in pp])
+            self.assertEqual(["<gen/b.h>"], calls)
+
+
+    def test_include_locator_priority_bad_fallback(self):
+        class Bad(object):
+            def __bool__(self):
+                raise ValueError("bad")
+        pp = cmonster.Preprocessor("test.c", data="")
+        with self.assertRaises(ValueError):
+            pp.set_include_locator_priority(first=["gen/"], fallback=Bad())
+
+
     def test_include_fileio(self):
         self.fail("not implemented")
 
@@ -74,6 +74,31 @@ class TestParser(unittest.TestCase):
         self.assertEqual(123, return_value.subexpr.value)
 
 
+    def test_concurrent_use_rejected(self):
+        # While one thread is preprocessing, with the GIL released, no other
+        # thread may use the parser or its preprocessor.
+        import threading
+        entered, release = threading.Event(), threading.Event()
+        p = cmonster.Parser("test.c", data="BLOCK()")
+        def BLOCK():
+            entered.set()
+            release.wait()
+            return "x"
+        p.preprocessor.define(BLOCK)
+        thread = threading.Thread(
+            target=p.preprocessor.preprocess, args=(os.devnull,))
+        thread.start()
+        try:
+            entered.wait()
+            with self.assertRaises(RuntimeError):
+                p.preprocessor.preprocess(os.devnull)
+            with self.assertRaises(RuntimeError):
+                p.parse()
+        finally:
+            release.set()
+            thread.join()
+
+
     def test_invalid_toplevel_decl(self):
         p = cmonster.Parser(
             "test.c",
@@ -0,0 +1,151 @@
+# Copyright (c) 2011 Andrew Wilkins <axwalk@gmail.com>
+# 
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+# 
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+from cmonster._preprocessor import CodeCache, _template_definition
+import cmonster
+import os
+import shutil
+import tempfile
+import unittest
+
+class TestCodeCache(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+
+    def test_memory(self):
+        cache = CodeCache(capacity=1)
+        source = "def f(x):\n    return x\n"
+        code = cache.compile(source)
+        self.assertIs(code, cache.compile(source))
+        cache.compile("def g(x):\n    return x\n")
+        info = cache.info()
+        self.assertEqual(1, info["hits"])
+        self.assertEqual(2, info["misses"])
+        self.assertEqual(1, info["size"])
+
+
+    def test_key(self):
+        cache = CodeCache()
+        calls = []
+        def format_source():
+            calls.append(None)
+            return "def f(x):\n    return x\n"
+        key = ["f", "(", "x", ")", "    return x\n"]
+        code = cache.compile(format_source, key)
+        # The source is only formatted if the code must be compiled.
+        self.assertIs(code, cache.compile(format_source, key))
+        self.assertEqual(1, len(calls))
+
+
+    def test_disk(self):
+        source = "def f(x):\n    return x * 2\n"
+        CodeCache(self.tmpdir).compile(source)
+        self.assertEqual(1, len(os.listdir(self.tmpdir)))
+
+        # A new cache (e.g. in another process) loads the marshalled code.
+        code = CodeCache(self.tmpdir).compile(source)
+        locals_ = {}
+        eval(code, {}, locals_)
+        self.assertEqual(4, locals_["f"](2))
+
+
+class TestTemplate(unittest.TestCase):
+    def test_simple(self):
+        self.assertEqual(
+            "#define CALL(f) f (1, 2)\n",
+            _template_definition("def CALL(f):\n    return f'{f}(1, 2)'\n"))
+
+
+    def test_paste(self):
+        self.assertEqual(
+            "#define __cmonster_template_CAT(x) foo_ ## x\n"
+            "#define CAT(x) __cmonster_template_CAT(x)\n",
+            _template_definition(
+                "def CAT(x):\n    return 'foo_' + str(x)\n"))
+
+
+    def test_not_template(self):
+        for source in ("def F(x, y):\n    return str(x) + str(y)\n",
+                       "def F(x):\n    return str(x)[::-1]\n",
+                       "def F(x):\n    return 'x' + str(x)\n",
+                       "def F(x):\n    return '#' + str(x)\n",
+                       "def F():\n    return str(location)\n"):
+            self.assertIsNone(_template_definition(source), source)
+
+
+    def test_comment(self):
+        # C comments in the body are blanked out, keeping its layout.
+        data = ("py_def(F(x))\n"
+                "    /* A comment,\n"
+                "       spanning lines. */\n"
+                "    y = str(x) + '_f' // Trailing.\n"
+                "    return y /* End. */\n"
+                "py_end\n"
+                "F(a)\n")
+        pp = cmonster.Preprocessor("test.c", data=data)
+        self.assertEqual(["a_f"], [str(t) for t in pp])
+
+
+    def test_native(self):
+        data = ("py_def(CALL(f))\n"
+                "    return f'{f}(1, 2)'\n"
+                "py_end\n"
+                "CALL(g)\n")
+        pp = cmonster.Preprocessor("test.c", data=data)
+        self.assertEqual(["g", "(", "1", ",", "2", ")"], [str(t) for t in pp])
+
+
+    def test_native_paste(self):
+        # Arguments are macro expanded before they are pasted, as they would
+        # be passed to the Python function.
+        data = ("#define Y bar\n"
+                "py_def(CAT(x))\n"
+                "    return 'foo_' + str(x)\n"
+                "py_end\n"
+                "CAT(Y)\n"
+                "#ifdef __cmonster_template_CAT\n"
+                "native\n"
+                "#endif\n")
+        pp = cmonster.Preprocessor("test.c", data=data)
+        self.assertEqual(["foo_bar", "native"], [str(t) for t in pp])
+
+
+    def test_native_helper_conflict(self):
+        # If the helper can't be defined, neither is the macro; the function
+        # is defined in Python instead.
+        data = ("py_def(CAT(x))\n"
+                "    return 'foo_' + str(x)\n"
+                "py_end\n"
+                "CAT(y)\n")
+        pp = cmonster.Preprocessor("test.c", data=data)
+        pp.define("__cmonster_template_CAT(x)", "wrong")
+        self.assertEqual(["foo_y"], [str(t) for t in pp])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -34,6 +34,161 @@ class TestToken(unittest.TestCase):
         self.assertEqual(3, len(toks[0]))
 
 
+    def test_iter_batches(self):
+        pp = cmonster.Preprocessor("test.c", data="a b c d e")
+        batches = [batch for batch in pp.iter_batches(2)]
+        self.assertEqual([2, 2, 1], [len(batch) for batch in batches])
+        toks = [str(tok) for batch in batches for tok in batch]
+        self.assertEqual(["a", "b", "c", "d", "e"], toks)
+
+
+    def test_iter_batches_invalid_size(self):
+        pp = cmonster.Preprocessor("test.c", data="a")
+        with self.assertRaises(ValueError):
+            pp.iter_batches(0)
+
+
+    def test_iter_filtered_identifiers(self):
+        pp = cmonster.Preprocessor("test.c", data="int a = b + a;")
+        toks = [str(tok) for tok in pp.iter_filtered(identifiers=["a"])]
+        self.assertEqual(["a", "a"], toks)
+
+
+    def test_iter_filtered_kinds_and_predicate(self):
+        pp = cmonster.Preprocessor("test.c", data="int a = 1 + 2;")
+        toks = pp.iter_filtered(
+            kinds=[cmonster.tok_numeric_constant],
+            predicate=lambda tok: str(tok) != "1")
+        self.assertEqual(["2"], [str(tok) for tok in toks])
+
+
+    def test_iter_filtered_files(self):
+        import tempfile
+        with tempfile.TemporaryDirectory() as d:
+            for name in ("a", "b"):
+                with open(os.path.join(d, name + ".h"), "w") as f:
+                    f.write("%s_tok\n" % name)
+            data = '#include "a.h"\n#include "b.h"\nmain_tok\n'
+            for kwargs, expected in (
+                    ({"main_file": True}, ["main_tok"]),
+                    ({"main_file": False}, ["a_tok", "b_tok", "main_tok"]),
+                    ({"files": [os.path.join(d, "b.h")]}, ["b_tok"]),
+                    ({"files": [os.path.join(d, "b.h")], "main_file": True},
+                     [])):
+                pp = cmonster.Preprocessor("test.c", data=data)
+                pp.add_include_dir(d)
+                toks = [str(tok) for tok in pp.iter_filtered(**kwargs)]
+                self.assertEqual(expected, toks, kwargs)
+
+
+    def test_tokenize(self):
+        pp = cmonster.Preprocessor("test.c", data="X")
+        pp.define("X", "int")
+        toks = pp.tokenize('#define Y "y"\nint Y')
+        self.assertEqual(
+            ["#", "define", "Y", '"y"', "int", "Y"], [str(t) for t in toks])
+        self.assertEqual(cmonster.tok_string_literal, toks[3].token_id)
+        self.assertEqual(cmonster.tok_kw_int, toks[4].token_id)
+        self.assertEqual(cmonster.tok_identifier, toks[5].token_id)
+        self.assertEqual(["int"], [str(tok) for tok in pp])
+
+
+    def test_tokenize_cache(self):
+        pp = cmonster.Preprocessor("test.c", data="")
+        before = pp.tokenize_cache_info()
+        first = pp.tokenize("a + 1")
+        second = pp.tokenize("a + 1")
+        self.assertEqual([str(t) for t in first], [str(t) for t in second])
+        info = pp.tokenize_cache_info()
+        self.assertEqual(before["misses"] + 1, info["misses"])
+        self.assertEqual(before["hits"] + 1, info["hits"])
+
+        pp.set_tokenize_cache_capacity(1)
+        pp.tokenize("b")
+        pp.tokenize("a + 1")
+        info = pp.tokenize_cache_info()
+        self.assertEqual(1, info["size"])
+        self.assertEqual(before["misses"] + 3, info["misses"])
+
+
+    def test_iter_pipelined(self):
+        data = " ".join("tok%d" % i for i in range(10000))
+        pp = cmonster.Parser("test.c", data=data)
+        # Parser defines py_def, so this falls back to the synchronous
+        # iterator; use the raw extension type to get a pipelined one.
+        raw = cmonster._cmonster.Parser(data, "test.c").preprocessor
+        for p in (pp.preprocessor, raw):
+            toks = [str(tok) for tok in p.iter_filtered(pipelined=True)]
+            self.assertEqual(data.split(), toks)
+        self.assertFalse(
+            pp.preprocessor.iter_filtered(pipelined=True).concurrent)
+
+        # The preprocessor can't be used while the lexing thread is.
+        raw = cmonster._cmonster.Parser(data, "test.c").preprocessor
+        it = raw.iter_filtered(pipelined=True)
+        self.assertTrue(it.concurrent)
+        self.assertRaises(RuntimeError, raw.define, "A")
+        self.assertRaises(RuntimeError, raw.tokenize, "a")
+        self.assertRaises(RuntimeError, raw.next)
+        self.assertRaises(RuntimeError, raw.iter_filtered, pipelined=True)
+        toks = list(it)
+        del it
+        raw.define("A")
+
+        # Tokens keep their resolved info after the iterator is gone.
+        self.assertEqual(data.split(), [str(tok) for tok in toks])
+
+        # Spellings and locations are resolved on the lexing thread.
+        raw = cmonster._cmonster.Parser("a += b;\nc", "test.c").preprocessor
+        toks = [(str(tok), tok.location.line, tok.location.column)
+                for tok in raw.iter_filtered(pipelined=True)]
+        self.assertEqual([("a", 1, 1), ("+=", 1, 3), ("b", 1, 6),
+                          (";", 1, 7), ("c", 2, 1)], toks)
+
+        # A Python predicate needs the GIL, so it is not evaluated on the
+        # lexing thread.
+        raw = cmonster._cmonster.Parser(data, "test.c").preprocessor
+        toks = [str(tok) for tok in raw.iter_filtered(
+                    predicate=lambda tok: str(tok) != "tok1",
+                    pipelined=True)]
+        self.assertEqual(data.split()[:1] + data.split()[2:], toks)
+
+
+    def test_record_replay(self):
+        import tempfile
+        data = '#define STR(x) #x\nint x = 123; char *s = STR(abc "d");\n'
+        pp = cmonster.Preprocessor("test.c", data=data)
+        expected = [(tok.token_id, str(tok)) for tok in
+                    cmonster.Preprocessor("test.c", data=data)]
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        try:
+            self.assertEqual(len(expected), pp.record(path))
+            replay = cmonster.Preprocessor("replay.c", data="")
+            self.assertEqual(
+                expected,
+                [(tok.token_id, str(tok)) for tok in replay.replay(path)])
+            batches = list(replay.replay(path, 4))
+            self.assertEqual(len(expected), sum(map(len, batches)))
+
+            # A stream recorded again is replayed afresh.
+            cmonster.Preprocessor("test.c", data="a b").record(path)
+            replayed = list(replay.replay(path))
+            self.assertEqual(["a", "b"], [str(tok) for tok in replayed])
+
+            # Even if its size and mtime are unchanged; and the tokens that
+            # were already replayed are unaffected.
+            st = os.stat(path)
+            cmonster.Preprocessor("test.c", data="c d").record(path)
+            self.assertEqual(st.st_size, os.stat(path).st_size)
+            os.utime(path, (st.st_atime, st.st_mtime))
+            self.assertEqual(
+                ["c", "d"], [str(tok) for tok in replay.replay(path)])
+            self.assertEqual(["a", "b"], [str(tok) for tok in replayed])
+        finally:
+            os.remove(path)
+
+
 if __name__ == "__main__":
     unittest.main()
 